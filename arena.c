@@ -0,0 +1,243 @@
+/*	arena.c
+ *
+ * Memory for the lines of a buffer.
+ *
+ * Every buffer has an arena that its lines (and the text of lines that got a
+ * copy of their own) are carved from. Blocks come in size classes: steps of
+ * ALIGN bytes up to SMALLMAX, then powers of two up to BIGMIN. A freed block
+ * goes on the free list of its class and is handed out again for the next
+ * block of that class. New blocks are cut from chunks that double in size
+ * as the arena grows, so reading in a file takes a handful of allocations
+ * and clearing a buffer just drops its chunks. Blocks bigger than the
+ * biggest class are allocated one by one, on a list of their own so that
+ * they can be dropped with the rest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "arena.h"
+
+#define	ALIGN		8	/* Size class step, block alignment     */
+#define	SMALLMAX	256	/* Biggest class in steps of ALIGN      */
+#define	NSMALL		(SMALLMAX / ALIGN)
+#define	BIGMIN		4096	/* Biggest class of all                 */
+#define	NCLASS		(NSMALL + 4)	/* 512 ... BIGMIN               */
+#define	CHUNKMIN	65536L	/* First chunk of an arena              */
+#define	CHUNKMAX	8388608L	/* Chunks stop growing here     */
+
+struct chunk {
+	struct chunk *c_next;	/* Next older chunk                     */
+	long c_size;		/* Size, including this header          */
+};
+
+struct bigblock {
+	struct bigblock *g_next;	/* Links of the big block list  */
+	struct bigblock *g_prev;
+	long g_size;		/* Size, including this header          */
+};
+
+struct arena {
+	struct chunk *a_chunks;	/* Chunks, newest first                 */
+	char *a_next;		/* Unused part of the newest chunk      */
+	char *a_end;
+	long a_chunksize;	/* Size of the next chunk               */
+	struct bigblock *a_big;	/* Blocks too big for a class           */
+	void *a_free[NCLASS];	/* Free list of each size class         */
+	long a_reserved;	/* Bytes got from malloc                */
+	long a_live;		/* Bytes handed out                     */
+};
+
+/* Counts over all arenas, for "$arena". */
+static long reserved;		/* Bytes got from malloc                */
+static long live;		/* Bytes handed out                     */
+static long nalloc;		/* Blocks handed out                    */
+static long nhit;		/* ... of which came off a free list    */
+
+/*
+ * Size class of a block of "size" bytes, or -1 if it is too big for one.
+ */
+static int sizeclass(int size)
+{
+	int c;
+	int n;
+
+	if (size <= SMALLMAX)
+		return size <= ALIGN ? 0 : (size + ALIGN - 1) / ALIGN - 1;
+	if (size > BIGMIN)
+		return -1;
+	c = NSMALL;
+	for (n = SMALLMAX * 2; n < size; n <<= 1)
+		++c;
+	return c;
+}
+
+/*
+ * Size of the blocks of class "c".
+ */
+static int classsize(int c)
+{
+	if (c < NSMALL)
+		return (c + 1) * ALIGN;
+	return SMALLMAX << (c - NSMALL + 1);
+}
+
+/*
+ * Create an empty arena. Return NULL if there is no memory for it.
+ */
+struct arena *arena_new(void)
+{
+	struct arena *ap;
+	int c;
+
+	if ((ap = (struct arena *)malloc(sizeof(struct arena))) == NULL)
+		return NULL;
+	ap->a_chunks = NULL;
+	ap->a_next = NULL;
+	ap->a_end = NULL;
+	ap->a_chunksize = CHUNKMIN;
+	ap->a_big = NULL;
+	for (c = 0; c < NCLASS; ++c)
+		ap->a_free[c] = NULL;
+	ap->a_reserved = 0;
+	ap->a_live = 0;
+	return ap;
+}
+
+/*
+ * Free everything that was ever allocated from arena "ap" in one go. The
+ * arena itself stays, empty, and can be used again.
+ */
+void arena_clear(struct arena *ap)
+{
+	struct chunk *cp;
+	struct bigblock *gp;
+	int c;
+
+	while ((cp = ap->a_chunks) != NULL) {
+		ap->a_chunks = cp->c_next;
+		free((char *) cp);
+	}
+	while ((gp = ap->a_big) != NULL) {
+		ap->a_big = gp->g_next;
+		free((char *) gp);
+	}
+	for (c = 0; c < NCLASS; ++c)
+		ap->a_free[c] = NULL;
+	ap->a_next = NULL;
+	ap->a_end = NULL;
+	ap->a_chunksize = CHUNKMIN;
+	reserved -= ap->a_reserved;
+	live -= ap->a_live;
+	ap->a_reserved = 0;
+	ap->a_live = 0;
+}
+
+/*
+ * Free arena "ap" and everything in it.
+ */
+void arena_delete(struct arena *ap)
+{
+	arena_clear(ap);
+	free((char *) ap);
+}
+
+/*
+ * Allocate a block of at least "*size" bytes from arena "ap", and set
+ * "*size" to the size that was really given. Return NULL if there isn't
+ * any memory left.
+ */
+void *arena_alloc(struct arena *ap, int *size)
+{
+	struct chunk *cp;
+	struct bigblock *gp;
+	char *p;
+	int c;
+	int n;
+
+	if ((c = sizeclass(*size)) < 0) {
+		n = (*size + ALIGN - 1) & ~(ALIGN - 1);
+		gp = (struct bigblock *)malloc(sizeof(struct bigblock) + n);
+		if (gp == NULL)
+			return NULL;
+		gp->g_size = sizeof(struct bigblock) + n;
+		gp->g_prev = NULL;
+		if ((gp->g_next = ap->a_big) != NULL)
+			gp->g_next->g_prev = gp;
+		ap->a_big = gp;
+		ap->a_reserved += gp->g_size;
+		reserved += gp->g_size;
+		ap->a_live += n;
+		live += n;
+		++nalloc;
+		*size = n;
+		return (void *) (gp + 1);
+	}
+	n = classsize(c);
+	if ((p = ap->a_free[c]) != NULL) {	/* Reuse a freed block  */
+		ap->a_free[c] = *(void **) p;
+		++nhit;
+	} else {
+		if (ap->a_end - ap->a_next < n) {	/* New chunk    */
+			cp = (struct chunk *)malloc(ap->a_chunksize);
+			if (cp == NULL)
+				return NULL;
+			cp->c_size = ap->a_chunksize;
+			cp->c_next = ap->a_chunks;
+			ap->a_chunks = cp;
+			ap->a_next = (char *) (cp + 1);
+			ap->a_end = (char *) cp + cp->c_size;
+			ap->a_reserved += cp->c_size;
+			reserved += cp->c_size;
+			if (ap->a_chunksize < CHUNKMAX)
+				ap->a_chunksize *= 2;
+		}
+		p = ap->a_next;
+		ap->a_next += n;
+	}
+	ap->a_live += n;
+	live += n;
+	++nalloc;
+	*size = n;
+	return (void *) p;
+}
+
+/*
+ * Give block "p" of "size" bytes, as set by arena_alloc(), back to arena
+ * "ap".
+ */
+void arena_release(struct arena *ap, void *p, int size)
+{
+	struct bigblock *gp;
+	int c;
+
+	ap->a_live -= size;
+	live -= size;
+	if ((c = sizeclass(size)) < 0) {
+		gp = (struct bigblock *)p - 1;
+		if (gp->g_prev != NULL)
+			gp->g_prev->g_next = gp->g_next;
+		else
+			ap->a_big = gp->g_next;
+		if (gp->g_next != NULL)
+			gp->g_next->g_prev = gp->g_prev;
+		ap->a_reserved -= gp->g_size;
+		reserved -= gp->g_size;
+		free((char *) gp);
+		return;
+	}
+	*(void **) p = ap->a_free[c];
+	ap->a_free[c] = p;
+}
+
+/*
+ * Report the bytes reserved, the bytes live and the percentage of blocks
+ * that came off a free list, over all arenas.
+ */
+char *arena_stats(void)
+{
+	static char result[64];
+
+	sprintf(result, "%ld %ld %ld", reserved, live,
+		nalloc == 0 ? 0L : nhit * 100 / nalloc);
+	return result;
+}
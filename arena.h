@@ -0,0 +1,19 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+/*
+ * The memory that the lines of a buffer are carved from. Blocks are handed
+ * out in size classes; "arena_alloc" rounds the size it is asked for up to
+ * the size of the class, and that is the size to give back to
+ * "arena_release" when the block is freed.
+ */
+struct arena;
+
+struct arena *arena_new(void);
+void arena_clear(struct arena *ap);
+void arena_delete(struct arena *ap);
+void *arena_alloc(struct arena *ap, int *size);
+void arena_release(struct arena *ap, void *p, int size);
+char *arena_stats(void);
+
+#endif  /* ARENA_H_ */
@@ -16,6 +16,7 @@
 #include "efunc.h"
 #include "line.h"
 #include "utf8.h"
+#include "lindex.h"
 
 /*
  * This routine, given a pointer to a struct line, and the current cursor goal
@@ -166,7 +167,17 @@ int gotoline(int f, int n)
 
 	/* First, we go to the begin of the buffer. */
 	gotobob(f, n);
-	return forwline(f, n - 1);
+	if (curwp->w_dotp == curbp->b_linep)
+		return FALSE;
+
+	/* Then straight to the line, as "forwline" would. */
+	if ((lastflag & CFCPCN) == 0)
+		curgoal = getccol(FALSE);
+	thisflag |= CFCPCN;
+	curwp->w_dotp = lindex_line(curbp, n - 1);
+	curwp->w_doto = getgoal(curwp->w_dotp);
+	curwp->w_flag |= WFMOVE;
+	return TRUE;
 }
 
 /*
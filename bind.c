@@ -535,7 +535,7 @@ char *flook(char *fname, int hflag)
 #endif
 
 	/* look it up via the old table method */
-	for (i = 2; i < ARRAY_SIZE(pathname); i++) {
+	for (i = 3; i < ARRAY_SIZE(pathname); i++) {
 		strcpy(fspec, pathname[i]);
 		strcat(fspec, fname);
 
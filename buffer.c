@@ -15,6 +15,9 @@
 #include "edef.h"
 #include "efunc.h"
 #include "line.h"
+#include "lindex.h"
+#include "arena.h"
+#include "undo.h"
 
 /*
  * Attach a buffer to a window. The
@@ -159,9 +162,12 @@ int zotbuf(struct buffer *bp)
 		mlwrite("Buffer is being displayed");
 		return FALSE;
 	}
+	savewait(bp);		/* Let a save of it finish.     */
 	if ((s = bclear(bp)) != TRUE)	/* Blow text away.      */
 		return s;
 	free((char *) bp->b_linep);	/* Release header line. */
+	arena_delete(bp->b_arena);
+	lindex_delete(bp);
 	bp1 = NULL;		/* Find the header.     */
 	bp2 = bheadp;
 	while (bp2 != bp) {
@@ -401,7 +407,7 @@ int addline(char *text)
 	int ntext;
 
 	ntext = strlen(text);
-	if ((lp = lalloc(ntext)) == NULL)
+	if ((lp = lalloc(blistp, ntext)) == NULL)
 		return FALSE;
 	for (i = 0; i < ntext; ++i)
 		lputc(lp, i, text[i]);
@@ -409,6 +415,7 @@ int addline(char *text)
 	lp->l_bp = blistp->b_linep->l_bp;
 	blistp->b_linep->l_bp = lp;
 	lp->l_fp = blistp->b_linep;
+	lindex_add(blistp, lp);
 	if (blistp->b_dotp == blistp->b_linep)	/* If "." is at the end */
 		blistp->b_dotp = lp;	/* move it to new line  */
 	return TRUE;
@@ -460,7 +467,12 @@ struct buffer *bfind(char *bname, int cflag, int bflag)
 	if (cflag != FALSE) {
 		if ((bp = (struct buffer *)malloc(sizeof(struct buffer))) == NULL)
 			return NULL;
-		if ((lp = lalloc(0)) == NULL) {
+		if ((bp->b_arena = arena_new()) == NULL) {
+			free((char *) bp);
+			return NULL;
+		}
+		if ((lp = lalloc(NULL, 0)) == NULL) {
+			arena_delete(bp->b_arena);
 			free((char *) bp);
 			return NULL;
 		}
@@ -492,6 +504,12 @@ struct buffer *bfind(char *bname, int cflag, int bflag)
 		bp->b_mode = gmode;
 		bp->b_nwnd = 0;
 		bp->b_linep = lp;
+		bp->b_index = NULL;
+		bp->b_undo = NULL;
+		bp->b_text = NULL;
+		bp->b_tsize = 0;
+		bp->b_krefs = 0;
+		bp->b_spid = 0;
 		strcpy(bp->b_fname, "");
 		strcpy(bp->b_bname, bname);
 #if	CRYPT
@@ -515,7 +533,7 @@ struct buffer *bfind(char *bname, int cflag, int bflag)
  */
 int bclear(struct buffer *bp)
 {
-	struct line *lp;
+	struct window *wp;
 	int s;
 
 	if ((bp->b_flag & BFINVS) == 0	/* Not scratch buffer.  */
@@ -523,8 +541,34 @@ int bclear(struct buffer *bp)
 	    && (s = mlyesno("Discard changes")) != TRUE)
 		return s;
 	bp->b_flag &= ~BFCHG;	/* Not changed          */
-	while ((lp = lforw(bp->b_linep)) != bp->b_linep)
-		lfree(lp);
+	undo_clear(bp);		/* Nothing to undo      */
+	arena_clear(bp->b_arena);	/* Drop all the lines   */
+	lindex_clear(bp);
+	bp->b_linep->l_fp = bp->b_linep;
+	bp->b_linep->l_bp = bp->b_linep;
+	wp = wheadp;		/* Nothing may point at */
+	while (wp != NULL) {	/* them any more.       */
+		if (wp->w_bufp == bp) {
+			wp->w_linep = bp->b_linep;
+			wp->w_dotp = bp->b_linep;
+			wp->w_doto = 0;
+			if (wp->w_markp != NULL) {
+				wp->w_markp = bp->b_linep;
+				wp->w_marko = 0;
+			}
+		}
+		wp = wp->w_wndp;
+	}
+	if (bp->b_text != NULL) {	/* No line shares it now */
+		kcopy(bp);	/* nor any kill */
+		if (bp->b_flag & BFMAP)
+			ffunmaptext(bp->b_text, bp->b_tsize);
+		else
+			free(bp->b_text);
+		bp->b_text = NULL;
+		bp->b_tsize = 0;
+		bp->b_flag &= ~BFMAP;
+	}
 	bp->b_dotp = bp->b_linep;	/* Fix "."              */
 	bp->b_doto = 0;
 	bp->b_markp = NULL;	/* Invalidate "mark"    */
@@ -12,11 +12,15 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <unistd.h>
+#ifdef POSIX
+#include <time.h>
+#endif
 
 #include "estruct.h"
 #include "edef.h"
 #include "efunc.h"
 #include "line.h"
+#include "lindex.h"
 #include "version.h"
 #include "wrapper.h"
 #include "display.h"
@@ -27,6 +31,10 @@
 
 struct video {
 	int v_flag;		/* Flags */
+	unsigned int v_hash;	/* Hash of v_text, 0 if not known */
+#if COLOR
+	int v_mcomment;		/* Comment state it was drawn in */
+#endif
 	struct text v_text[1];	/* Screen data. */
 };
 
@@ -42,6 +50,22 @@ static struct video **pscreen;		/* Physical screen. */
 #endif
 
 static int displaying = TRUE;
+
+/* cells are the same, colours and all */
+#define	textsame(a, b)	(memcmp((a), (b), sizeof(struct text)) == 0)
+
+#if COLOR
+struct attr attrs[NATTR] = { { CLR_NONE, CLR_NONE } };
+static int nattr = 1;			/* Colour pairs in "attrs"  */
+static unsigned short attrhash[2 * NATTR];	/* Their places, plus 1 */
+#endif
+
+#define	NSCROLL	3	/* Most blocks of lines moved in one update */
+#define	SCRCOST	16	/* About what setting up a scroll costs, in chars */
+#define	SCRLINE	4	/* And getting to a line and clearing it        */
+#define	NSHASH	1024	/* Lists lines are found by their hash in      */
+#define	FRWAIT	1000	/* Most ms type ahead holds the screen back */
+static long lastframe;	/* When the last update was done, in ms     */
 #if UNIX
 #include <signal.h>
 #endif
@@ -54,15 +78,25 @@ int chg_width, chg_height;
 #if COLOR
 static int hi_enable;
 extern int hi_mcomment;
+
+/* note on row "row" the comment state the line put on it starts in */
+#define	mcmark(row)	((void) (vscreen[row]->v_mcomment = hi_mcomment))
+#else
+#define	mcmark(row)	((void) 0)
 #endif
 
+static int frameskip(void);
+static long frameclock(void);
 static int reframe(struct window *wp);
 static void updone(struct window *wp);
 static void updall(struct window *wp);
-static int scrolls(int inserts);
+static int scrolls(void);
 static void scrscroll(int from, int to, int count);
-static int texttest(int vrow, int prow);
+static unsigned int texthash(struct video *vp);
+static int linelen(int *len, int row);
+static unsigned int rowhash(struct text *tp, int n);
 static int endofline(struct text *s, int n);
+static int linecol(struct line *lp, int off);
 static void updext(void);
 static int updateline(int row, struct video *vp1, struct video *vp2);
 static void modeline(struct window *wp);
@@ -71,14 +105,68 @@ static void mlputli(long l, int r);
 static void mlputf(int s);
 static int newscreensize(int h, int w);
 
-#if COLOR
-static void mcomment_update_state(struct line *startp, struct line *endp, int state);
-#endif
-
 #if RAINBOW
 static void putline(int row, int col, char *buf);
 #endif
 
+#if COLOR
+/*
+ * Return the index in "attrs" of the pair of colours "fcolor" and
+ * "bcolor", adding it if it is new. Should the table fill up, cells in
+ * new pairs are drawn without colour.
+ */
+unsigned int attr_find(int fcolor, int bcolor)
+{
+	static int lastf = CLR_NONE, lastb = CLR_NONE;
+	static unsigned int last = ATTR_NONE;
+	unsigned int h;
+	int i;
+
+	if (fcolor == lastf && bcolor == lastb)
+		return last;
+	if (fcolor == CLR_NONE && bcolor == CLR_NONE)
+		return ATTR_NONE;
+
+	h = ((unsigned int) fcolor * 2654435761u
+	     ^ (unsigned int) bcolor * 2246822519u) >> 7;
+	for (;; ++h) {
+		h &= 2 * NATTR - 1;
+		i = attrhash[h] - 1;
+		if (i < 0 || (attrs[i].a_fcolor == fcolor
+			      && attrs[i].a_bcolor == bcolor))
+			break;
+	}
+	if (i < 0) {		/* a new pair */
+		if (nattr == NATTR)
+			return ATTR_NONE;
+		i = nattr++;
+		attrs[i].a_fcolor = fcolor;
+		attrs[i].a_bcolor = bcolor;
+		attrhash[h] = i + 1;
+	}
+	lastf = fcolor;
+	lastb = bcolor;
+	last = i;
+	return i;
+}
+
+/*
+ * Give the cell at "tp" foreground colour "fcolor".
+ */
+void text_setfg(struct text *tp, int fcolor)
+{
+	tp->t_attr = attr_find(fcolor, text_bcolor(tp));
+}
+
+/*
+ * Give the cell at "tp" background colour "bcolor".
+ */
+void text_setbg(struct text *tp, int bcolor)
+{
+	tp->t_attr = attr_find(text_fcolor(tp), bcolor);
+}
+#endif
+
 /*
  * Initialize the data structures used by the display code. The edge vectors
  * used to access the screens are set up. The operating system's terminal I/O
@@ -104,10 +192,15 @@ void vtinit(void)
 	for (i = 0; i < term.t_mrow; ++i) {
 		vp = xmalloc(sizeof(struct video) + term.t_mcol*sizeof(struct text));
 		vp->v_flag = 0;
+		vp->v_hash = 0;
+#if COLOR
+		vp->v_mcomment = 0;
+#endif
 		vscreen[i] = vp;
 #if	MEMMAP == 0 || SCROLLCODE
 		vp = xmalloc(sizeof(struct video) + term.t_mcol*sizeof(struct text));
 		vp->v_flag = 0;
+		vp->v_hash = 0;
 		pscreen[i] = vp;
 #endif
 	}
@@ -163,7 +256,10 @@ void vtmove(int row, int col)
 	vtcol = col;
 }
 
-static int b_mode;
+#if COLOR
+static struct synlang *b_syn;	/* Language of the buffer being drawn */
+static struct arena *b_arena;	/* and its memory */
+#endif
 
 /*
  * Write a character to the virtual screen. The virtual row and
@@ -189,6 +285,11 @@ static void vtputc(int c)
 	vp = vscreen[vtrow];
 
 	if (vtcol + ncol > term.t_ncol) {
+#if COLOR
+		/* off the screen, but it counts for what comes after */
+		if (hi_enable == TRUE && b_syn != NULL)
+			syntax_feed(vp->v_text, vtcol, c);
+#endif
 		vtcol += ncol;
 		if (vp->v_text[term.t_ncol - 1].t_char != PADCH)
 			vp->v_text[term.t_ncol - 1].t_char = '$';
@@ -233,24 +334,21 @@ static void vtputc(int c)
 	
 	if (vtcol >= 0) {
 #if COLOR
-		vp->v_text[vtcol].t_fcolor = CLR_NONE;
-		vp->v_text[vtcol].t_bcolor = CLR_NONE;
+		vp->v_text[vtcol].t_attr = ATTR_NONE;
 #endif
 		vp->v_text[vtcol].t_char = c;
 		if (ncol == 2) {
 #if COLOR
-			vp->v_text[vtcol + 1].t_fcolor = CLR_NONE;
-			vp->v_text[vtcol + 1].t_bcolor = CLR_NONE;
+			vp->v_text[vtcol + 1].t_attr = ATTR_NONE;
 #endif
 			vp->v_text[vtcol + 1].t_char = PADCH;
 		}
 	}
 
 #if COLOR
-	/* syntax highlight */
-	if (hi_enable == TRUE && (b_mode & MDCMOD) != 0) {
-		syntax_c_handle(vp->v_text, vtcol);
-	}
+	/* syntax highlight, what is on the screen */
+	if (hi_enable == TRUE && b_syn != NULL)
+		syntax_handle(vp->v_text, vtcol, c);
 #endif
 
 	vtcol += ncol;
@@ -269,8 +367,7 @@ static void vteeol(void)
 	while (vtcol < term.t_ncol) {
 /*	vp->v_text[vtcol++].t_char = ' ';	*/
 #if COLOR
-		vcp[vtcol].t_fcolor = CLR_NONE;
-		vcp[vtcol].t_bcolor = CLR_NONE;
+		vcp[vtcol].t_attr = ATTR_NONE;
 #endif
 		vcp[vtcol].t_char = EOLCH;
 		vtcol++;
@@ -305,14 +402,14 @@ int update(int force)
 {
 	struct window *wp;
 
-#if	TYPEAH && ! PKCODE
-	if (force == FALSE && typahead())
-		return TRUE;
-#endif
 #if	VISMAC == 0
 	if (force == FALSE && kbdmode == PLAY)
 		return TRUE;
 #endif
+	if (force == FALSE && frameskip()) {
+		++frdrop;
+		return TRUE;
+	}
 
 	displaying = TRUE;
 
@@ -343,7 +440,10 @@ int update(int force)
 	wp = wheadp;
 	while (wp != NULL) {
 		if (wp->w_flag) {
-			b_mode = wp->w_bufp->b_mode;
+#if COLOR
+			b_syn = syntax_find(wp->w_bufp);
+			b_arena = wp->w_bufp->b_arena;
+#endif
 
 			/* if the window has changed, service it */
 			reframe(wp);	/* check the framing */
@@ -397,6 +497,8 @@ int update(int force)
 	movecursor(currow, curcol - lbound);
 	TTflush();
 	displaying = FALSE;
+	++frames;
+	lastframe = frameclock();
 #if SIGWINCH
 	while (chg_width || chg_height)
 		newscreensize(chg_height, chg_width);
@@ -404,6 +506,47 @@ int update(int force)
 	return TRUE;
 }
 
+/*
+ * Should an update that is not forced be left out? Keys already typed are
+ * taken in first, so a burst of them is drawn once, though the screen is
+ * not held back for more than FRWAIT ms at a time. With "$fps" set, an
+ * update that comes sooner than 1/$fps seconds after the last one waits
+ * out the rest of that time, and is left out if a key comes meanwhile.
+ */
+static int frameskip(void)
+{
+#ifdef POSIX
+	long now, wait;
+
+	now = frameclock();
+	if (typahead() && now - lastframe < FRWAIT)
+		return TRUE;
+	if (maxfps > 0 && (wait = lastframe + 1000 / maxfps - now) > 0
+	    && ttwait(wait))
+		return TRUE;
+	return FALSE;
+#elif	TYPEAH && ! PKCODE
+	return typahead();
+#else
+	return FALSE;
+#endif
+}
+
+/*
+ * A clock for "frameskip", in milliseconds.
+ */
+static long frameclock(void)
+{
+#ifdef POSIX
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+#else
+	return 0;
+#endif
+}
+
 /*
  * reframe:
  *	check to see if the cursor is on in the window
@@ -493,14 +636,26 @@ static int reframe(struct window *wp)
 	return TRUE;
 }
 
+/*
+ * Put line "lp" on the virtual screen at the virtual cursor. A line that
+ * starts at the left edge is highlighted in the colours saved with it if
+ * they are still good, and they are saved otherwise.
+ */
 static void show_line(struct line *lp)
 {
+	int i = 0, len = llength(lp);
 #if COLOR
-	hi_enable = TRUE;
-	if ((b_mode & MDCMOD) != 0)
-		syntax_c_line_init();
+	int cached = FALSE, save = FALSE;
+
+	if (b_syn != NULL) {
+		save = vtcol == 0 && taboff == 0;
+		cached = save && syntax_line_cached(b_syn, lp, term.t_ncol,
+						    tabmask);
+	}
+	hi_enable = !cached;
+	if (b_syn != NULL && !cached)
+		syntax_line_init(b_syn, term.t_ncol);
 #endif
-	int i = 0, len = llength(lp);
 
 	while (i < len) {
 		unicode_t c;
@@ -508,8 +663,16 @@ static void show_line(struct line *lp)
 		vtputc(c);
 	}
 #if COLOR
-	if ((b_mode & MDCMOD) != 0)
-		syntax_c_line_end(vscreen[vtrow]->v_text, vtcol);
+	i = vtcol < term.t_ncol ? vtcol : term.t_ncol;
+	if (cached) {
+		syntax_line_paint(lp, vscreen[vtrow]->v_text, i);
+		hi_enable = TRUE;
+	} else if (b_syn != NULL) {
+		syntax_line_end(vscreen[vtrow]->v_text, vtcol);
+		if (save)
+			syntax_line_save(b_arena, lp, vscreen[vtrow]->v_text,
+					 i, term.t_ncol, tabmask);
+	}
 #endif
 }
 
@@ -535,39 +698,33 @@ static void updone(struct window *wp)
 
 	endrow = sline + 1;
 #if COLOR
-	if ((b_mode & MDCMOD) != 0) {
-		hi_mcomment = lp->l_mcomment;
+	if (b_syn != NULL) {
+		hi_mcomment = lindex_mcomment(wp->w_bufp, b_syn, lp);
 		endrow = wp->w_toprow + wp->w_ntrows;
 	}
 #endif
 	while (sline < endrow) {
-#if	COLOR
-		if ((b_mode & MDCMOD) != 0)
-			lp->l_mcomment = hi_mcomment;
-#endif
 		/* and update the virtual line */
 		vscreen[sline]->v_flag |= VFCHG;
 		vscreen[sline]->v_flag &= ~VFREQ;
 		vtmove(sline, 0);
 		if (lp != wp->w_bufp->b_linep) {
 			/* if we are not at the end */
+			mcmark(sline);
 			show_line(lp);
 			lp = lforw(lp);
 		}
 		vteeol();
 		++sline;
 #if	COLOR
-		if ((b_mode & MDCMOD) != 0 && sline < endrow) {
-			if (lp->l_mcomment == hi_mcomment)
+		/* the lines below are fine if they start as they were drawn */
+		if (b_syn != NULL && sline < endrow) {
+			if (lp == wp->w_bufp->b_linep ||
+			    vscreen[sline]->v_mcomment == hi_mcomment)
 				break;
 		}
 #endif
 	}
-
-#if	COLOR
-	if ((b_mode & MDCMOD) != 0 && sline == endrow)
-		mcomment_update_state(lp, wp->w_bufp->b_linep, hi_mcomment);
-#endif
 }
 
 /*
@@ -585,8 +742,8 @@ static void updall(struct window *wp)
 	lp = wp->w_linep;
 	sline = wp->w_toprow;
 #if	COLOR
-	if ((b_mode & MDCMOD) != 0)
-		hi_mcomment = lp->l_mcomment;
+	if (b_syn != NULL)
+		hi_mcomment = lindex_mcomment(wp->w_bufp, b_syn, lp);
 #endif
 	while (sline < wp->w_toprow + wp->w_ntrows) {
 
@@ -596,6 +753,7 @@ static void updall(struct window *wp)
 		vtmove(sline, 0);
 		if (lp != wp->w_bufp->b_linep) {
 			/* if we are not at the end */
+			mcmark(sline);
 			show_line(lp);
 			lp = lforw(lp);
 		}
@@ -614,7 +772,6 @@ static void updall(struct window *wp)
 void updpos(void)
 {
 	struct line *lp;
-	int i;
 
 	/* find the current row */
 	lp = curwp->w_linep;
@@ -625,18 +782,7 @@ void updpos(void)
 	}
 
 	/* find the current column */
-	curcol = 0;
-	i = 0;
-	while (i < curwp->w_doto) {
-		unicode_t c;
-		int bytes;
-
-		bytes = utf8_to_unicode(lp->l_text, i, curwp->w_doto, &c);
-		i += bytes;
-		if (c == '\t')
-			curcol |= tabmask;
-		curcol += char_width(c);
-	}
+	curcol = linecol(lp, curwp->w_doto);
 
 	/* if extended, flag so and update the virtual line image */
 	if (curcol >= term.t_ncol - 1) {
@@ -646,12 +792,38 @@ void updpos(void)
 		lbound = 0;
 }
 
+/*
+ * linecol:
+ *	the column offset "off" of line "lp" is shown in, before any
+ *	horizontal scroll
+ */
+static int linecol(struct line *lp, int off)
+{
+	int col;
+	int i;
+
+	col = 0;
+	i = 0;
+	while (i < off) {
+		unicode_t c;
+		int bytes;
+
+		bytes = utf8_to_unicode(lp->l_text, i, off, &c);
+		i += bytes;
+		if (c == '\t')
+			col |= tabmask;
+		col += char_width(c);
+	}
+	return col;
+}
+
 #if	COLOR
 #define CLR_MATCH	0x06989A
 
 /*
  * updmatch:
- *	highlight match synbols: {}()[]
+ *	highlight the match symbol {}()[] under the cursor, and the one
+ *	that matches it if that is in the window
  */
 void updmatch(void)
 {
@@ -659,92 +831,56 @@ void updmatch(void)
 	static int lastcol1 = -1;
 	static int lastrow2 = -1;
 	static int lastcol2 = -1;
+	struct line *lp;
+	struct line *wlp;
+	int off;
+	int row;
+	int col;
 
 	if (lastrow1 != -1 && lastcol1 != -1) {
-		vscreen[lastrow1]->v_text[lastcol1].t_bcolor = CLR_NONE;
+		text_setbg(&vscreen[lastrow1]->v_text[lastcol1], CLR_NONE);
 		vscreen[lastrow1]->v_flag |= VFCHG;
 		lastrow1 = -1;
 		lastcol1 = -1;
 	}
 
 	if (lastrow2 != -1 && lastcol2 != -1) {
-		vscreen[lastrow2]->v_text[lastcol2].t_bcolor = CLR_NONE;
+		text_setbg(&vscreen[lastrow2]->v_text[lastcol2], CLR_NONE);
 		vscreen[lastrow2]->v_flag |= VFCHG;
 		lastrow2 = -1;
 		lastcol2 = -1;
 	}
 
-	struct text *tp = &vscreen[currow]->v_text[curcol];
-	unicode_t c = tp->t_char;
-	if ((c == '{' || c == '(' || c == '[') &&
-	    tp->t_fcolor == CLR_NONE) {
-		tp->t_bcolor = CLR_MATCH;
-		vscreen[currow]->v_flag |= VFCHG;
-		lastrow1 = currow;
-		lastcol1 = curcol;
-
-		int tmprow = currow;
-		int tmpcol = curcol + 1;
-
-		while (tmprow < curwp->w_toprow + curwp->w_ntrows) {
-			while (tmpcol < term.t_mcol) {
-				struct text *tmptp = &vscreen[tmprow]->v_text[tmpcol];
-				unicode_t tmpc = tmptp->t_char;
-				if (tmpc == EOLCH)
-					break;
-				if (((c == '{' && tmpc == '}') ||
-				    (c == '(' && tmpc == ')') ||
-				    (c == '[' && tmpc == ']')) && tmptp->t_fcolor == CLR_NONE) {
-					tmptp->t_bcolor = CLR_MATCH;
-					vscreen[tmprow]->v_flag |= VFCHG;
-					lastrow2 = tmprow;
-					lastcol2 = tmpcol;
-					break;
-				}
-				tmpcol++;
-			}
-
-			if (lastrow2 != -1 && lastcol2 != -1)
-				break;
-			tmprow++;
-			tmpcol = 0;
-		}
-	} else if ((c == '}' || c == ')' || c == ']') &&
-	    tp->t_fcolor == CLR_NONE) {
-		tp->t_bcolor = CLR_MATCH;
-		vscreen[currow]->v_flag |= VFCHG;
-		lastrow1 = currow;
-		lastcol1 = curcol;
-
-		int tmprow = currow;
-		int tmpcol = curcol - 1;
-
-		while (tmprow >= curwp->w_toprow) {
-			while (tmpcol >= 0) {
-				struct text *tmptp = &vscreen[tmprow]->v_text[tmpcol];
-				unicode_t tmpc = tmptp->t_char;
-				if (tmpc == EOLCH) {
-					tmpcol--;
-					continue;
-				}
-				if (((tmpc == '{' && c == '}') ||
-				    (tmpc == '(' && c == ')') ||
-				    (tmpc == '[' && c == ']')) && tmptp->t_fcolor == CLR_NONE) {
-					tmptp->t_bcolor = CLR_MATCH;
-					vscreen[tmprow]->v_flag |= VFCHG;
-					lastrow2 = tmprow;
-					lastcol2 = tmpcol;
-					break;
-				}
-				tmpcol--;
-			}
+	lp = curwp->w_dotp;
+	off = curwp->w_doto;
+	col = curcol - lbound;
+	if (col >= term.t_ncol || !lindex_fence(curbp, &lp, &off))
+		return;
+	text_setbg(&vscreen[currow]->v_text[col], CLR_MATCH);
+	vscreen[currow]->v_flag |= VFCHG;
+	lastrow1 = currow;
+	lastcol1 = col;
+	if (lp == NULL)
+		return;
 
-			if (lastrow2 != -1 && lastcol2 != -1)
-				break;
-			tmprow--;
-			tmpcol = term.t_mcol -1;
-		}
+	/* find the match on the screen, if it is there */
+	row = curwp->w_toprow;
+	for (wlp = lp; wlp != curwp->w_linep; wlp = lback(wlp))
+		if (wlp == curbp->b_linep ||
+		    ++row == curwp->w_toprow + curwp->w_ntrows)
+			return;
+	col = linecol(lp, off);
+	if (row == currow && lbound > 0) {
+		col -= lbound;
+		if (col < 1)	/* under the "$" */
+			return;
 	}
+	if (col >= term.t_ncol - 1)
+		return;
+	text_setbg(&vscreen[row]->v_text[col], CLR_MATCH);
+	vscreen[row]->v_flag |= VFCHG;
+	lastrow2 = row;
+	lastcol2 = col;
 }
 #endif
 
@@ -763,11 +899,20 @@ void upddex(void)
 	while (wp != NULL) {
 		lp = wp->w_linep;
 		i = wp->w_toprow;
+#if COLOR
+		b_syn = syntax_find(wp->w_bufp);
+		b_arena = wp->w_bufp->b_arena;
+#endif
 
 		while (i < wp->w_toprow + wp->w_ntrows) {
 			if (vscreen[i]->v_flag & VFEXT) {
 				if ((wp != curwp) || (lp != wp->w_dotp) ||
 				    (curcol < term.t_ncol - 1)) {
+#if COLOR
+					if (b_syn != NULL)
+						hi_mcomment = lindex_mcomment(
+						    wp->w_bufp, b_syn, lp);
+#endif
 					vtmove(i, 0);
 					show_line(lp);
 					vteeol();
@@ -801,11 +946,11 @@ void updgar(void)
 		vscreen[i]->v_flag &= ~VFREV;
 #endif
 #if	MEMMAP == 0 || SCROLLCODE
+		pscreen[i]->v_hash = 0;
 		txt = pscreen[i]->v_text;
 		for (j = 0; j < term.t_ncol; ++j) {
 #if COLOR
-			txt[j].t_fcolor = CLR_NONE;
-			txt[j].t_bcolor = CLR_NONE;
+			txt[j].t_attr = ATTR_NONE;
 #endif
 			txt[j].t_char = EOLCH;
 		}
@@ -813,6 +958,10 @@ void updgar(void)
 	}
 
 	movecursor(0, 0);	/* Erase the screen. */
+#if	COLOR
+	TTreforg();
+	TTrebacg();
+#endif
 	TTeeop();
 	sgarbf = FALSE;		/* Erase-page clears */
 	mpresf = FALSE;		/* the message area. */
@@ -831,12 +980,21 @@ int updupd(int force)
 {
 	struct video *vp1;
 	int i;
+#if SCROLLCODE
+	int nchg;
+#endif
 
 #if SCROLLCODE
-	if (scrflags & WFKILLS)
-		scrolls(FALSE);
-	if (scrflags & WFINS)
-		scrolls(TRUE);
+	/* the hashes of rows redrawn since the last update are stale */
+	nchg = 0;
+	for (i = 0; i < term.t_nrow; ++i)
+		if (vscreen[i]->v_flag & VFCHG) {
+			vscreen[i]->v_hash = 0;
+			++nchg;
+		}
+	/* move the lines that moved, a few blocks at most */
+	if (nchg > 2)
+		for (i = 0; i < NSCROLL && scrolls(); ++i);
 	scrflags = 0;
 #endif
 
@@ -862,137 +1020,147 @@ int updupd(int force)
 #if SCROLLCODE
 
 /*
- * optimize out scrolls (line breaks, and newlines)
- * arg. chooses between looking for inserts or deletes
+ * Scroll lines of the physical screen that the virtual screen wants
+ * elsewhere into place. The lines are matched up by their hashes, and the
+ * run of them that saves writing out the most characters is moved; if
+ * that is more than the scroll itself is likely to cost, and the run is
+ * not much shorter than how far it moves. Returns TRUE if it does
+ * something.
  */
-static int scrolls(int inserts)
-{				/* returns true if it does something */
+static int scrolls(void)
+{
 	struct video *vpv;	/* virtual screen image */
 	struct video *vpp;	/* physical screen image */
+	unsigned int vh[MAXROW];	/* hashes of the virtual lines */
+	unsigned int ph[MAXROW];	/* hashes of the physical lines */
+	int len[MAXROW];	/* length of each virtual line, or -1 */
+	int head[NSHASH];	/* physical lines by hash... */
+	int next[MAXROW];	/* ...chained up */
+	char tried[2 * MAXROW];	/* shifts worth a look */
 	int i, j, k;
 	int rows, cols;
-	int first, match, count, target, end;
-	int longmatch, longcount;
-	int from, to;
+	int d, run, gain;
+	int bestd, bestrow, bestrun, bestgain;
+	int from, to, count;
 
 	if (!term.t_scroll)	/* no way to scroll */
 		return FALSE;
 
 	rows = term.t_nrow;
 	cols = term.t_ncol;
-
-	first = -1;
-	for (i = 0; i < rows; i++) {	/* find first wrong line */
-		if (!texttest(i, i)) {
-			first = i;
-			break;
+	for (i = 0; i < rows; i++) {
+		vpv = vscreen[i];
+		len[i] = -1;
+		if (vpv->v_hash == 0) {
+			len[i] = endofline(vpv->v_text, cols);
+			vpv->v_hash = rowhash(vpv->v_text, len[i]);
 		}
+		vh[i] = vpv->v_hash;
+		ph[i] = texthash(pscreen[i]);
 	}
 
-	if (first < 0)
-		return FALSE;	/* no text changes */
-
-	vpv = vscreen[first];
-	vpp = pscreen[first];
-
-	if (inserts) {
-		/* determine types of potential scrolls */
-		end = endofline(vpv->v_text, cols);
-		if (end == 0)
-			target = first;	/* newlines */
-		else if (memcmp(vpp->v_text, vpv->v_text, sizeof(struct text)*end) == 0)
-			target = first + 1;	/* broken line newlines */
-		else
-			target = first;
-	} else {
-		target = first + 1;
-	}
-
-	/* find the matching shifted area */
-	match = -1;
-	longmatch = -1;
-	longcount = 0;
-	from = target;
-	for (i = from + 1; i < rows - longcount /* P.K. */ ; i++) {
-		if (inserts ? texttest(i, from) : texttest(from, i)) {
-			match = i;
-			count = 1;
-			for (j = match + 1, k = from + 1;
-			     j < rows && k < rows; j++, k++) {
-				if (inserts ? texttest(j, k) :
-				    texttest(k, j))
-					count++;
-				else
-					break;
+	/* each wrong line votes for the shifts that would put it right */
+	for (i = 0; i < NSHASH; i++)
+		head[i] = -1;
+	for (i = rows - 1; i >= 0; i--) {
+		k = ph[i] & (NSHASH - 1);
+		next[i] = head[k];
+		head[k] = i;
+	}
+	memset(tried, FALSE, 2 * rows);
+	for (i = 0; i < rows; i++)
+		if (vh[i] != ph[i] && linelen(len, i) > 0)
+			for (j = head[vh[i] & (NSHASH - 1)]; j >= 0; j = next[j])
+				if (ph[j] == vh[i])
+					tried[j - i + rows] = TRUE;
+
+	/* line "i" of the virtual screen is line "i + d" of the physical */
+	bestd = bestrow = bestrun = bestgain = 0;
+	for (d = 1 - rows; d < rows; d++) {
+		if (!tried[d + rows])
+			continue;
+		run = gain = 0;
+		for (i = d < 0 ? -d : 0;; i++) {
+			if (i < rows && i + d < rows && vh[i] == ph[i + d]) {
+				run++;
+				if (vh[i] != ph[i])
+					gain += linelen(len, i) + SCRLINE;
+				continue;
+			}
+			/* less what was right where the run leaves */
+			if (gain > bestgain && 2 * run >= abs(d)) {
+				j = d < 0 ? i - run + d : i;
+				for (k = j + abs(d); j < k; j++)
+					if (vh[j] == ph[j] && linelen(len, j) > 0)
+						gain -= len[j] + SCRLINE;
 			}
-			if (longcount < count) {
-				longcount = count;
-				longmatch = match;
+			if (gain > bestgain && 2 * run >= abs(d)
+			    && gain > SCRCOST + abs(d)) {
+				bestd = d;
+				bestrow = i - run;
+				bestrun = run;
+				bestgain = gain;
 			}
+			if (i >= rows || i + d >= rows)
+				break;
+			run = gain = 0;
 		}
 	}
-	match = longmatch;
-	count = longcount;
+	if (bestgain == 0)
+		return FALSE;
 
-	if (!inserts) {
-		/* full kill case? */
-		if (match > 0 && texttest(first, match - 1)) {
-			target--;
-			match--;
-			count++;
-		}
-	}
+	/* move the "count" lines at "from" to "to" */
+	from = bestrow + bestd;
+	to = bestrow;
 
-	/* do the scroll */
-	if (match > 0 && count > 2) {	/* got a scroll */
-		/* move the count lines starting at target to match */
-		if (inserts) {
-			from = target;
-			to = match;
-		} else {
-			from = match;
-			to = target;
+	/* the hashes only said the lines match, so make sure */
+	for (count = 0; count < bestrun; count++)
+		if (memcmp(pscreen[from + count]->v_text,
+			   vscreen[to + count]->v_text,
+			   sizeof(struct text) * cols) != 0)
+			break;
+	if (count <= 2 || 2 * count < abs(from - to))
+		return FALSE;
+
+	scrscroll(from, to, count);
+	for (i = 0; i < count; i++) {
+		vpp = pscreen[to + i];
+		vpv = vscreen[to + i];
+		memcpy(vpp->v_text, vpv->v_text, sizeof(struct text)*cols);
+		vpp->v_hash = vpv->v_hash;
+		vpp->v_flag = vpv->v_flag;	/* XXX */
+		if (vpp->v_flag & VFREV) {
+			vpp->v_flag &= ~VFREV;
+			vpp->v_flag |= ~VFREQ;
 		}
-		if (2 * count < abs(from - to))
-			return FALSE;
-		scrscroll(from, to, count);
-		for (i = 0; i < count; i++) {
-			vpp = pscreen[to + i];
-			vpv = vscreen[to + i];
-			memcpy(vpp->v_text, vpv->v_text, sizeof(struct text)*cols);
-			vpp->v_flag = vpv->v_flag;	/* XXX */
-			if (vpp->v_flag & VFREV) {
-				vpp->v_flag &= ~VFREV;
-				vpp->v_flag |= ~VFREQ;
-			}
 #if	MEMMAP
-			vscreen[to + i]->v_flag &= ~VFCHG;
+		vscreen[to + i]->v_flag &= ~VFCHG;
 #endif
-		}
-		if (inserts) {
-			from = target;
-			to = match;
-		} else {
-			from = target + count;
-			to = match + count;
-		}
+	}
+
+	/* the lines it moved away from are blank now */
+	if (from < to) {
+		i = from;
+		count = to;
+	} else {
+		i = to + count;
+		count = from + count;
+	}
 #if	MEMMAP == 0
-		for (i = from; i < to; i++) {
-			struct text *txt;
-			txt = pscreen[i]->v_text;
-			for (j = 0; j < term.t_ncol; ++j) {
+	for (; i < count; i++) {
+		struct text *txt;
+		pscreen[i]->v_hash = 0;
+		txt = pscreen[i]->v_text;
+		for (j = 0; j < term.t_ncol; ++j) {
 #if COLOR
-				txt[j].t_fcolor = CLR_NONE;
-				txt[j].t_bcolor = CLR_NONE;
+			txt[j].t_attr = ATTR_NONE;
 #endif
-				txt[j].t_char = EOLCH;
-			}
-			vscreen[i]->v_flag |= VFCHG;
+			txt[j].t_char = EOLCH;
 		}
-#endif
-		return TRUE;
+		vscreen[i]->v_flag |= VFCHG;
 	}
-	return FALSE;
+#endif
+	return TRUE;
 }
 
 /* move the "count" lines starting at "from" to "to" */
@@ -1003,16 +1171,53 @@ static void scrscroll(int from, int to, int count)
 }
 
 /*
- * return TRUE on text match
- *
- * int vrow, prow;		virtual, physical rows
+ * return the hash of the text of line "vp". It is worked out the first
+ * time it is needed, and kept for as long as the line stays the same; a
+ * line of the physical screen takes on the hash of the virtual one it is
+ * updated from. The blanks at the end of the line are left out; the
+ * caller makes sure of a match before it counts on one.
  */
-static int texttest(int vrow, int prow)
+static unsigned int texthash(struct video *vp)
 {
-	struct video *vpv = vscreen[vrow];	/* virtual screen image */
-	struct video *vpp = pscreen[prow];	/* physical screen image */
+	if (vp->v_hash == 0)
+		vp->v_hash = rowhash(vp->v_text,
+				     endofline(vp->v_text, term.t_ncol));
+	return vp->v_hash;
+}
 
-	return !memcmp(vpv->v_text, vpp->v_text, sizeof(struct text)*term.t_ncol);
+/*
+ * return the length of line "row" of the virtual screen, working it out
+ * if "len[row]" does not have it yet
+ */
+static int linelen(int *len, int row)
+{
+	if (len[row] < 0)
+		len[row] = endofline(vscreen[row]->v_text, term.t_ncol);
+	return len[row];
+}
+
+/*
+ * hash the "n" cells at "tp", never to 0. The characters and colours go
+ * into hashes of their own, which keeps the multiplies from waiting on
+ * each other.
+ */
+static unsigned int rowhash(struct text *tp, int n)
+{
+	unsigned int h = 1;
+#if COLOR
+	unsigned int ha = 2;
+#endif
+
+	for (; n > 0; --n, ++tp) {
+		h = (h + tp->t_char) * 2654435761u;
+#if COLOR
+		ha = (ha + tp->t_attr) * 2246822519u;
+#endif
+	}
+#if COLOR
+	h ^= ha >> 7;
+#endif
+	return h ? h : 1;
 }
 
 /*
@@ -1049,6 +1254,12 @@ static void updext(void)
 	/* once we reach the left edge                                  */
 	vtmove(currow, -lbound);	/* start scanning offscreen */
 	lp = curwp->w_dotp;	/* line to output */
+#if COLOR
+	b_syn = syntax_find(curbp);
+	b_arena = curbp->b_arena;
+	if (b_syn != NULL)
+		hi_mcomment = lindex_mcomment(curbp, b_syn, lp);
+#endif
 	show_line(lp);
 
 	/* truncate the virtual line, restore tab offset */
@@ -1084,6 +1295,7 @@ static int updateline(int row, struct video *vp1, struct video *vp2)
 		++cp1;
 	}
 	while (--nch);
+	vp2->v_hash = vp1->v_hash;
 #endif
 #if	COLOR
 	scwrite(row, vp1->v_text, vp1->v_rfcolor, vp1->v_rbcolor);
@@ -1145,6 +1357,7 @@ static int updateline(int row, struct video *vp1, struct video *vp2)
 #if COLOR
 	int last_fg = CLR_NONE;
 	int last_bg = CLR_NONE;
+	int fg, bg;
 #endif
 
 	/* set up pointers to virtual and physical lines */
@@ -1177,19 +1390,24 @@ static int updateline(int row, struct video *vp1, struct video *vp2)
 		while (cp1 < cp3) {
 			if (cp1->t_char != PADCH) {
 #if COLOR
-				if (cp1->t_fcolor != last_fg) {
-					if (cp1->t_fcolor == CLR_NONE)
+				/* The foreground of a blank does not show */
+				fg = text_fcolor(cp1);
+				bg = text_bcolor(cp1);
+				if (fg != last_fg && (req
+				    || (cp1->t_char != ' '
+				    && cp1->t_char != EOLCH))) {
+					if (fg == CLR_NONE)
 						TTreforg();
 					else
-						TTforg(cp1->t_fcolor);
-					last_fg = cp1->t_fcolor;
+						TTforg(fg);
+					last_fg = fg;
 				}
-				if (cp1->t_bcolor != last_bg) {
-					if (cp1->t_bcolor == CLR_NONE)
+				if (bg != last_bg) {
+					if (bg == CLR_NONE)
 						TTrebacg();
 					else
-						TTbacg(cp1->t_bcolor);
-					last_bg = cp1->t_bcolor;
+						TTbacg(bg);
+					last_bg = bg;
 				}
 #endif
 				if (cp1->t_char != EOLCH) {
@@ -1210,6 +1428,7 @@ static int updateline(int row, struct video *vp1, struct video *vp2)
 
 		/* update the needed flags */
 		vp1->v_flag &= ~VFCHG;
+		vp2->v_hash = vp1->v_hash;
 		if (req)
 			vp1->v_flag |= VFREV;
 		else
@@ -1219,12 +1438,7 @@ static int updateline(int row, struct video *vp1, struct video *vp2)
 #endif
 
 	/* advance past any common chars at the left */
-	while (cp1 != &vp1->v_text[term.t_ncol] && cp1->t_char == cp2->t_char
-#if COLOR
-			&& cp1->t_fcolor == cp2->t_fcolor
-			&& cp1->t_bcolor == cp2->t_bcolor
-#endif
-			) {
+	while (cp1 != &vp1->v_text[term.t_ncol] && textsame(cp1, cp2)) {
 		if (cp1->t_char == EOLCH)
 			break;
 		if (cp1->t_char != PADCH)
@@ -1250,12 +1464,7 @@ static int updateline(int row, struct video *vp1, struct video *vp2)
 	cp3 = &vp1->v_text[term.t_ncol];
 	cp4 = &vp2->v_text[term.t_ncol];
 
-	while (cp3 > cp1 && cp3[-1].t_char == cp4[-1].t_char
-#if COLOR
-			&& cp3[-1].t_fcolor == cp4[-1].t_fcolor
-			&& cp3[-1].t_bcolor == cp4[-1].t_bcolor
-#endif
-			) {
+	while (cp3 > cp1 && textsame(&cp3[-1], &cp4[-1])) {
 		--cp3;
 		--cp4;
 		if (cp3->t_char != EOLCH)	/* Note if any nonblank */
@@ -1281,19 +1490,24 @@ static int updateline(int row, struct video *vp1, struct video *vp2)
 	while (cp1 != cp5) {	/* Ordinary. */
 		if (cp1->t_char != PADCH) {
 #if COLOR
-			if (cp1->t_fcolor != last_fg) {
-				if (cp1->t_fcolor == CLR_NONE)
+			/* The foreground of a blank does not show */
+			fg = text_fcolor(cp1);
+			bg = text_bcolor(cp1);
+			if (fg != last_fg && (rev
+			    || (cp1->t_char != ' '
+			    && cp1->t_char != EOLCH))) {
+				if (fg == CLR_NONE)
 					TTreforg();
 				else
-					TTforg(cp1->t_fcolor);
-				last_fg = cp1->t_fcolor;
+					TTforg(fg);
+				last_fg = fg;
 			}
-			if (cp1->t_bcolor != last_bg) {
-				if (cp1->t_bcolor == CLR_NONE)
+			if (bg != last_bg) {
+				if (bg == CLR_NONE)
 					TTrebacg();
 				else
-					TTbacg(cp1->t_bcolor);
-				last_bg = cp1->t_bcolor;
+					TTbacg(bg);
+				last_bg = bg;
 			}
 #endif
 			if (cp1->t_char != EOLCH) {
@@ -1321,6 +1535,7 @@ static int updateline(int row, struct video *vp1, struct video *vp2)
 	TTrev(FALSE);
 #endif
 	vp1->v_flag &= ~VFCHG;	/* flag this line as updated */
+	vp2->v_hash = vp1->v_hash;
 	return TRUE;
 #endif
 }
@@ -1806,37 +2021,4 @@ static int newscreensize(int h, int w)
 	return TRUE;
 }
 
-#if COLOR
-int mcomment_line_state(struct line *lp, int state)
-{
-	int i;
-
-	for (i = 1; i < lp->l_used; i++) {
-		if (state == FALSE &&
-			lp->l_text[i - 1] == '/' && lp->l_text[i] == '*') {
-			state = TRUE;
-			i++;
-		} else if (state == TRUE &&
-			lp->l_text[i - 1] == '*' && lp->l_text[i] == '/') {
-			state = FALSE;
-			i++;
-		}
-	}
-	return state;
-}
-
-static void mcomment_update_state(struct line *startp, struct line *endp, int state)
-{
-	struct line *lp = startp;
-
-	while (lp != endp) {
-		if (lp->l_mcomment == state)
-			break;
-		lp->l_mcomment = state;
-		state = mcomment_line_state(lp, state);
-		lp = lforw(lp);
-	}
-}
-#endif
-
 #endif
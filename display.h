@@ -3,12 +3,35 @@
 
 #include "utf8.h"
 
+/*
+ * A cell of the screen. Its colours are kept as the index of their pair in
+ * "attrs", so a cell is two words with no padding, and cells and whole
+ * lines can be compared with memcmp. Pair ATTR_NONE has neither colour set.
+ */
 struct text {
+	unicode_t t_char;
 #if COLOR
-	int t_fcolor;
-	int t_bcolor;
+	unsigned int t_attr;
 #endif
-	unicode_t t_char;
 };
 
+#if COLOR
+#define	NATTR		256	/* Most colour pairs on the screen */
+#define	ATTR_NONE	0
+
+struct attr {
+	int a_fcolor;
+	int a_bcolor;
+};
+
+extern struct attr attrs[NATTR];
+
+#define	text_fcolor(tp)	(attrs[(tp)->t_attr].a_fcolor)
+#define	text_bcolor(tp)	(attrs[(tp)->t_attr].a_bcolor)
+
+unsigned int attr_find(int fcolor, int bcolor);
+void text_setfg(struct text *tp, int fcolor);
+void text_setbg(struct text *tp, int bcolor);
+#endif
+
 #endif /* DISPLAY_H_ */
@@ -71,6 +71,8 @@ struct key_tab keytab[NBINDS] = {
 	,
 	{CONTROL | ']', metafn}
 	,
+	{CONTROL | '_', undo}
+	,
 	{CTLX | CONTROL | 'B', listbuffers}
 	,
 	{CTLX | CONTROL | 'C', quit}
@@ -182,6 +184,8 @@ struct key_tab keytab[NBINDS] = {
 	{CTLX | 'S', fisearch}
 	,
 #endif
+	{CTLX | 'U', undo}
+	,
 	{CTLX | 'W', resize}
 	,
 	{CTLX | 'X', nextbuffer}
@@ -299,8 +303,12 @@ struct key_tab keytab[NBINDS] = {
 	,
 	{META | 'X', namedcmd}
 	,
+	{META | 'Y', yankpop}
+	,
 	{META | 'Z', quickexit}
 	,
+	{META | '_', redo}
+	,
 	{META | 0x7F, delbword}
 	,
 
@@ -62,8 +62,8 @@ extern int quotec;		/* quote char during mlreply() */
 extern int tabmask;
 extern char *cname[];		/* names of colors              */
 extern struct kill *kbufp;		/* current kill buffer chunk pointer */
-extern struct kill *kbufh;		/* kill buffer header pointer   */
-extern int kused;		/* # of bytes used in KB        */
+extern struct kill *kring[];	/* kill ring, newest kill first */
+extern int killring;		/* # of kills kept in the ring  */
 extern struct window *swindow;	/* saved window pointer         */
 extern int cryptflag;		/* currently encrypting?        */
 extern int *kbdptr;		/* current position in keyboard buf */
@@ -90,6 +90,12 @@ extern int justflag;		/* justify, don't fill */
 #endif
 extern int overlap;		/* line overlap in forw/back page */
 extern int scrollcount;		/* number of lines to scroll */
+extern int bigfile;		/* size of files read in shared */
+extern int srchjobs;		/* processes a big search is split over */
+extern int maxfps;		/* most screen updates a second */
+extern int undosize;		/* bytes of undo kept for a buffer */
+extern int frames;		/* screen updates done */
+extern int frdrop;		/* screen updates left out */
 
 /* Uninitialized global external declarations. */
 
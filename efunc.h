@@ -141,12 +141,15 @@ extern void mlforce(char *s);
 extern void mlputs(char *s);
 extern void getscreensize(int *widthp, int *heightp);
 extern void sizesignal(int signr);
-extern int mcomment_line_state(struct line *lp, int state);
 
 /* syntax.c */
 extern void syninit(void);
 extern void synfree(void);
 
+/* undo.c */
+extern int undo(int f, int n);
+extern int redo(int f, int n);
+
 /* region.c */
 extern int killregion(int f, int n);
 extern int copyregion(int f, int n);
@@ -161,6 +164,7 @@ extern int ttputc(int c);
 extern void ttflush(void);
 extern int ttgetc(void);
 extern int typahead(void);
+extern int ttwait(int msec);
 
 /* input.c */
 extern int mlyesno(char *prompt);
@@ -225,6 +229,8 @@ extern void unqname(char *name);
 extern int filewrite(int f, int n);
 extern int filesave(int f, int n);
 extern int writeout(char *fn);
+extern int savepoll(void);
+extern void savewait(struct buffer *bp);
 extern int filename(int f, int n);
 extern int ifile(char *fname);
 
@@ -233,7 +239,15 @@ extern int ffropen(char *fn);
 extern int ffwopen(char *fn);
 extern int ffclose(void);
 extern int ffputline(char *buf, int nbuf);
+extern int ffreplace(void);
+extern void ffdiscard(void);
+extern void ffdetach(void);
 extern int ffgetline(int *res);
+extern long ffsize(void);
+extern int ffgettext(char **textp, long *size);
+extern int ffmaptext(char **textp, long size);
+extern void ffunmaptext(char *text, long size);
+extern int ffsame(char *fn1, char *fn2);
 extern int fexist(char *fname);
 
 /* exec.c */
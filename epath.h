@@ -8,12 +8,15 @@
 #ifndef EPATH_H_
 #define EPATH_H_
 
-/*	possible names and paths of help files under different OSs	*/
+/*	possible names and paths of help files under different OSs:
+ *	the startup file, the help file and the syntax file come first
+ */
 static char *pathname[] =
 #if	MSDOS
 {
 	"emacs.rc",
 	"emacs.hlp",
+	"emacs.syn",
 	"\\sys\\public\\",
 	"\\usr\\bin\\",
 	"\\bin\\",
@@ -24,7 +27,7 @@ static char *pathname[] =
 
 #if	V7 | BSD | USG
 {
-	".emacsrc", "emacs.hlp",
+	".emacsrc", "emacs.hlp", "emacs.syn",
 #if	PKCODE
 	    "/usr/global/lib/", "/usr/local/bin/", "/usr/local/lib/",
 #endif
@@ -33,7 +36,7 @@ static char *pathname[] =
 
 #if	VMS
 {
-	"emacs.rc", "emacs.hlp", "",
+	"emacs.rc", "emacs.hlp", "emacs.syn", "",
 #if	PKCODE
 	    "sys$login:", "emacs_dir:",
 #endif
@@ -235,7 +235,9 @@
 #define HUGE    1000		/* Huge number                  */
 #define	NLOCKS	100		/* max # of file locks active   */
 #define	NCOLORS	8		/* number of supported colors   */
-#define	KBLOCK	250		/* sizeof kill buffer chunks    */
+#define	KBLOCK	250		/* sizeof first kill buffer chunk */
+#define	KMAXBLOCK 1048576	/* sizeof biggest kill chunk    */
+#define	NKRING	64		/* max # of kills in kill ring  */
 
 /* supported colors */
 #define CLR_NONE	-1
@@ -313,6 +315,7 @@
 
 #define CFCPCN  0x0001		/* Last command was C-P, C-N    */
 #define CFKILL  0x0002		/* Last command was a kill      */
+#define CFYANK  0x0004		/* Last command was a yank      */
 
 #define	BELL	0x07		/* a bell character             */
 #define	TAB	0x09		/* a tab character              */
@@ -467,15 +470,28 @@ struct window {
  * safe store for the dot and mark in the header, but this is only valid if
  * the buffer is not being displayed (that is, if "b_nwnd" is 0). The text for
  * the buffer is kept in a circularly linked list of lines, with a pointer to
- * the header line in "b_linep".
+ * the header line in "b_linep". The lines, all but the header, are carved
+ * from the arena of the buffer, so clearing a buffer is just dropping it.
  * 	Buffers may be "Inactive" which means the files associated with them
  * have not been read in yet. These get read in at "use buffer" time.
+ *	A buffer read from a big file keeps the original file text in "b_text",
+ * and its lines point into it until they are changed. Where it can, the
+ * text is the file itself mapped into memory (BFMAP). Text killed or
+ * copied from such lines is not copied either; "b_krefs" counts the kill
+ * ring pieces that point into the original text.
  */
 struct buffer {
         struct buffer *b_bufp;	/* Link to next struct buffer   */
 	struct line *b_dotp;	/* Link to "." struct line structure   */
 	struct line *b_markp;	/* The same as the above two,   */
 	struct line *b_linep;	/* Link to the header struct line      */
+	struct arena *b_arena;	/* Memory for the other lines   */
+	struct lindex *b_index;	/* Line numbers, made on demand */
+	struct undo *b_undo;	/* Changes to undo, or NULL     */
+	char *b_text;		/* Original text of a big file  */
+	long b_tsize;		/* Size of the original text    */
+	long b_krefs;		/* Kill pieces in the text      */
+	int b_spid;		/* Process saving it, or 0      */
 	int b_doto;		/* Offset of "." in above struct line  */
 	int b_marko;		/* but for the "mark"           */
 	int b_mode;		/* editor mode of this buffer   */
@@ -492,6 +508,8 @@ struct buffer {
 #define BFINVS  0x01		/* Internal invisable buffer    */
 #define BFCHG   0x02		/* Changed since last write     */
 #define	BFTRUNC	0x04		/* buffer was truncated when read */
+#define	BFMAP	0x08		/* original text is mapped file */
+#define	BFRESAVE 0x10		/* save again when saving is done */
 
 /*	mode flags	*/
 #define	NUMMODES	10	/* # of defined modes           */
@@ -596,14 +614,22 @@ struct name_bind {
 };
 
 /* The editor holds deleted text chunks in the struct kill buffer. The
- * kill buffer is logically a stream of ascii characters, however
- * due to its unpredicatable size, it gets implemented as a linked
- * list of chunks. (The d_ prefix is for "deleted" text, as k_
- * was taken up by the keycode structure).
+ * kill ring keeps the last few kills, each logically a stream of ascii
+ * characters; due to its unpredicatable size, a kill gets implemented
+ * as a linked list of chunks. A chunk either holds a copy of the text,
+ * following the structure in the same block, or points into the
+ * original text of a big file that the lines it came from still
+ * share ("d_bufp"); that costs nothing, however big the kill. Copies
+ * are twice the size of the one before, up to KMAXBLOCK, so a big kill
+ * takes few of them. (The d_ prefix is for "deleted" text, as k_ was
+ * taken up by the keycode structure).
  */
 struct kill {
 	struct kill *d_next;   /* Link to next chunk, NULL if last. */
-	char d_chunk[KBLOCK];  /* Deleted text. */
+	struct buffer *d_bufp; /* Buffer whose text it is, or NULL. */
+	char *d_chunk;         /* Deleted text. */
+	long d_used;           /* Bytes of text. */
+	long d_size;           /* Room for a copy, 0 if shared. */
 };
 
 /* When emacs' command interpetor needs to get a variable's name,
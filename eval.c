@@ -14,6 +14,7 @@
 #include "evar.h"
 #include "line.h"
 #include "util.h"
+#include "arena.h"
 #include "version.h"
 
 #define	MAXVARS	255
@@ -313,6 +314,22 @@ char *gtenv(char *vname)
 		return itoa(overlap);
 	case EVSCROLLCOUNT:
 		return itoa(scrollcount);
+	case EVBIGFILE:
+		return itoa(bigfile);
+	case EVARENA:
+		return arena_stats();
+	case EVSRCHJOBS:
+		return itoa(srchjobs);
+	case EVFPS:
+		return itoa(maxfps);
+	case EVFRAMES:
+		return itoa(frames);
+	case EVDROPPED:
+		return itoa(frdrop);
+	case EVUNDOSIZE:
+		return itoa(undosize);
+	case EVKILLRING:
+		return itoa(killring);
 #if SCROLLCODE
 	case EVSCROLL:
 		return ltos(term.t_scroll != NULL);
@@ -332,16 +349,17 @@ char *getkill(void)
 	int size;	/* max number of chars to return */
 	static char value[NSTRING];	/* temp buffer for value */
 
-	if (kbufh == NULL)
+	if (kring[0] == NULL)
 		/* no kill buffer....just a null string */
 		value[0] = 0;
 	else {
 		/* copy in the contents... */
-		if (kused < NSTRING)
-			size = kused;
+		if (kring[0]->d_used < NSTRING)
+			size = kring[0]->d_used;
 		else
 			size = NSTRING - 1;
-		strncpy(value, kbufh->d_chunk, size);
+		memcpy(value, kring[0]->d_chunk, size);
+		value[size] = 0;
 	}
 
 	/* and return the constructed value */
@@ -666,6 +684,33 @@ int svar(struct variable_description *var, char *value)
 		case EVSCROLLCOUNT:
 			scrollcount = atoi(value);
 			break;
+		case EVBIGFILE:
+			bigfile = atoi(value);
+			break;
+		case EVARENA:
+			break;
+		case EVSRCHJOBS:
+			srchjobs = atoi(value);
+			break;
+		case EVFPS:
+			maxfps = atoi(value);
+			break;
+		case EVFRAMES:
+			frames = atoi(value);
+			break;
+		case EVDROPPED:
+			frdrop = atoi(value);
+			break;
+		case EVUNDOSIZE:
+			undosize = atoi(value);
+			break;
+		case EVKILLRING:
+			killring = atoi(value);
+			if (killring < 1)
+				killring = 1;
+			if (killring > NKRING)
+				killring = NKRING;
+			break;
 		case EVSCROLL:
 #if SCROLLCODE
 			if (!stol(value))
@@ -60,6 +60,14 @@ static char *envars[] = {
 	"tab",			/* tab 4 or 8 */
 	"overlap",
 	"jump",
+	"bigfile",		/* size of files read in shared */
+	"arena",		/* line memory: reserved, live, hit % */
+	"srchjobs",		/* processes a big search is split over */
+	"fps",			/* most screen updates a second */
+	"frames",		/* screen updates done */
+	"dropped",		/* screen updates left out */
+	"undosize",		/* bytes of undo kept for a buffer */
+	"killring",		/* # of kills kept in the kill ring */
 #if SCROLLCODE
 	"scroll",		/* scroll enabled */
 #endif
@@ -107,7 +115,15 @@ static char *envars[] = {
 #define EVTAB		37
 #define EVOVERLAP	38
 #define EVSCROLLCOUNT	39
-#define EVSCROLL	40
+#define EVBIGFILE	40
+#define EVARENA		41
+#define EVSRCHJOBS	42
+#define EVFPS		43
+#define EVFRAMES	44
+#define EVDROPPED	45
+#define EVUNDOSIZE	46
+#define EVKILLRING	47
+#define EVSCROLL	48
 
 enum function_type {
 	NILNAMIC = 0,
@@ -13,6 +13,7 @@
 #include "edef.h"
 #include "efunc.h"
 #include "line.h"
+#include "lindex.h"
 
 /*
  * Execute a named command even if it is not bound.
@@ -636,7 +637,7 @@ int dobuf(struct buffer *bp)
 		if (mstore) {
 			/* allocate the space for the line */
 			linlen = strlen(eline);
-			if ((mp = lalloc(linlen)) == NULL) {
+			if ((mp = lalloc(bstore, linlen)) == NULL) {
 				mlwrite
 				    ("Out of memory while storing macro");
 				return FALSE;
@@ -651,6 +652,7 @@ int dobuf(struct buffer *bp)
 			mp->l_bp = bstore->b_linep->l_bp;
 			bstore->b_linep->l_bp = mp;
 			mp->l_fp = bstore->b_linep;
+			lindex_add(bstore, mp);
 			goto onward;
 		}
 
@@ -14,13 +14,28 @@
 #include "edef.h"
 #include "efunc.h"
 #include "line.h"
+#include "lindex.h"
 #include "util.h"
 
+#if	V7 | USG | BSD
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#endif
+
 #if defined(PKCODE)
 /* Max number of lines from one file. */
 #define	MAXNLINE 10000000
 #endif
 
+static void markmode(struct buffer *bp);
+static int unmaptext(struct buffer *bp);
+static int wopen(char *fn);
+static int wlines(struct buffer *bp, int *nlinep);
+#if	V7 | USG | BSD
+static int bgsave(struct buffer *bp);
+#endif
+
 /*
  * Read a file into the current
  * buffer. This is really easy; all you do it
@@ -202,6 +217,51 @@ int getfile(char *fname, int lockfl)
 	return s;
 }
 
+/*
+ * Make the open file the original text of buffer "bp", and build lines
+ * that share it instead of copying it. The file is mapped into memory if
+ * at all possible, and read in one go otherwise. This is how files of at
+ * least "bigfile" bytes are read; until they are changed, their lines
+ * cost no more than a line header each. Return the final status of the
+ * read, and count the lines in "nline".
+ */
+static int readshared(struct buffer *bp, long size, int *nline)
+{
+	struct line *lp1;
+	struct line *lp2;
+	char *cp;
+	char *ep;
+	char *np;
+	int s;
+
+	if (ffmaptext(&bp->b_text, size) == FIOSUC)
+		bp->b_flag |= BFMAP;
+	else if ((s = ffgettext(&bp->b_text, &size)) != FIOSUC)
+		return s;
+	bp->b_tsize = size;
+	cp = bp->b_text;
+	ep = cp + size;
+	while (cp != ep) {
+		if ((np = memchr(cp, '\n', ep - cp)) == NULL)
+			np = ep;
+#if	PKCODE
+		if (*nline > MAXNLINE)
+			return FIOMEM;
+#endif
+		if ((lp1 = lshare(bp, cp, np - cp)) == NULL)
+			return FIOMEM;
+		lp2 = lback(bp->b_linep);
+		lp2->l_fp = lp1;
+		lp1->l_fp = bp->b_linep;
+		lp1->l_bp = lp2;
+		bp->b_linep->l_bp = lp1;
+		lindex_add(bp, lp1);
+		++*nline;
+		cp = (np == ep) ? ep : np + 1;
+	}
+	return FIOEOF;
+}
+
 /*
  * Read file "fname" into the current buffer, blowing away any text
  * found there.  Called by both the read and find commands.  Return
@@ -223,9 +283,7 @@ int readin(char *fname, int lockfl)
 	int s;
 	int nbytes;
 	int nline;
-#if	COLOR
-	int nstate;
-#endif
+	long size;
 	char mesg[NSTRING];
 
 #if	(FILOCK && BSD) || SVR4
@@ -266,34 +324,31 @@ int readin(char *fname, int lockfl)
 	/* read the file in */
 	mlwrite("(Reading file)");
 	nline = 0;
-#if	COLOR
-	nstate = FALSE;
-#endif
-	while ((s = ffgetline(&nbytes)) == FIOSUC) {
-		if ((lp1 = lalloc(nbytes)) == NULL) {
-			s = FIOMEM;	/* Keep message on the  */
-			break;	/* display.             */
-		}
+	if (bigfile > 0 && nullflag && !cryptflag
+	    && (size = ffsize()) >= bigfile)
+		s = readshared(bp, size, &nline);
+	else {
+		while ((s = ffgetline(&nbytes)) == FIOSUC) {
+			if ((lp1 = lalloc(curbp, nbytes)) == NULL) {
+				s = FIOMEM;	/* Keep message on the  */
+				break;	/* display.             */
+			}
 #if	PKCODE
-		if (nline > MAXNLINE) {
-			s = FIOMEM;
-			break;
-		}
+			if (nline > MAXNLINE) {
+				s = FIOMEM;
+				break;
+			}
 #endif
-		lp2 = lback(curbp->b_linep);
-		lp2->l_fp = lp1;
-		lp1->l_fp = curbp->b_linep;
-		lp1->l_bp = lp2;
-		curbp->b_linep->l_bp = lp1;
-		for (i = 0; i < nbytes; ++i)
-			lputc(lp1, i, fline[i]);
-#if	COLOR
-		if ((curbp->b_mode & MDCMOD) != 0) {
-			lp1->l_mcomment = nstate;
-			nstate = mcomment_line_state(lp1, nstate);
+			lp2 = lback(curbp->b_linep);
+			lp2->l_fp = lp1;
+			lp1->l_fp = curbp->b_linep;
+			lp1->l_bp = lp2;
+			curbp->b_linep->l_bp = lp1;
+			lindex_add(curbp, lp1);
+			for (i = 0; i < nbytes; ++i)
+				lputc(lp1, i, fline[i]);
+			++nline;
 		}
-#endif
-		++nline;
 	}
 	ffclose();		/* Ignore errors.       */
 	strcpy(mesg, "(");
@@ -433,7 +488,6 @@ int filewrite(int f, int n)
  */
 int filesave(int f, int n)
 {
-	struct window *wp;
 	int s;
 
 	if (curbp->b_mode & MDVIEW)	/* don't allow this command if      */
@@ -453,18 +507,68 @@ int filesave(int f, int n)
 		}
 	}
 
-	if ((s = writeout(curbp->b_fname)) == TRUE) {
+#if	V7 | USG | BSD
+	/* from the keyboard, save in the background */
+	if (clexec == FALSE) {
+		if (curbp->b_spid != 0) {	/* One save at a time.  */
+			curbp->b_flag |= BFRESAVE;
+			mlwrite("(Saving again when the save is done)");
+			s = TRUE;
+		} else
+			s = bgsave(curbp);
+	} else {
+		savewait(curbp);
+		s = writeout(curbp->b_fname);
+	}
+#else
+	s = writeout(curbp->b_fname);
+#endif
+	if (s == TRUE) {
 		curbp->b_flag &= ~BFCHG;
-		wp = wheadp;	/* Update mode lines.   */
-		while (wp != NULL) {
-			if (wp->w_bufp == curbp)
-				wp->w_flag |= WFMODE;
-			wp = wp->w_wndp;
-		}
+		markmode(curbp);
 	}
 	return s;
 }
 
+/*
+ * Have the mode lines of the windows on buffer "bp" updated.
+ */
+static void markmode(struct buffer *bp)
+{
+	struct window *wp;
+
+	for (wp = wheadp; wp != NULL; wp = wp->w_wndp)
+		if (wp->w_bufp == bp)
+			wp->w_flag |= WFMODE;
+}
+
+/*
+ * Give buffer "bp" a copy of the file text it has mapped, and move the
+ * lines and kills that still share it over to the copy. Needed before the
+ * file is written over, which would pull the text out from under them.
+ */
+static int unmaptext(struct buffer *bp)
+{
+	struct line *lp;
+	char *text;
+	char *old;
+
+	if ((text = malloc(bp->b_tsize)) == NULL) {
+		mlwrite("(OUT OF MEMORY)");
+		return FALSE;
+	}
+	memcpy(text, bp->b_text, bp->b_tsize);
+	for (lp = lforw(bp->b_linep); lp != bp->b_linep; lp = lforw(lp))
+		if (lp->l_size == 0)
+			lp->l_text = text + (lp->l_text - bp->b_text);
+	old = bp->b_text;
+	bp->b_text = text;
+	kmove(bp, old);
+	ffunmaptext(old, bp->b_tsize);
+	bp->b_flag &= ~BFMAP;
+	return TRUE;
+}
+
 /*
  * This function performs the details of file
  * writing. Uses the file management routines in the
@@ -476,42 +580,191 @@ int filesave(int f, int n)
 int writeout(char *fn)
 {
 	int s;
-	struct line *lp;
 	int nline;
 
+	if ((s = wopen(fn)) != TRUE)
+		return s;
+	mlwrite("(Writing...)");	/* tell us were writing */
+	if ((s = wlines(curbp, &nline)) != FIOSUC)
+		return FALSE;
+	if (nline == 1)
+		mlwrite("(Wrote 1 line)");
+	else
+		mlwrite("(Wrote %d lines)", nline);
+	return TRUE;
+}
+
+/*
+ * Open file "fn" to write the current buffer to it.
+ */
+static int wopen(char *fn)
+{
+	struct buffer *bp;
+
 #if	CRYPT
+	int s;
+
 	s = resetkey();
 	if (s != TRUE)
 		return s;
 #endif
 
-	if ((s = ffwopen(fn)) != FIOSUC) {	/* Open writes message. */
+	if (ffwopen(fn) != FIOSUC)	/* Open writes message. */
 		return FALSE;
-	}
-	mlwrite("(Writing...)");	/* tell us were writing */
-	lp = lforw(curbp->b_linep);	/* First line.          */
-	nline = 0;		/* Number of lines.     */
-	while (lp != curbp->b_linep) {
+
+	/* don't write over a file that a buffer has mapped */
+	if (!ffreplace())
+		for (bp = bheadp; bp != NULL; bp = bp->b_bufp)
+			if ((bp->b_flag & BFMAP) != 0
+			    && ffsame(bp->b_fname, fn)
+			    && unmaptext(bp) != TRUE) {
+				ffdiscard();
+				return FALSE;
+			}
+	return TRUE;
+}
+
+/*
+ * Write the lines of buffer "bp" to the file opened by wopen(), and close
+ * it. Set "*nlinep" to the number of lines written.
+ */
+static int wlines(struct buffer *bp, int *nlinep)
+{
+	struct line *lp;
+	int s;
+
+	s = FIOSUC;
+	lp = lforw(bp->b_linep);	/* First line.          */
+	*nlinep = 0;		/* Number of lines.     */
+	while (lp != bp->b_linep) {
 		if ((s = ffputline(&lp->l_text[0], llength(lp))) != FIOSUC)
 			break;
-		++nline;
+		++*nlinep;
 		lp = lforw(lp);
 	}
-	if (s == FIOSUC) {	/* No write error.      */
-		s = ffclose();
-		if (s == FIOSUC) {	/* No close error.      */
-			if (nline == 1)
-				mlwrite("(Wrote 1 line)");
-			else
-				mlwrite("(Wrote %d lines)", nline);
+	if (s == FIOSUC)	/* No write error.      */
+		return ffclose();
+	ffdiscard();		/* Keep the old file    */
+	return s;		/* if a write error.    */
+}
+
+#if	V7 | USG | BSD
+static int nsaving;		/* Saves going on in the background */
+
+/*
+ * Start saving buffer "bp" in the background. The file is opened here,
+ * and a child process writes the lines to it: it has a copy of the buffer
+ * as it is now, so editing can go on while it writes. savepoll() reports
+ * how it went. If there is no child to be had, save it the usual way.
+ */
+static int bgsave(struct buffer *bp)
+{
+	struct buffer *oldbp;
+	int nline;
+	int pid;
+	int fd;
+	int s;
+
+	oldbp = curbp;		/* Keys and messages are    */
+	curbp = bp;		/* those of the current one */
+	if ((s = wopen(bp->b_fname)) != TRUE) {
+		curbp = oldbp;
+		return s;
+	}
+	if ((pid = fork()) < 0) {
+		s = writeout(bp->b_fname);
+		curbp = oldbp;
+		return s;
+	}
+	curbp = oldbp;
+	if (pid == 0) {		/* The child: off the screen */
+		if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+			dup2(fd, 0);
+			dup2(fd, 1);
+			dup2(fd, 2);
 		}
-	} else			/* Ignore close error   */
-		ffclose();	/* if a write error.    */
-	if (s != FIOSUC)	/* Some sort of error.  */
-		return FALSE;
+		discmd = FALSE;
+		_exit(wlines(bp, &nline) == FIOSUC ? 0 : 1);
+	}
+	ffdetach();
+	bp->b_spid = pid;
+	++nsaving;
+	mlwrite("(Saving %s...)", bp->b_fname);
 	return TRUE;
 }
 
+/*
+ * Collect the background saves that are done, of buffer "bp" or of all
+ * buffers if it is NULL, and say how they went. If "hang" is TRUE, wait for
+ * them to be done.
+ */
+static void savereap(struct buffer *bp, int hang)
+{
+	struct buffer *bp1;
+	int status;
+	int pid;
+
+	for (bp1 = bheadp; bp1 != NULL && nsaving != 0; bp1 = bp1->b_bufp) {
+		if (bp != NULL && bp1 != bp)
+			continue;
+		while (bp1->b_spid != 0) {
+			pid = waitpid(bp1->b_spid, &status, hang ? 0 : WNOHANG);
+			if (pid == 0 || (pid < 0 && errno == EINTR && !hang))
+				break;
+			if (pid < 0 && errno == EINTR)
+				continue;
+			bp1->b_spid = 0;
+			--nsaving;
+			if (pid > 0 && WIFEXITED(status)
+			    && WEXITSTATUS(status) == 0)
+				mlwrite("(Wrote %s)", bp1->b_fname);
+			else {
+				mlwrite("Error saving %s", bp1->b_fname);
+				bp1->b_flag |= BFCHG;
+			}
+			if ((bp1->b_flag & BFRESAVE) != 0) {
+				bp1->b_flag &= ~BFRESAVE;
+				if (bgsave(bp1) == TRUE)
+					bp1->b_flag &= ~BFCHG;
+				else
+					bp1->b_flag |= BFCHG;
+			}
+			markmode(bp1);
+		}
+	}
+}
+
+/*
+ * Report on the background saves that are done. Return the number of saves
+ * still going on.
+ */
+int savepoll(void)
+{
+	if (nsaving != 0)
+		savereap(NULL, FALSE);
+	return nsaving;
+}
+
+/*
+ * Wait for the background saves of buffer "bp", or of all buffers if it
+ * is NULL, to be done.
+ */
+void savewait(struct buffer *bp)
+{
+	if (nsaving != 0)
+		savereap(bp, TRUE);
+}
+#else
+int savepoll(void)
+{
+	return 0;
+}
+
+void savewait(struct buffer *bp)
+{
+}
+#endif
+
 /*
  * The command allows the user
  * to modify the file name associated with
@@ -545,24 +798,48 @@ int filename(int f, int n)
 	return TRUE;
 }
 
+/*
+ * Put the "n" bytes at "text" in front of the line dot is on, as whole
+ * lines; the last one may lack its newline. Dot stays on that line.
+ */
+static int inslines(char *text, long n)
+{
+	if (n == 0)
+		return TRUE;
+	if (curwp->w_dotp != curbp->b_linep) {
+		if (linstext(text, n) != TRUE)
+			return FALSE;
+		return text[n - 1] == '\n' ? TRUE : lnewline();
+	}
+
+	/* at the end a line goes in with its newline */
+	if (text[n - 1] == '\n')
+		--n;
+	if ((n > 0 ? linstext(text, n) : lnewline()) != TRUE)
+		return FALSE;
+	curwp->w_dotp = curbp->b_linep;
+	curwp->w_doto = 0;
+	return TRUE;
+}
+
 /*
  * Insert file "fname" into the current
  * buffer, Called by insert file command. Return the final
- * status of the read.
+ * status of the read. The file goes in front of the line
+ * dot is on, in one go if it can be read in one block,
+ * and the mark is set at the start of it.
  */
 int ifile(char *fname)
 {
 	struct line *lp0;
-	struct line *lp1;
-	struct line *lp2;
-	int i;
 	struct buffer *bp;
 	int s;
 	int nbytes;
-	int nline;
-#if	COLOR
-	int nstate;
-#endif
+	long nline;
+	long line;
+	long byte;
+	long size;
+	char *text;
 	char mesg[NSTRING];
 
 	bp = curbp;		/* Cheap.               */
@@ -581,48 +858,29 @@ int ifile(char *fname)
 	if (s != TRUE)
 		return s;
 #endif
-	/* back up a line and save the mark here */
-	curwp->w_dotp = lback(curwp->w_dotp);
+	/* remember the line before, for the mark */
+	lp0 = lback(curwp->w_dotp);
 	curwp->w_doto = 0;
-	curwp->w_markp = curwp->w_dotp;
-	curwp->w_marko = 0;
+	lindex_where(curbp, curwp->w_dotp, &nline, &byte);
 
-	nline = 0;
-#if	COLOR
-	nstate = FALSE;
-	if ((curbp->b_mode & MDCMOD) != 0) {
-		nstate = curwp->w_dotp->l_mcomment;
-		nstate = mcomment_line_state(curwp->w_dotp, nstate);
-	}
-#endif
-	while ((s = ffgetline(&nbytes)) == FIOSUC) {
-		if ((lp1 = lalloc(nbytes)) == NULL) {
-			s = FIOMEM;	/* Keep message on the  */
-			break;	/* display.             */
+	if (nullflag && !cryptflag && (size = ffsize()) >= 0) {
+		if ((s = ffgettext(&text, &size)) == FIOSUC) {
+			s = inslines(text, size) == TRUE ? FIOEOF : FIOMEM;
+			free(text);
 		}
-		lp0 = curwp->w_dotp;	/* line previous to insert */
-		lp2 = lp0->l_fp;	/* line after insert */
-
-		/* re-link new line between lp0 and lp2 */
-		lp2->l_bp = lp1;
-		lp0->l_fp = lp1;
-		lp1->l_bp = lp0;
-		lp1->l_fp = lp2;
-
-		/* and advance and write out the current line */
-		curwp->w_dotp = lp1;
-		for (i = 0; i < nbytes; ++i)
-			lputc(lp1, i, fline[i]);
-#if	COLOR
-		if ((curbp->b_mode & MDCMOD) != 0) {
-			lp1->l_mcomment = nstate;
-			nstate = mcomment_line_state(lp1, nstate);
+	} else
+		while ((s = ffgetline(&nbytes)) == FIOSUC) {
+			fline[nbytes] = '\n';	/* There is room for it */
+			if (inslines(fline, nbytes + 1L) != TRUE) {
+				s = FIOMEM;	/* Keep message on the  */
+				break;	/* display.             */
+			}
 		}
-#endif
-		++nline;
-	}
 	ffclose();		/* Ignore errors.       */
-	curwp->w_markp = lforw(curwp->w_markp);
+	curwp->w_markp = lforw(lp0);
+	curwp->w_marko = 0;
+	lindex_where(curbp, curwp->w_dotp, &line, &byte);
+	nline = line - nline;
 	strcpy(mesg, "(");
 	if (s == FIOERR) {
 		strcat(mesg, "I/O ERROR, ");
@@ -632,27 +890,14 @@ int ifile(char *fname)
 		strcat(mesg, "OUT OF MEMORY, ");
 		curbp->b_flag |= BFTRUNC;
 	}
-#if	COLOR
-	if ((curbp->b_mode & MDCMOD) != 0) {
-		lp1 = lforw(curwp->w_dotp);
-		while (lp1 != curwp->w_bufp->b_linep) {
-			if (lp1->l_mcomment == nstate)
-				break;
-			lp1->l_mcomment = nstate;
-			nstate = mcomment_line_state(lp1, nstate);
-			lp1 = lforw(lp1);
-		}
-	}
-#endif
-	sprintf(&mesg[strlen(mesg)], "Inserted %d line", nline);
+	sprintf(&mesg[strlen(mesg)], "Inserted %ld line", nline);
 	if (nline > 1)
 		strcat(mesg, "s");
 	strcat(mesg, ")");
 	mlwrite(mesg);
 
       out:
-	/* advance to the next line and mark the window for changes */
-	curwp->w_dotp = lforw(curwp->w_dotp);
+	/* mark the window for changes */
 	curwp->w_flag |= WFHARD | WFMODE;
 
 	/* copy window parameters back to the buffer structure */
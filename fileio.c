@@ -7,13 +7,46 @@
  */
 
 #include        <stdio.h>
+#include	<string.h>
 #include	"estruct.h"
 #include        "edef.h"
 #include	"efunc.h"
 
+#if	V7 | USG | BSD
+#include	<sys/types.h>
+#include	<sys/stat.h>
+#include	<sys/mman.h>
+#include	<sys/uio.h>
+#include	<errno.h>
+#include	<fcntl.h>
+#include	<unistd.h>
+#endif
+
 static FILE *ffp;			/* File pointer, all functions. */
 static int eofflag;			/* end-of-file flag */
 
+#define	FBUFSIZ	65536			/* read buffer size */
+static char fbuf[FBUFSIZ];		/* read buffer for ffgetline() */
+static int fbpos;			/* next byte in fbuf */
+static int fbend;			/* end of the bytes in fbuf */
+
+#if	V7 | USG | BSD
+/*
+ * A file is written by gathering the text of the lines into "fiov" and
+ * handing it to writev() in one go. Encrypted text is copied to "fbuf"
+ * first. Where it can, the text goes to a new file next to the old one,
+ * which is renamed over it once it is all safely on the disk.
+ */
+#define	NFIOV	1024			/* lines, and newlines, per writev */
+static struct iovec fiov[NFIOV];	/* text waiting to be written */
+static int nfiov;			/* entries used in fiov */
+static int ffd = -1;			/* file being written, or -1 */
+static long fwsize;			/* bytes written so far */
+static int ftrunc;			/* cut the file to fwsize at the end */
+static char fwname[NFILEN];		/* name of the file being written */
+static char ftmpname[NFILEN + 8];	/* its new file, "" if in place */
+#endif
+
 /*
  * Open a file for reading.
  */
@@ -22,15 +55,68 @@ int ffropen(char *fn)
 	if ((ffp = fopen(fn, "r")) == NULL)
 		return FIOFNF;
 	eofflag = FALSE;
+	fbpos = 0;
+	fbend = 0;
 	return FIOSUC;
 }
 
 /*
  * Open a file for writing. Return TRUE if all is well, and FALSE on error
- * (cannot create).
+ * (cannot create). On UNIX this makes a new file to replace the old one
+ * with, keeping its mode and owner; a file that is a link, or that has no
+ * room for a new one next to it, is written over in place.
  */
 int ffwopen(char *fn)
 {
+#if	V7 | USG | BSD
+	struct stat st;
+	int exists;
+	int mode;
+
+	nfiov = 0;
+	fbpos = 0;
+	fwsize = 0;
+	ffd = -1;
+	strcpy(fwname, fn);
+	ftmpname[0] = 0;
+
+	/* a link is better written in place, so that it stays one */
+	exists = lstat(fn, &st) == 0;
+	if (!exists || (S_ISREG(st.st_mode) && st.st_nlink == 1)) {
+		if (strlen(fn) + 8 <= sizeof(ftmpname)) {
+			strcpy(ftmpname, fn);
+			strcat(ftmpname, ".XXXXXX");
+			ffd = mkstemp(ftmpname);
+		}
+		if (ffd < 0)
+			ftmpname[0] = 0;
+		else {
+			if (exists) {
+				mode = st.st_mode & 07777;
+				if (fchown(ffd, st.st_uid, st.st_gid) != 0)
+					mode &= 0777;
+			} else {
+				mode = umask(0);
+				umask(mode);
+				mode = 0666 & ~mode;
+			}
+			fchmod(ffd, mode);
+		}
+	}
+
+	/* no new file, so truncate the old one only when done */
+	ftrunc = FALSE;
+	if (ffd < 0) {
+		ftrunc = stat(fn, &st) == 0 && S_ISREG(st.st_mode);
+		ffd = open(fn, ftrunc ? O_WRONLY : O_WRONLY | O_CREAT | O_TRUNC,
+			   0666);
+		if (ffd < 0) {
+			mlwrite("Cannot open file for writing");
+			return FIOERR;
+		}
+	}
+	return FIOSUC;
+#else
 #if     VMS
 	int fd;
 
@@ -43,8 +129,116 @@ int ffwopen(char *fn)
 		return FIOERR;
 	}
 	return FIOSUC;
+#endif
 }
 
+#if	V7 | USG | BSD
+/*
+ * Write out everything gathered in "fiov". Return the status.
+ */
+static int ffflush(void)
+{
+	struct iovec *iov;
+	int n;
+	ssize_t w;
+
+	iov = fiov;
+	n = nfiov;
+	while (n > 0) {
+		if ((w = writev(ffd, iov, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return FIOERR;
+		}
+		while (n > 0 && (size_t) w >= iov->iov_len) {
+			w -= iov->iov_len;
+			++iov;
+			--n;
+		}
+		if (n > 0) {	/* Partly written       */
+			iov->iov_base = (char *) iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+	nfiov = 0;
+	fbpos = 0;
+	return FIOSUC;
+}
+
+/*
+ * Add "nbuf" bytes at "buf" to the text to be written, flushing it when
+ * there is no room left. Encrypt it on the way if "crypt" is set.
+ */
+static int ffgather(char *buf, int nbuf, int crypt)
+{
+	struct iovec *iov;
+	int n;
+
+	while (nbuf > 0) {
+		if (nfiov == NFIOV && ffflush() != FIOSUC)
+			return FIOERR;
+		n = nbuf;
+		if (crypt) {	/* Encrypt a copy       */
+			if (fbpos == FBUFSIZ && ffflush() != FIOSUC)
+				return FIOERR;
+			if (n > FBUFSIZ - fbpos)
+				n = FBUFSIZ - fbpos;
+			memcpy(&fbuf[fbpos], buf, n);
+#if	CRYPT
+			myencrypt(&fbuf[fbpos], n);
+#endif
+			buf = &fbuf[fbpos];
+			fbpos += n;
+		}
+		iov = &fiov[nfiov];
+		if (nfiov > 0 && (char *) iov[-1].iov_base + iov[-1].iov_len == buf)
+			iov[-1].iov_len += n;	/* Runs on: join it     */
+		else {
+			iov->iov_base = buf;
+			iov->iov_len = n;
+			++nfiov;
+		}
+		fwsize += n;
+		buf += n;
+		nbuf -= n;
+	}
+	return FIOSUC;
+}
+
+/*
+ * Finish off the file being written: write out the rest of the text, and
+ * either move the new file into place or cut the old one down to size.
+ * If "keep" is FALSE, something went wrong; then the new file is thrown
+ * away, and the old one is left as it is.
+ */
+static int ffwclose(int keep)
+{
+	int s;
+
+	s = FIOSUC;
+	if (keep && ffflush() != FIOSUC) {
+		mlwrite("Write I/O error");
+		keep = FALSE;
+		s = FIOERR;
+	}
+	if (keep && ftrunc && ftruncate(ffd, fwsize) != 0)
+		s = FIOERR;
+	if (keep && ftmpname[0] != 0 && fsync(ffd) != 0)
+		s = FIOERR;
+	if (close(ffd) != 0)
+		s = FIOERR;
+	ffd = -1;
+	if (s == FIOSUC && keep && ftmpname[0] != 0
+	    && rename(ftmpname, fwname) != 0)
+		s = FIOERR;
+	if (s != FIOSUC && keep)
+		mlwrite("Error closing file");
+	if (ftmpname[0] != 0 && (s != FIOSUC || !keep))
+		unlink(ftmpname);
+	return s;
+}
+#endif
+
 /*
  * Close a file. Should look at the status in all systems.
  */
@@ -57,6 +251,11 @@ int ffclose(void)
 	}
 	eofflag = FALSE;
 
+#if	V7 | USG | BSD
+	if (ffd >= 0)
+		return ffwclose(TRUE);
+#endif
+
 #if	MSDOS & CTRLZ
 	fputc(26, ffp);		/* add a ^Z at the end of the file */
 #endif
@@ -73,6 +272,45 @@ int ffclose(void)
 #endif
 }
 
+/*
+ * Is the file being written going to replace the old one, rather than be
+ * written over it?
+ */
+int ffreplace(void)
+{
+#if	V7 | USG | BSD
+	return ffd >= 0 && ftmpname[0] != 0;
+#else
+	return FALSE;
+#endif
+}
+
+/*
+ * Give up on the file being written. The old file is left as it was,
+ * unless it was written in place and some of it was written already.
+ */
+void ffdiscard(void)
+{
+#if	V7 | USG | BSD
+	ffwclose(FALSE);
+#else
+	ffclose();
+#endif
+}
+
+/*
+ * Let go of the file being written without finishing it or throwing it
+ * away; that is left to the process the writing was handed to.
+ */
+void ffdetach(void)
+{
+#if	V7 | USG | BSD
+	if (ffd >= 0)
+		close(ffd);
+	ffd = -1;
+#endif
+}
+
 /*
  * Write a line to the already opened file. The "buf" points to the buffer,
  * and the "nbuf" is its length, less the free newline. Return the status.
@@ -80,6 +318,16 @@ int ffclose(void)
  */
 int ffputline(char *buf, int nbuf)
 {
+#if	V7 | USG | BSD
+	static char newline = '\n';
+
+	if (ffgather(buf, nbuf, cryptflag) != FIOSUC
+	    || ffgather(&newline, 1, FALSE) != FIOSUC) {
+		mlwrite("Write I/O error");
+		return FIOERR;
+	}
+	return FIOSUC;
+#else
 	int i;
 #if	CRYPT
 	char c;			/* character to translate */
@@ -106,89 +354,101 @@ int ffputline(char *buf, int nbuf)
 	}
 
 	return FIOSUC;
+#endif
+}
+
+/*
+ * Fill the read buffer from the file. Return the number of bytes read, 0 at
+ * the end of the file, or -1 on a read error.
+ */
+static int ffillbuf(void)
+{
+	int n;
+
+#if	V7 | USG | BSD
+	n = read(fileno(ffp), fbuf, FBUFSIZ);
+#else
+	n = fread(fbuf, 1, FBUFSIZ, ffp);
+	if (n == 0 && ferror(ffp))
+		n = -1;
+#endif
+	fbpos = 0;
+	fbend = n > 0 ? n : 0;
+	return n;
 }
 
 /*
- * Read a line from a file, and store the bytes in the supplied buffer. The
- * "nbuf" is the length of the buffer. Complain about long lines and lines
- * at the end of the file that don't have a newline present. Check for I/O
- * errors too. Return status.
+ * Read a line from a file, and store the bytes in "fline", which grows to
+ * fit the line. The file is read a big block at a time, and the line is
+ * cut out of the block. Complain about lines at the end of the file that
+ * don't have a newline present. Check for I/O errors too. Return status.
  */
 int ffgetline(int *res)
 {
-	int c;		/* current character read */
-	int i;		/* current index into fline */
+	char *cp;	/* start of the rest of the read buffer */
+	char *ep;	/* newline in it, if any */
 	char *tmpline;	/* temp storage for expanding line */
+	int i;		/* current index into fline */
+	int n;		/* bytes of the line in the read buffer */
+	int size;	/* size to grow fline to */
 
 	/* if we are at the end...return it */
 	if (eofflag)
 		return FIOEOF;
 
-	/* dump fline if it ended up too big */
-	if (flen > NSTRING) {
-		free(fline);
-		fline = NULL;
-	}
-
 	/* if we don't have an fline, allocate one */
 	if (fline == NULL)
 		if ((fline = malloc(flen = NSTRING)) == NULL)
 			return FIOMEM;
 
 	/* read the line in */
-#if	PKCODE
-	if (!nullflag) {
-		if (fgets(fline, NSTRING, ffp) == (char *) NULL) {	/* EOF ? */
-			i = 0;
-			c = EOF;
-		} else {
-			i = strlen(fline);
-			c = 0;
-			if (i > 0) {
-				c = fline[i - 1];
-				i--;
-			}
-		}
-	} else {
-		i = 0;
-		c = fgetc(ffp);
-	}
-	while (c != EOF && c != '\n') {
-#else
 	i = 0;
-	while ((c = fgetc(ffp)) != EOF && c != '\n') {
-#endif
-#if	PKCODE
-		if (c || nullflag) {
-#endif
-			fline[i++] = c;
-			/* if it's longer, get more room */
-			if (i >= flen) {
-				if ((tmpline =
-				     malloc(flen + NSTRING)) == NULL)
-					return FIOMEM;
-				strncpy(tmpline, fline, flen);
-				flen += NSTRING;
-				free(fline);
-				fline = tmpline;
+	for (;;) {
+		if (fbpos == fbend) {
+			n = ffillbuf();
+			if (n < 0) {
+				mlwrite("File read error");
+				return FIOERR;
+			}
+			if (n == 0) {	/* End of file          */
+				if (i == 0)
+					return FIOEOF;
+				eofflag = TRUE;
+				break;
 			}
-#if	PKCODE
 		}
-		c = fgetc(ffp);
-#endif
-	}
+		cp = &fbuf[fbpos];
+		if ((ep = memchr(cp, '\n', fbend - fbpos)) != NULL)
+			n = ep - cp;
+		else
+			n = fbend - fbpos;
+		fbpos += n;
 
-	/* test for any errors that may have occured */
-	if (c == EOF) {
-		if (ferror(ffp)) {
-			mlwrite("File read error");
-			return FIOERR;
+		/* if it's longer, get more room */
+		if (i + n >= flen) {
+			size = flen * 2;
+			while (i + n >= size)
+				size *= 2;
+			if ((tmpline = realloc(fline, size)) == NULL)
+				return FIOMEM;
+			fline = tmpline;
+			flen = size;
+		}
+#if	PKCODE
+		if (!nullflag) {	/* Drop null characters */
+			for (; n > 0; --n, ++cp)
+				if (*cp != 0)
+					fline[i++] = *cp;
+		} else
+#endif
+		{
+			memcpy(&fline[i], cp, n);
+			i += n;
+		}
+		if (ep != NULL) {	/* Skip the newline     */
+			++fbpos;
+			break;
 		}
-
-		if (i != 0)
-			eofflag = TRUE;
-		else
-			return FIOEOF;
 	}
 
 	/* terminate and decrypt the string */
@@ -201,6 +461,99 @@ int ffgetline(int *res)
 	return FIOSUC;
 }
 
+/*
+ * Return the size of the file opened for reading, or -1 if it is not a
+ * plain file or the size cannot be told.
+ */
+long ffsize(void)
+{
+#if	V7 | USG | BSD
+	struct stat st;
+
+	if (fstat(fileno(ffp), &st) != 0 || !S_ISREG(st.st_mode))
+		return -1;
+	return (long) st.st_size;
+#else
+	return -1;
+#endif
+}
+
+/*
+ * Read the rest of the file opened for reading into one block of memory,
+ * for a buffer whose lines share the original file text, or to insert it
+ * all at once. The "size" is what ffsize() told; the number of bytes
+ * actually read is stored back into it. Return the status.
+ */
+int ffgettext(char **textp, long *size)
+{
+	char *text;
+	long n;
+
+	if ((text = malloc(*size > 0 ? *size : 1)) == NULL)
+		return FIOMEM;
+	n = fread(text, 1, *size, ffp);
+	if (ferror(ffp)) {
+		free(text);
+		mlwrite("File read error");
+		return FIOERR;
+	}
+	*textp = text;
+	*size = n;
+	return FIOSUC;
+}
+
+/*
+ * Map the file opened for reading into memory, read only, instead of
+ * reading it. The "size" is what ffsize() told. Nothing is copied; the
+ * pages are read in by the system when the text is first looked at.
+ * Return FIOSUC, or FIOERR if the file cannot be mapped (the caller can
+ * still read it with ffgettext()).
+ */
+int ffmaptext(char **textp, long size)
+{
+#if	V7 | USG | BSD
+	char *text;
+
+	if (size <= 0)
+		return FIOERR;
+	text = mmap(NULL, (size_t) size, PROT_READ, MAP_PRIVATE,
+		    fileno(ffp), (off_t) 0);
+	if (text == MAP_FAILED)
+		return FIOERR;
+	*textp = text;
+	return FIOSUC;
+#else
+	return FIOERR;
+#endif
+}
+
+/*
+ * Release file text mapped by ffmaptext().
+ */
+void ffunmaptext(char *text, long size)
+{
+#if	V7 | USG | BSD
+	munmap(text, (size_t) size);
+#endif
+}
+
+/*
+ * Do the names <fn1> and <fn2> refer to the same file on disk?
+ */
+int ffsame(char *fn1, char *fn2)
+{
+#if	V7 | USG | BSD
+	struct stat st1;
+	struct stat st2;
+
+	if (stat(fn1, &st1) != 0 || stat(fn2, &st2) != 0)
+		return FALSE;
+	return st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino;
+#else
+	return strcmp(fn1, fn2) == 0;
+#endif
+}
+
 /*
  * does <fname> exist on disk?
  *
@@ -59,8 +59,8 @@ char *cname[] = {		/* names of colors              */
 #endif
 };
 struct kill *kbufp = NULL;		/* current kill buffer chunk pointer    */
-struct kill *kbufh = NULL;		/* kill buffer header pointer           */
-int kused = KBLOCK;		/* # of bytes used in kill buffer       */
+struct kill *kring[NKRING];		/* kill ring, newest kill first         */
+int killring = 8;		/* # of kills kept in the kill ring     */
 struct window *swindow = NULL;	/* saved window pointer                 */
 int cryptflag = FALSE;		/* currently encrypting?                */
 int *kbdptr;			/* current position in keyboard buf */
@@ -87,6 +87,12 @@ int justflag = FALSE;		/* justify, don't fill */
 #endif
 int overlap = 0;		/* line overlap in forw/back page */
 int scrollcount = 1;		/* number of lines to scroll */
+int bigfile = 1048576;		/* files this big share their text */
+int srchjobs = 0;		/* processes a big search uses, 0 = CPUs */
+int maxfps = 60;		/* most screen updates a second, 0 = any */
+int undosize = 16777216;	/* bytes of undo kept for a buffer */
+int frames = 0;			/* screen updates done */
+int frdrop = 0;			/* screen updates left out */
 
 /* uninitialized global definitions */
 
@@ -258,7 +258,8 @@ int isearch(int f, int n)
 		if (!status) {	/* If we lost last time       */
 			TTputc(BELL);	/* Feep again                 */
 			TTflush();	/* see that the feep feeps    */
-		} else /* Otherwise, we must have won */ if (!(status = checknext(c, pat, n)))	/* See if match         */
+		} else /* Otherwise, we must have won */ if (status == ABORT	/* or been cut short    */
+			    || !(status = checknext(c, pat, n)))	/* See if match         */
 			status = scanmore(pat, n);	/*  or find the next match    */
 		c = ectoc(expc = get_char());	/* Get the next char          */
 	}			/* for {;;} */
@@ -332,7 +333,7 @@ int scanmore(char *patrn, int dir)	/* search forward or back for a pattern
 	} else
 		sts = scanner(patrn, FORWARD, PTEND);	/* Nope. Go forward   */
 
-	if (!sts) {
+	if (sts == FALSE) {
 		TTputc(BELL);	/* Feep if search fails       */
 		TTflush();	/* see that the feep feeps    */
 	}
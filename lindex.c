@@ -0,0 +1,863 @@
+/*	lindex.c
+ *
+ * The line index of a buffer.
+ *
+ * The lines of a buffer are cut into chunks of about CHUNKLINES lines, and
+ * each line knows the chunk it is in ("l_chunk"). A chunk keeps its first
+ * line and how many lines and bytes are in it. Two Fenwick trees over the
+ * chunks, in buffer order, sum up the lines and the bytes in front of any
+ * chunk, so finding the number or byte offset of a line is a walk back to
+ * the start of its chunk plus a tree lookup, and finding line "n" is a tree
+ * descent plus a walk forward within a chunk.
+ *
+ * The index is built the first time it is asked for, so reading in a file
+ * costs nothing extra; after that the line functions keep it up to date.
+ * A chunk that grows to twice its size is split. A chunk that loses all of
+ * its lines stays in the trees, empty, until there are many of those, when
+ * the trees are rebuilt without them. Clearing the buffer throws the whole
+ * index away.
+ *
+ * The chunks are also where the multi line comment state of a buffer with
+ * a language is kept: each chunk knows the state at its first line, but
+ * only the ones in front of "x_mcvalid" are right, and only for language
+ * "x_mclang". A change to a line can only change the state of the lines
+ * after it, so it just pulls "x_mcvalid" back to the chunk of the line;
+ * the states are worked out again when the display asks for them, and
+ * then only down to the line it asked about. A chunk whose lines have not
+ * changed since the state after it was worked out ("c_changed") need not
+ * be gone through again if it starts in the same state as it did then.
+ *
+ * Last, each chunk sums up the fences in it that are not in comments or
+ * strings: for each kind, how many more open ones there are than close
+ * ones, and the least that comes to over a run of its first lines. That
+ * is all it takes to tell whether the fence that matches one in front of
+ * it (or after it) is in the chunk, so "lindex_fence" can pass over the
+ * chunks that do not have it without looking at their lines. The sums
+ * are made when they are first needed, and made again once a line of the
+ * chunk has changed or it starts in another comment state.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "utf8.h"
+#include "line.h"
+#include "lindex.h"
+#include "syntax.h"
+
+#define	CHUNKLINES	128	/* Lines in a chunk, split at twice that */
+#define	NFENCE		3	/* Kinds of fence, ()[]{}           */
+
+static const char fenceopen[NFENCE + 1] = "([{";
+static const char fenceclose[NFENCE + 1] = ")]}";
+
+/* What a run of lines does to the depth of one kind of fence */
+struct lfence {
+	int f_depth;		/* Open fences less close ones  */
+	int f_low;		/* Least of that over its start */
+};
+
+struct lchunk {
+	struct line *c_first;	/* First line, NULL if empty    */
+	int c_pos;		/* Position, or next free slot  */
+	int c_lines;		/* Lines in the chunk           */
+	long c_bytes;		/* Bytes, one newline per line  */
+	int c_fstate;		/* State c_fence is for, or -1  */
+	struct lfence c_fence[NFENCE];	/* Fences, by kind      */
+#if COLOR
+	int c_mcomment;		/* Comment state at c_first     */
+	int c_changed;		/* Lines changed since the next */
+				/* chunk's state was worked out */
+#endif
+};
+
+struct lindex {
+	int x_valid;		/* Chunks match the lines       */
+	struct lchunk *x_chunk;	/* The chunks, by slot          */
+	int x_nslot;		/* Slots ever handed out        */
+	int x_free;		/* First free slot, -1 if none  */
+	int *x_order;		/* Slot at each position        */
+	long *x_lines;		/* Fenwick trees over positions */
+	long *x_bytes;		/* (from 1) for lines and bytes */
+	int x_nchunk;		/* Chunks in buffer order       */
+	int x_nempty;		/* ... that are empty           */
+	int x_max;		/* Room in all of the arrays    */
+#if COLOR
+	int x_mcvalid;		/* Positions with c_mcomment    */
+	struct synlang *x_mclang;	/* Language they are for */
+	struct synlang *x_flang;	/* and the c_fence ones  */
+#endif
+};
+
+static int *fenceoff;		/* Offsets of fences found      */
+static struct line **fenceline;	/* and their lines              */
+static int fenceroom;		/* Room in both                 */
+
+/*
+ * A line of chunk "cp" changed: its fences have to be summed up again, and
+ * the comment states after it may be off.
+ */
+static void stale(struct lindex *xp, struct lchunk *cp)
+{
+	cp->c_fstate = -1;
+#if COLOR
+	cp->c_changed = TRUE;
+	if (cp->c_pos < xp->x_mcvalid)
+		xp->x_mcvalid = cp->c_pos + 1;
+#endif
+}
+
+/*
+ * Set up chunk "cp" that has just been made; nothing about its lines is
+ * known.
+ */
+static void fresh(struct lchunk *cp)
+{
+	cp->c_fstate = -1;
+#if COLOR
+	cp->c_changed = TRUE;
+#endif
+}
+
+/*
+ * Add "delta" to the entry for position "pos" of the Fenwick tree "tree"
+ * over "n" positions.
+ */
+static void treeadd(long *tree, int n, int pos, long delta)
+{
+	for (++pos; pos <= n; pos += pos & -pos)
+		tree[pos] += delta;
+}
+
+/*
+ * Sum of the entries in front of position "pos" of Fenwick tree "tree".
+ */
+static long treesum(long *tree, int pos)
+{
+	long sum;
+
+	for (sum = 0; pos > 0; pos -= pos & -pos)
+		sum += tree[pos];
+	return sum;
+}
+
+/*
+ * Make room for twice as many chunks. Return FALSE if there is no memory
+ * for it; what was there is left alone.
+ */
+static int grow(struct lindex *xp)
+{
+	struct lchunk *chunk;
+	int *order;
+	long *lines;
+	long *bytes;
+	int max;
+
+	max = xp->x_max == 0 ? 64 : xp->x_max * 2;
+	chunk = realloc(xp->x_chunk, max * sizeof(struct lchunk));
+	if (chunk == NULL)
+		return FALSE;
+	xp->x_chunk = chunk;
+	if ((order = realloc(xp->x_order, max * sizeof(int))) == NULL)
+		return FALSE;
+	xp->x_order = order;
+	if ((lines = realloc(xp->x_lines, (max + 1) * sizeof(long))) == NULL)
+		return FALSE;
+	xp->x_lines = lines;
+	if ((bytes = realloc(xp->x_bytes, (max + 1) * sizeof(long))) == NULL)
+		return FALSE;
+	xp->x_bytes = bytes;
+	xp->x_max = max;
+	return TRUE;
+}
+
+/*
+ * Get a free chunk slot. Return -1 if there is no memory for one.
+ */
+static int newslot(struct lindex *xp)
+{
+	int s;
+
+	if ((s = xp->x_free) >= 0) {
+		xp->x_free = xp->x_chunk[s].c_pos;
+		return s;
+	}
+	if (xp->x_nslot == xp->x_max && grow(xp) == FALSE)
+		return -1;
+	return xp->x_nslot++;
+}
+
+/*
+ * Drop the empty chunks, number the others by position and build the trees
+ * from scratch.
+ */
+static void rebuild(struct lindex *xp)
+{
+	struct lchunk *cp;
+	int i;
+	int j;
+	int k;
+	int s;
+
+	j = 0;
+	k = 0;
+	for (i = 0; i < xp->x_nchunk; ++i) {
+		s = xp->x_order[i];
+		cp = &xp->x_chunk[s];
+		if (cp->c_first == NULL) {
+			cp->c_pos = xp->x_free;
+			xp->x_free = s;
+#if COLOR
+			/* The chunk in front of it has a new one after it */
+			if (j > 0)
+				xp->x_chunk[xp->x_order[j - 1]].c_changed = TRUE;
+#endif
+		} else
+			xp->x_order[j++] = s;
+#if COLOR
+		if (i < xp->x_mcvalid)
+			k = j;
+#endif
+	}
+#if COLOR
+	xp->x_mcvalid = k;
+#endif
+	xp->x_nchunk = j;
+	xp->x_nempty = 0;
+	for (i = 0; i < j; ++i) {
+		cp = &xp->x_chunk[xp->x_order[i]];
+		cp->c_pos = i;
+		xp->x_lines[i + 1] = cp->c_lines;
+		xp->x_bytes[i + 1] = cp->c_bytes;
+	}
+	for (i = 1; i <= j; ++i) {
+		k = i + (i & -i);
+		if (k <= j) {
+			xp->x_lines[k] += xp->x_lines[i];
+			xp->x_bytes[k] += xp->x_bytes[i];
+		}
+	}
+}
+
+/*
+ * Put chunk "s" after all of the others.
+ */
+static void append(struct lindex *xp, int s)
+{
+	struct lchunk *cp;
+	int i;
+
+	cp = &xp->x_chunk[s];
+	cp->c_pos = xp->x_nchunk;
+	xp->x_order[xp->x_nchunk++] = s;
+	i = xp->x_nchunk;
+	xp->x_lines[i] = cp->c_lines + treesum(xp->x_lines, i - 1)
+	    - treesum(xp->x_lines, i - (i & -i));
+	xp->x_bytes[i] = cp->c_bytes + treesum(xp->x_bytes, i - 1)
+	    - treesum(xp->x_bytes, i - (i & -i));
+}
+
+/*
+ * Build the index of buffer "bp" from its lines. Return FALSE if there is
+ * no memory for it.
+ */
+static int build(struct buffer *bp)
+{
+	struct lindex *xp;
+	struct lchunk *cp;
+	struct line *lp;
+	int s;
+
+	s = 0;
+	if ((xp = bp->b_index) == NULL) {
+		if ((xp = (struct lindex *)malloc(sizeof(struct lindex))) == NULL)
+			return FALSE;
+		memset(xp, 0, sizeof(struct lindex));
+		bp->b_index = xp;
+	}
+	xp->x_valid = FALSE;
+	xp->x_nslot = 0;
+	xp->x_free = -1;
+	xp->x_nchunk = 0;
+#if COLOR
+	xp->x_mcvalid = 0;
+#endif
+	cp = NULL;
+	for (lp = lforw(bp->b_linep); lp != bp->b_linep; lp = lforw(lp)) {
+		if (cp == NULL || cp->c_lines == CHUNKLINES) {
+			if ((s = newslot(xp)) < 0)
+				return FALSE;
+			cp = &xp->x_chunk[s];
+			cp->c_first = lp;
+			cp->c_lines = 0;
+			cp->c_bytes = 0;
+			fresh(cp);
+			xp->x_order[xp->x_nchunk++] = s;
+		}
+		lp->l_chunk = s;
+		++cp->c_lines;
+		cp->c_bytes += llength(lp) + 1;
+	}
+	rebuild(xp);
+	xp->x_valid = TRUE;
+	return TRUE;
+}
+
+/*
+ * Return TRUE if buffer "bp" has an index that is up to date, building it
+ * if need be.
+ */
+static int ready(struct buffer *bp)
+{
+	if (bp->b_index != NULL && bp->b_index->x_valid)
+		return TRUE;
+	return build(bp);
+}
+
+/*
+ * Split chunk "s" in two if it has grown too big.
+ */
+static void split(struct lindex *xp, int s)
+{
+	struct lchunk *cp;
+	struct lchunk *np;
+	struct line *lp;
+	int pos;
+	int n;
+	int i;
+
+	if (xp->x_chunk[s].c_lines <= 2 * CHUNKLINES)
+		return;
+	if ((n = newslot(xp)) < 0) {
+		xp->x_valid = FALSE;	/* Build it again later */
+		return;
+	}
+	cp = &xp->x_chunk[s];
+	np = &xp->x_chunk[n];
+	lp = cp->c_first;
+	for (i = 0; i < CHUNKLINES; ++i)
+		lp = lforw(lp);
+	np->c_first = lp;
+	np->c_lines = cp->c_lines - CHUNKLINES;
+	np->c_bytes = 0;
+	fresh(np);
+	for (i = 0; i < np->c_lines; ++i) {
+		lp->l_chunk = n;
+		np->c_bytes += llength(lp) + 1;
+		lp = lforw(lp);
+	}
+	cp->c_lines = CHUNKLINES;
+	cp->c_bytes -= np->c_bytes;
+	stale(xp, cp);
+	pos = cp->c_pos;
+	treeadd(xp->x_lines, xp->x_nchunk, pos, -np->c_lines);
+	treeadd(xp->x_bytes, xp->x_nchunk, pos, -np->c_bytes);
+	if (pos == xp->x_nchunk - 1) {	/* Last one: cheap      */
+		append(xp, n);
+		return;
+	}
+	memmove(&xp->x_order[pos + 2], &xp->x_order[pos + 1],
+		(xp->x_nchunk - pos - 1) * sizeof(int));
+	xp->x_order[pos + 1] = n;
+	++xp->x_nchunk;
+	rebuild(xp);
+}
+
+/*
+ * Forget the index of buffer "bp"; its lines are all gone.
+ */
+void lindex_clear(struct buffer *bp)
+{
+	if (bp->b_index != NULL)
+		bp->b_index->x_valid = FALSE;
+}
+
+/*
+ * Free the index of buffer "bp", which is going away.
+ */
+void lindex_delete(struct buffer *bp)
+{
+	struct lindex *xp;
+
+	if ((xp = bp->b_index) == NULL)
+		return;
+	free(xp->x_chunk);
+	free(xp->x_order);
+	free(xp->x_lines);
+	free(xp->x_bytes);
+	free((char *) xp);
+	bp->b_index = NULL;
+}
+
+/*
+ * Line "lp" was just linked into buffer "bp". It joins the chunk of the
+ * line in front of it, or that of the line after it if it is the first.
+ */
+void lindex_add(struct buffer *bp, struct line *lp)
+{
+	struct lindex *xp;
+	struct lchunk *cp;
+	int s;
+
+	if ((xp = bp->b_index) == NULL || !xp->x_valid)
+		return;
+	if (lback(lp) != bp->b_linep)
+		s = lback(lp)->l_chunk;
+	else if (lforw(lp) != bp->b_linep) {
+		s = lforw(lp)->l_chunk;
+		xp->x_chunk[s].c_first = lp;
+	} else {		/* The only line        */
+		if ((s = newslot(xp)) < 0) {
+			xp->x_valid = FALSE;
+			return;
+		}
+		cp = &xp->x_chunk[s];
+		cp->c_first = lp;
+		cp->c_lines = 0;
+		cp->c_bytes = 0;
+		fresh(cp);
+		append(xp, s);
+	}
+	cp = &xp->x_chunk[s];
+	lp->l_chunk = s;
+	++cp->c_lines;
+	cp->c_bytes += llength(lp) + 1;
+	stale(xp, cp);
+	treeadd(xp->x_lines, xp->x_nchunk, cp->c_pos, 1);
+	treeadd(xp->x_bytes, xp->x_nchunk, cp->c_pos, llength(lp) + 1);
+	split(xp, s);
+}
+
+/*
+ * Line "lp" of buffer "bp" is about to be unlinked.
+ */
+void lindex_remove(struct buffer *bp, struct line *lp)
+{
+	struct lindex *xp;
+	struct lchunk *cp;
+
+	if ((xp = bp->b_index) == NULL || !xp->x_valid)
+		return;
+	cp = &xp->x_chunk[lp->l_chunk];
+	--cp->c_lines;
+	cp->c_bytes -= llength(lp) + 1;
+	stale(xp, cp);
+	treeadd(xp->x_lines, xp->x_nchunk, cp->c_pos, -1);
+	treeadd(xp->x_bytes, xp->x_nchunk, cp->c_pos, -(llength(lp) + 1));
+	if (cp->c_first != lp)
+		return;
+	if (cp->c_lines > 0) {	/* The next line is in it */
+		cp->c_first = lforw(lp);
+		return;
+	}
+	cp->c_first = NULL;
+	if (++xp->x_nempty * 2 > xp->x_nchunk)
+		rebuild(xp);
+}
+
+/*
+ * Line "nlp" was just linked into buffer "bp" in the place of "olp".
+ */
+void lindex_replace(struct buffer *bp, struct line *olp, struct line *nlp)
+{
+	struct lindex *xp;
+	struct lchunk *cp;
+
+	if ((xp = bp->b_index) == NULL || !xp->x_valid)
+		return;
+	nlp->l_chunk = olp->l_chunk;
+	cp = &xp->x_chunk[nlp->l_chunk];
+	if (cp->c_first == olp)
+		cp->c_first = nlp;
+	cp->c_bytes += llength(nlp) - llength(olp);
+	stale(xp, cp);
+	treeadd(xp->x_bytes, xp->x_nchunk, cp->c_pos,
+		llength(nlp) - llength(olp));
+}
+
+/*
+ * Line "lp" of buffer "bp" has grown by "delta" bytes (or shrunk, if it is
+ * negative). The header line is not in the index; a newline put at the end
+ * of the buffer "changes" it by nothing.
+ */
+void lindex_resize(struct buffer *bp, struct line *lp, int delta)
+{
+	struct lindex *xp;
+	struct lchunk *cp;
+
+	if ((xp = bp->b_index) == NULL || !xp->x_valid || lp == bp->b_linep)
+		return;
+	cp = &xp->x_chunk[lp->l_chunk];
+	cp->c_bytes += delta;
+	stale(xp, cp);
+	treeadd(xp->x_bytes, xp->x_nchunk, cp->c_pos, delta);
+}
+
+#if COLOR
+/*
+ * The text of line "lp" of buffer "bp" was changed in place, without
+ * changing its length.
+ */
+void lindex_change(struct buffer *bp, struct line *lp)
+{
+	struct lindex *xp;
+
+	if ((xp = bp->b_index) == NULL || !xp->x_valid)
+		return;
+	stale(xp, &xp->x_chunk[lp->l_chunk]);
+}
+
+/*
+ * Return the multi line comment state of language "sp" at the start of line
+ * "lp" of buffer "bp", working out the states of the chunks in front of it
+ * that are not known. The header line is never in a comment.
+ */
+int lindex_mcomment(struct buffer *bp, struct synlang *sp, struct line *lp)
+{
+	struct lindex *xp;
+	struct lchunk *cp;
+	struct lchunk *pp;
+	struct lchunk *np;
+	struct line *clp;
+	int state;
+	int i;
+
+	state = 0;
+	if (lp == bp->b_linep)
+		return state;
+	if (!ready(bp)) {	/* No memory: from the top */
+		for (clp = lforw(bp->b_linep); clp != lp; clp = lforw(clp))
+			state = syntax_line_state(sp, clp, state);
+		return state;
+	}
+	xp = bp->b_index;
+	if (xp->x_mclang != sp) {
+		xp->x_mclang = sp;
+		xp->x_mcvalid = 0;
+		for (i = 0; i < xp->x_nchunk; ++i)
+			xp->x_chunk[xp->x_order[i]].c_changed = TRUE;
+	}
+	cp = &xp->x_chunk[lp->l_chunk];
+	while (xp->x_mcvalid <= cp->c_pos) {
+		state = 0;
+		if (xp->x_mcvalid > 0) {
+			pp = &xp->x_chunk[xp->x_order[xp->x_mcvalid - 1]];
+			state = pp->c_mcomment;
+			clp = pp->c_first;
+			for (i = 0; i < pp->c_lines; ++i) {
+				state = syntax_line_state(sp, clp, state);
+				clp = lforw(clp);
+			}
+			pp->c_changed = FALSE;
+		}
+		np = &xp->x_chunk[xp->x_order[xp->x_mcvalid++]];
+		if (np->c_mcomment != state) {
+			np->c_mcomment = state;
+			continue;
+		}
+		/* As it was: so are the ones after it, up to a changed one */
+		while (!np->c_changed && xp->x_mcvalid < xp->x_nchunk)
+			np = &xp->x_chunk[xp->x_order[xp->x_mcvalid++]];
+	}
+	state = cp->c_mcomment;
+	for (clp = cp->c_first; clp != lp; clp = lforw(clp))
+		state = syntax_line_state(sp, clp, state);
+	return state;
+}
+#endif
+
+/*
+ * Return the kind of fence "c" is, or -1 if it is none, and leave in
+ * "*dir" 1 if it is an open one and -1 if it is a close one.
+ */
+static int fencekind(int c, int *dir)
+{
+	int k;
+
+	*dir = 0;
+	for (k = 0; k < NFENCE; ++k) {
+		if (c == fenceopen[k]) {
+			*dir = 1;
+			return k;
+		}
+		if (c == fenceclose[k]) {
+			*dir = -1;
+			return k;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Add the fences of line "lp" that are not in comments or strings of
+ * language "sp" (all of them if it is NULL), starting in comment state
+ * "*statep", to the "n" already in "fenceoff" and "fenceline", and leave
+ * the state after the line in "*statep". Return how many there are then,
+ * or -1 if there is no memory.
+ */
+static int linefences(struct synlang *sp, struct line *lp, int *statep,
+		      int n)
+{
+	int *off;
+	struct line **line;
+	int max;
+	int dir;
+	int i;
+	int m;
+
+	if (n + llength(lp) > fenceroom) {
+		max = fenceroom * 2;
+		if (max < n + llength(lp))
+			max = n + llength(lp) + 64;
+		if ((off = realloc(fenceoff, max * sizeof(int))) == NULL)
+			return -1;
+		fenceoff = off;
+		line = realloc(fenceline, max * sizeof(struct line *));
+		if (line == NULL)
+			return -1;
+		fenceline = line;
+		fenceroom = max;
+	}
+	m = n;
+#if COLOR
+	if (sp != NULL)
+		*statep = syntax_line_fences(sp, lp, *statep, fenceoff, &n);
+#endif
+	if (sp == NULL)
+		for (i = 0; i < llength(lp); ++i)
+			if (fencekind(lgetc(lp, i), &dir) >= 0)
+				fenceoff[n++] = i;
+	while (m < n)
+		fenceline[m++] = lp;
+	return n;
+}
+
+/*
+ * Find the fences of chunk "cp", which starts in comment state "state" of
+ * language "sp", leaving them in order in "fenceoff" and "fenceline", and
+ * sum them up in its "c_fence". Return how many there are, or -1 if
+ * there is no memory.
+ */
+static int chunkfences(struct synlang *sp, struct lchunk *cp, int state)
+{
+	struct lfence *fp;
+	struct line *lp;
+	int end;
+	int dir;
+	int n;
+	int i;
+	int k;
+
+	n = 0;
+	end = state;
+	lp = cp->c_first;
+	for (i = 0; i < cp->c_lines; ++i) {
+		if ((n = linefences(sp, lp, &end, n)) < 0)
+			return -1;
+		lp = lforw(lp);
+	}
+	cp->c_fstate = state;
+	memset(cp->c_fence, 0, sizeof(cp->c_fence));
+	for (i = 0; i < n; ++i) {
+		k = fencekind(lgetc(fenceline[i], fenceoff[i]), &dir);
+		fp = &cp->c_fence[k];
+		fp->f_depth += dir;
+		if (fp->f_depth < fp->f_low)
+			fp->f_low = fp->f_depth;
+	}
+	return n;
+}
+
+/*
+ * The comment state of language "sp" that chunk "cp" of buffer "bp"
+ * starts in, 0 if there is no language.
+ */
+static int chunkstate(struct buffer *bp, struct synlang *sp,
+		      struct lchunk *cp)
+{
+#if COLOR
+	if (sp != NULL)
+		return lindex_mcomment(bp, sp, cp->c_first);
+#endif
+	return 0;
+}
+
+/*
+ * If the character at offset "*offp" of line "*lpp" of buffer "bp" is a
+ * fence, ()[]{}, that is not in a comment or a string of the language of
+ * the buffer, find the fence that matches it and return TRUE; "*lpp" and
+ * "*offp" are left at the match, or "*lpp" is NULL if there is none.
+ * Otherwise, or if there is no memory to find out, return FALSE.
+ */
+int lindex_fence(struct buffer *bp, struct line **lpp, int *offp)
+{
+	struct lindex *xp;
+	struct lchunk *cp;
+	struct lfence *fp;
+	struct synlang *sp;
+	struct line *lp;
+	int state;
+	int depth;
+	int kind;
+	int c;
+	int dir;
+	int pos;
+	int d;
+	int n;
+	int i;
+
+	lp = *lpp;
+	if (lp == bp->b_linep || *offp >= llength(lp) ||
+	    (kind = fencekind(lgetc(lp, *offp), &dir)) < 0 || !ready(bp))
+		return FALSE;
+	xp = bp->b_index;
+	sp = NULL;
+#if COLOR
+	sp = syntax_find(bp);
+	if (xp->x_flang != sp) {
+		xp->x_flang = sp;
+		for (i = 0; i < xp->x_nchunk; ++i)
+			xp->x_chunk[xp->x_order[i]].c_fstate = -1;
+	}
+#endif
+
+	/* find it among the fences of its chunk */
+	cp = &xp->x_chunk[lp->l_chunk];
+	state = chunkstate(bp, sp, cp);
+	if ((n = chunkfences(sp, cp, state)) < 0)
+		return FALSE;
+	for (i = 0; i < n; ++i)
+		if (fenceline[i] == lp && fenceoff[i] == *offp)
+			break;
+	if (i == n)
+		return FALSE;
+
+	depth = 0;
+	pos = cp->c_pos;
+	for (;;) {
+		/* go through the fences of the chunk, from fence "i" on */
+		for (; i >= 0 && i < n; i += dir) {
+			c = lgetc(fenceline[i], fenceoff[i]);
+			if (fencekind(c, &d) != kind)
+				continue;
+			depth += d * dir;
+			if (depth == 0) {
+				*lpp = fenceline[i];
+				*offp = fenceoff[i];
+				return TRUE;
+			}
+		}
+
+		/* pass over the chunks it cannot be in */
+		for (;;) {
+			pos += dir;
+			if (pos < 0 || pos >= xp->x_nchunk) {
+				*lpp = NULL;
+				return TRUE;
+			}
+			cp = &xp->x_chunk[xp->x_order[pos]];
+			if (cp->c_first == NULL)
+				continue;
+			n = -1;		/* Fences not found yet */
+			state = chunkstate(bp, sp, cp);
+			if (cp->c_fstate != state &&
+			    (n = chunkfences(sp, cp, state)) < 0)
+				return FALSE;
+			fp = &cp->c_fence[kind];
+			if (dir > 0 ? depth + fp->f_low <= 0
+			    : fp->f_depth - fp->f_low >= depth)
+				break;
+			depth += dir * fp->f_depth;
+		}
+		if (n < 0 && (n = chunkfences(sp, cp, state)) < 0)
+			return FALSE;
+		i = dir > 0 ? 0 : n - 1;
+	}
+}
+
+/*
+ * Find the number of line "lp" of buffer "bp" and the offset of its first
+ * byte, both counting from 0. The header line is the one after the last.
+ */
+void lindex_where(struct buffer *bp, struct line *lp, long *line, long *byte)
+{
+	struct lindex *xp;
+	struct lchunk *cp;
+	struct line *clp;
+	long n;
+	long b;
+
+	n = 0;
+	b = 0;
+	if (!ready(bp)) {	/* No memory: count     */
+		for (clp = lforw(bp->b_linep); clp != lp
+		     && clp != bp->b_linep; clp = lforw(clp)) {
+			++n;
+			b += llength(clp) + 1;
+		}
+		*line = n;
+		*byte = b;
+		return;
+	}
+	xp = bp->b_index;
+	if (lp == bp->b_linep) {
+		*line = treesum(xp->x_lines, xp->x_nchunk);
+		*byte = treesum(xp->x_bytes, xp->x_nchunk);
+		return;
+	}
+	cp = &xp->x_chunk[lp->l_chunk];
+	while (lp != cp->c_first) {
+		lp = lback(lp);
+		++n;
+		b += llength(lp) + 1;
+	}
+	*line = treesum(xp->x_lines, cp->c_pos) + n;
+	*byte = treesum(xp->x_bytes, cp->c_pos) + b;
+}
+
+/*
+ * Count the lines and bytes of buffer "bp".
+ */
+void lindex_total(struct buffer *bp, long *lines, long *bytes)
+{
+	lindex_where(bp, bp->b_linep, lines, bytes);
+}
+
+/*
+ * Return line "n" of buffer "bp", counting from 0, or the header line if
+ * there are not that many.
+ */
+struct line *lindex_line(struct buffer *bp, long n)
+{
+	struct lindex *xp;
+	struct line *lp;
+	int pos;
+	int step;
+
+	if (n < 0)
+		return bp->b_linep;
+	if (!ready(bp)) {	/* No memory: count     */
+		lp = lforw(bp->b_linep);
+		while (n-- > 0 && lp != bp->b_linep)
+			lp = lforw(lp);
+		return lp;
+	}
+	xp = bp->b_index;
+	if (n >= treesum(xp->x_lines, xp->x_nchunk))
+		return bp->b_linep;
+	pos = 0;
+	for (step = 1; step * 2 <= xp->x_nchunk; step *= 2)
+		;
+	for (; step > 0; step /= 2)
+		if (pos + step <= xp->x_nchunk && xp->x_lines[pos + step] <= n) {
+			pos += step;
+			n -= xp->x_lines[pos];
+		}
+	lp = xp->x_chunk[xp->x_order[pos]].c_first;
+	while (n-- > 0)
+		lp = lforw(lp);
+	return lp;
+}
@@ -0,0 +1,35 @@
+#ifndef LINDEX_H_
+#define LINDEX_H_
+
+/*
+ * The line index of a buffer, for finding line numbers and byte offsets
+ * without counting lines from the top. The line functions keep it up to
+ * date as lines come and go: "lindex_add" after a line is linked in,
+ * "lindex_remove" before it is unlinked, "lindex_replace" when a new line
+ * took the place of an old one, "lindex_resize" when a line grew or
+ * shrank by some bytes, and "lindex_change" when its text changed in place.
+ * For a buffer with a language to highlight it also keeps checkpoints of
+ * the multi line comment state, which "lindex_mcomment" works out as they
+ * are needed, and for any buffer it sums up the fences in each stretch of
+ * lines, so "lindex_fence" can find the match of one without going
+ * through the lines between them.
+ */
+struct lindex;
+struct synlang;
+
+void lindex_clear(struct buffer *bp);
+void lindex_delete(struct buffer *bp);
+void lindex_add(struct buffer *bp, struct line *lp);
+void lindex_remove(struct buffer *bp, struct line *lp);
+void lindex_replace(struct buffer *bp, struct line *olp, struct line *nlp);
+void lindex_resize(struct buffer *bp, struct line *lp, int delta);
+#if COLOR
+void lindex_change(struct buffer *bp, struct line *lp);
+int lindex_mcomment(struct buffer *bp, struct synlang *sp, struct line *lp);
+#endif
+void lindex_where(struct buffer *bp, struct line *lp, long *line, long *byte);
+void lindex_total(struct buffer *bp, long *lines, long *bytes);
+struct line *lindex_line(struct buffer *bp, long n);
+int lindex_fence(struct buffer *bp, struct line **lpp, int *offp);
+
+#endif  /* LINDEX_H_ */
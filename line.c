@@ -14,22 +14,29 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "estruct.h"
 #include "edef.h"
 #include "efunc.h"
 #include "utf8.h"
 #include "line.h"
+#include "arena.h"
+#include "lindex.h"
+#include "syntax.h"
+#include "undo.h"
 
 #define	BLOCK_SIZE 16 /* Line block chunk size. */
 
 /*
  * This routine allocates a block of memory large enough to hold a struct line
- * containing "used" characters. The block is always rounded up a bit. Return
- * a pointer to the new block, or NULL if there isn't any memory left. Print a
+ * containing "used" characters, from the arena of buffer "bp". The block is
+ * always rounded up a bit. A line without a buffer is allocated on its own;
+ * that is for the header line, which has to outlive the arena. Return a
+ * pointer to the new block, or NULL if there isn't any memory left. Print a
  * message in the message line if no space.
  */
-struct line *lalloc(int used)
+struct line *lalloc(struct buffer *bp, int used)
 {
 	struct line *lp;
 	int size;
@@ -37,19 +44,103 @@ struct line *lalloc(int used)
 	size = (used + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
 	if (size == 0)	/* Assume that is an empty. */
 		size = BLOCK_SIZE;  /* Line is for type-in. */
-	if ((lp = (struct line *)malloc(sizeof(struct line) + size)) == NULL) {
+	size += sizeof(struct line);
+	if (bp == NULL)
+		lp = (struct line *)malloc(size);
+	else
+		lp = (struct line *)arena_alloc(bp->b_arena, &size);
+	if (lp == NULL) {
 		mlwrite("(OUT OF MEMORY)");
 		return NULL;
 	}
-	lp->l_size = size;
+	lp->l_text = (char *) (lp + 1);
+	lp->l_size = size - sizeof(struct line);
 	lp->l_used = used;
+#if COLOR
+	lp->l_syn = NULL;
+#endif
 	return lp;
 }
 
 /*
- * Delete line "lp". Fix all of the links that might point at it (they are
- * moved to offset 0 of the next line. Unlink the line from whatever buffer it
- * might be in. Release the memory. The buffers are updated too; the magic
+ * Allocate a line of buffer "bp" that shares "used" bytes of the original
+ * file text at "text" instead of holding a copy of its own. The text must
+ * stay around for as long as the line does; it is owned by the buffer
+ * ("b_text").
+ */
+struct line *lshare(struct buffer *bp, char *text, int used)
+{
+	struct line *lp;
+	int size;
+
+	size = sizeof(struct line);
+	if ((lp = (struct line *)arena_alloc(bp->b_arena, &size)) == NULL) {
+		mlwrite("(OUT OF MEMORY)");
+		return NULL;
+	}
+	lp->l_text = text;
+	lp->l_size = 0;
+	lp->l_used = used;
+#if COLOR
+	lp->l_syn = NULL;
+#endif
+	return lp;
+}
+
+/*
+ * Give a line of the current buffer that still shares the original file
+ * text a private copy of it, so that it can be changed in place. The line
+ * itself does not move, so nothing that points at it needs fixing. Return
+ * TRUE if all is well.
+ */
+int lowntext(struct line *lp)
+{
+	char *text;
+	int size;
+
+	if (lp->l_size != 0)	/* Already private.     */
+		return TRUE;
+	size = (lp->l_used + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+	if (size == 0)
+		size = BLOCK_SIZE;
+	if ((text = arena_alloc(curbp->b_arena, &size)) == NULL) {
+		mlwrite("(OUT OF MEMORY)");
+		return FALSE;
+	}
+	memcpy(text, lp->l_text, lp->l_used);
+	lp->l_text = text;
+	lp->l_size = size;
+	return TRUE;
+}
+
+/*
+ * Give the memory of a line of the current buffer that is no longer linked
+ * in back to the arena. Shared text belongs to the buffer, and text that
+ * was made private by lowntext() is a block of its own, as are the colours
+ * the line was drawn in.
+ */
+static void ldispose(struct line *lp)
+{
+	struct arena *ap;
+
+	ap = curbp->b_arena;
+#if COLOR
+	if (lp->l_syn != NULL)
+		syntax_free(ap, lp);
+#endif
+	if (lp->l_size == 0) {
+		arena_release(ap, lp, sizeof(struct line));
+	} else if (lp->l_text != (char *) (lp + 1)) {
+		arena_release(ap, lp->l_text, lp->l_size);
+		arena_release(ap, lp, sizeof(struct line));
+	} else
+		arena_release(ap, lp, sizeof(struct line) + lp->l_size);
+}
+
+/*
+ * Delete line "lp" of the current buffer. Fix all of the links that might
+ * point at it (they are moved to offset 0 of the next line. Unlink the line
+ * from the buffer. Release the memory. The buffers are updated too; the magic
  * conditions described in the above comments don't hold here.
  */
 void lfree(struct line *lp)
@@ -85,9 +176,10 @@ void lfree(struct line *lp)
 		}
 		bp = bp->b_bufp;
 	}
+	lindex_remove(curbp, lp);
 	lp->l_bp->l_fp = lp->l_fp;
 	lp->l_fp->l_bp = lp->l_bp;
-	free((char *) lp);
+	ldispose(lp);
 }
 
 /*
@@ -134,42 +226,29 @@ int insspace(int f, int n)
 int linstr(char *instr)
 {
 	int status = TRUE;
-	char tmpc;
-
-	if (instr != NULL)
-		while ((tmpc = *instr) && status == TRUE) {
-			status =
-			    (tmpc == '\n' ? lnewline() : linsert(1, tmpc));
 
-			/* Insertion error? */
-			if (status != TRUE) {
-				mlwrite("%%Out of memory while inserting");
-				break;
-			}
-			instr++;
-		}
+	if (instr != NULL
+	    && (status = linstext(instr, (long) strlen(instr))) != TRUE)
+		mlwrite("%%Out of memory while inserting");
 	return status;
 }
 
 /*
- * Insert "n" copies of the character "c" at the current location of dot. In
- * the easy case all that happens is the text is stored in the line. In the
- * hard case, the line has to be reallocated. When the window list is updated,
- * take special care; I screwed it up once. You always update dot in the
- * current window. You update mark, and a dot in another window, if it is
- * greater than the place where you did the insert. Return TRUE if all is
- * well, and FALSE on errors.
+ * Insert "n" bytes at the current location of dot: the bytes at "text", or
+ * "n" copies of the character "c" if "text" is NULL. In the easy case all
+ * that happens is the text is stored in the line. In the hard case, the
+ * line has to be reallocated. When the window list is updated, take special
+ * care; I screwed it up once. You always update dot in the current window.
+ * You update mark, and a dot in another window, if it is greater than the
+ * place where you did the insert. Return TRUE if all is well, and FALSE on
+ * errors.
  */
-
-static int linsert_byte(int n, int c)
+static int linsert_text(char *text, int n, int c)
 {
-	char *cp1;
-	char *cp2;
 	struct line *lp1;
 	struct line *lp2;
 	struct line *lp3;
 	int doto;
-	int i;
 	struct window *wp;
 
 	if (curbp->b_mode & MDVIEW)	/* don't allow this command if      */
@@ -181,53 +260,50 @@ static int linsert_byte(int n, int c)
 			mlwrite("bug: linsert");
 			return FALSE;
 		}
-		if ((lp2 = lalloc(n)) == NULL)	/* Allocate new line        */
+		if ((lp2 = lalloc(curbp, n)) == NULL)	/* Allocate new line        */
 			return FALSE;
 		lp3 = lp1->l_bp;	/* Previous line        */
 		lp3->l_fp = lp2;	/* Link in              */
 		lp2->l_fp = lp1;
 		lp1->l_bp = lp2;
 		lp2->l_bp = lp3;
-		for (i = 0; i < n; ++i)
-			lp2->l_text[i] = c;
-#if	COLOR
-		if ((curbp->b_mode & MDCMOD) != 0)
-			lp2->l_mcomment = mcomment_line_state(lp3, lp3->l_mcomment);
-#endif
+		if (text != NULL)
+			memcpy(lp2->l_text, text, n);
+		else
+			memset(lp2->l_text, c, n);
+		lindex_add(curbp, lp2);
+		undo_record(lp2, 0, NULL, 0, "\n", 1);
+		undo_record(lp2, 0, NULL, 0, lp2->l_text, n);
 		curwp->w_dotp = lp2;
 		curwp->w_doto = n;
 		return TRUE;
 	}
 	doto = curwp->w_doto;	/* Save for later.      */
 	if (lp1->l_used + n > lp1->l_size) {	/* Hard: reallocate     */
-		if ((lp2 = lalloc(lp1->l_used + n)) == NULL)
+		if ((lp2 = lalloc(curbp, lp1->l_used + n)) == NULL)
 			return FALSE;
-		cp1 = &lp1->l_text[0];
-		cp2 = &lp2->l_text[0];
-		while (cp1 != &lp1->l_text[doto])
-			*cp2++ = *cp1++;
-		cp2 += n;
-		while (cp1 != &lp1->l_text[lp1->l_used])
-			*cp2++ = *cp1++;
+		memcpy(lp2->l_text, lp1->l_text, doto);
+		memcpy(&lp2->l_text[doto + n], &lp1->l_text[doto],
+		       lp1->l_used - doto);
 		lp1->l_bp->l_fp = lp2;
 		lp2->l_fp = lp1->l_fp;
 		lp1->l_fp->l_bp = lp2;
 		lp2->l_bp = lp1->l_bp;
-#if	COLOR
-		if ((curbp->b_mode & MDCMOD) != 0)
-			lp2->l_mcomment = lp1->l_mcomment;
-#endif
-		free((char *) lp1);
+		lindex_replace(curbp, lp1, lp2);
+		ldispose(lp1);
 	} else {		/* Easy: in place       */
 		lp2 = lp1;	/* Pretend new line     */
+		lforget(lp2);
+		memmove(&lp2->l_text[doto + n], &lp2->l_text[doto],
+			lp2->l_used - doto);
 		lp2->l_used += n;
-		cp2 = &lp1->l_text[lp1->l_used];
-		cp1 = cp2 - n;
-		while (cp1 != &lp1->l_text[doto])
-			*--cp2 = *--cp1;
+		lindex_resize(curbp, lp2, n);
 	}
-	for (i = 0; i < n; ++i)	/* Add the characters       */
-		lp2->l_text[doto + i] = c;
+	if (text != NULL)	/* Add the characters       */
+		memcpy(&lp2->l_text[doto], text, n);
+	else
+		memset(&lp2->l_text[doto], c, n);
+	undo_record(lp2, doto, NULL, 0, &lp2->l_text[doto], n);
 	wp = wheadp;		/* Update windows       */
 	while (wp != NULL) {
 		if (wp->w_linep == lp1)
@@ -247,6 +323,11 @@ static int linsert_byte(int n, int c)
 	return TRUE;
 }
 
+static int linsert_byte(int n, int c)
+{
+	return linsert_text(NULL, n, c);
+}
+
 int linsert(int n, int c)
 {
 	char utf8[6];
@@ -265,6 +346,156 @@ int linsert(int n, int c)
 	return TRUE;
 }
 
+/*
+ * Insert the "n" bytes at "text" at the current location of dot, as they
+ * are; a newline among them breaks the line. All of the new lines are made
+ * first, then linked in and the windows fixed up in one go, so putting in
+ * a whole file costs about what reading it does. As in lnewline(), the
+ * line dot is on keeps what comes after dot. Return TRUE if all is well,
+ * and FALSE on errors; then nothing is inserted.
+ */
+int linstext(char *text, long n)
+{
+	struct line *lp1;	/* Line dot is on               */
+	struct line *lp2;	/* What it is afterwards        */
+	struct line *first;	/* New lines in front of it     */
+	struct line *lp;
+	struct line *nlp;
+	struct window *wp;
+	char *cp;
+	char *ep;
+	char *np;
+	int doto;
+	int ntext;		/* Text after the last newline  */
+	int ntail;		/* Rest of the line after dot   */
+	int atend;
+	int inplace;
+
+	if ((np = memchr(text, '\n', n)) == NULL)	/* Easy: one line */
+		return n > 0 ? linsert_text(text, n, 0) : TRUE;
+	if (curbp->b_mode & MDVIEW)	/* don't allow this command if      */
+		return rdonly();	/* we are in read only mode     */
+	lp1 = curwp->w_dotp;
+	doto = curwp->w_doto;
+	atend = (lp1 == curbp->b_linep);
+
+	/* Make a line up to each newline, the first with the head of dot's */
+	first = lp = NULL;
+	cp = text;
+	ep = text + n;
+	while (np != NULL) {
+		if ((nlp = lalloc(curbp, (cp == text ? doto : 0) + (np - cp)))
+		    == NULL)
+			goto nomem;
+		if (cp == text) {
+			memcpy(nlp->l_text, lp1->l_text, doto);
+			memcpy(&nlp->l_text[doto], cp, np - cp);
+		} else
+			memcpy(nlp->l_text, cp, np - cp);
+		nlp->l_fp = NULL;
+		if (lp == NULL)
+			first = nlp;
+		else
+			lp->l_fp = nlp;
+		lp = nlp;
+		cp = np + 1;
+		np = memchr(cp, '\n', ep - cp);
+	}
+
+	/* and put the text after the last one in front of the tail */
+	ntext = ep - cp;
+	ntail = atend ? 0 : lp1->l_used - doto;
+	if (atend)
+		inplace = FALSE;
+	else if (lp1->l_size == 0)	/* Shared: can only lose its head */
+		inplace = (ntext == 0);
+	else
+		inplace = (ntext + ntail <= lp1->l_size);
+	if (inplace)
+		lp2 = lp1;
+	else {
+		if ((lp2 = lalloc(curbp, ntext + ntail)) == NULL)
+			goto nomem;
+		memcpy(lp2->l_text, cp, ntext);
+		memcpy(&lp2->l_text[ntext], &lp1->l_text[doto], ntail);
+	}
+
+	/* Nothing can go wrong now */
+#if SCROLLCODE
+	lchange(WFHARD | WFINS);
+#else
+	lchange(WFHARD);
+#endif
+	if (inplace) {
+		lforget(lp1);
+		if (lp1->l_size == 0)	/* Shared, skip the head */
+			lp1->l_text += doto;
+		else {
+			memmove(&lp1->l_text[ntext], &lp1->l_text[doto], ntail);
+			memcpy(lp1->l_text, cp, ntext);
+		}
+		lp1->l_used = ntext + ntail;
+		lindex_resize(curbp, lp1, ntext - doto);
+	} else if (atend) {
+		lp2->l_bp = lp1->l_bp;
+		lp2->l_fp = lp1;
+		lp1->l_bp->l_fp = lp2;
+		lp1->l_bp = lp2;
+		lindex_add(curbp, lp2);
+	} else {
+		lp2->l_bp = lp1->l_bp;
+		lp2->l_fp = lp1->l_fp;
+		lp1->l_bp->l_fp = lp2;
+		lp1->l_fp->l_bp = lp2;
+		lindex_replace(curbp, lp1, lp2);
+	}
+	for (lp = first; lp != NULL; lp = nlp) {
+		nlp = lp->l_fp;
+		lp->l_bp = lp2->l_bp;
+		lp->l_fp = lp2;
+		lp2->l_bp->l_fp = lp;
+		lp2->l_bp = lp;
+		lindex_add(curbp, lp);
+	}
+	if (atend)		/* The new last line's newline  */
+		undo_record(first, 0, NULL, 0, "\n", 1);
+	undo_record(first, doto, NULL, 0, text, n);
+
+	wp = wheadp;		/* Windows              */
+	while (wp != NULL) {
+		if (wp->w_linep == lp1 && !atend)
+			wp->w_linep = first;
+		if (wp->w_dotp == lp1) {
+			if (wp == curwp) {
+				wp->w_dotp = lp2;
+				wp->w_doto = ntext;
+			} else if (!atend && wp->w_doto > doto) {
+				wp->w_dotp = lp2;
+				wp->w_doto += ntext - doto;
+			} else if (!atend)
+				wp->w_dotp = first;
+		}
+		if (wp->w_markp == lp1 && !atend) {
+			if (wp->w_marko > doto) {
+				wp->w_markp = lp2;
+				wp->w_marko += ntext - doto;
+			} else
+				wp->w_markp = first;
+		}
+		wp = wp->w_wndp;
+	}
+	if (!inplace && !atend)
+		ldispose(lp1);
+	return TRUE;
+
+      nomem:
+	for (lp = first; lp != NULL; lp = nlp) {
+		nlp = lp->l_fp;
+		ldispose(lp);
+	}
+	return FALSE;
+}
+
 /*
  * Overwrite a character into the current line at the current position
  *
@@ -329,26 +560,28 @@ int lnewline(void)
 #endif
 	lp1 = curwp->w_dotp;	/* Get the address and  */
 	doto = curwp->w_doto;	/* offset of "."        */
-	if ((lp2 = lalloc(doto)) == NULL)	/* New first half line      */
+	if ((lp2 = lalloc(curbp, doto)) == NULL)	/* New first half line      */
 		return FALSE;
 	cp1 = &lp1->l_text[0];	/* Shuffle text around  */
 	cp2 = &lp2->l_text[0];
 	while (cp1 != &lp1->l_text[doto])
 		*cp2++ = *cp1++;
-	cp2 = &lp1->l_text[0];
-	while (cp1 != &lp1->l_text[lp1->l_used])
-		*cp2++ = *cp1++;
+	lforget(lp1);
+	if (lp1->l_size == 0)	/* Shared, skip first half */
+		lp1->l_text += doto;
+	else {
+		cp2 = &lp1->l_text[0];
+		while (cp1 != &lp1->l_text[lp1->l_used])
+			*cp2++ = *cp1++;
+	}
 	lp1->l_used -= doto;
 	lp2->l_bp = lp1->l_bp;
 	lp1->l_bp = lp2;
 	lp2->l_bp->l_fp = lp2;
 	lp2->l_fp = lp1;
-#if COLOR
-	if ((curbp->b_mode & MDCMOD) != 0) {
-		lp2->l_mcomment = lp1->l_mcomment;
-		lp1->l_mcomment = mcomment_line_state(lp2, lp2->l_mcomment);
-	}
-#endif
+	lindex_resize(curbp, lp1, -doto);
+	lindex_add(curbp, lp2);
+	undo_record(lp2, doto, NULL, 0, "\n", 1);
 	wp = wheadp;		/* Windows              */
 	while (wp != NULL) {
 		if (wp->w_linep == lp1)
@@ -428,26 +661,29 @@ int ldelete(long n, int kflag)
 #else
 			lchange(WFHARD);
 #endif
-			if (ldelnewline() == FALSE
-			    || (kflag != FALSE && kinsert('\n') == FALSE))
+			if ((kflag != FALSE && kinsline(dotp, doto, 1) == FALSE)
+			    || ldelnewline() == FALSE)
 				return FALSE;
 			--n;
 			continue;
 		}
 		lchange(WFEDIT);
+		if (dotp->l_size == 0 && doto != 0	/* Shared, in the middle */
+		    && doto + chunk != dotp->l_used && lowntext(dotp) == FALSE)
+			return FALSE;
+		lforget(dotp);
 		cp1 = &dotp->l_text[doto];	/* Scrunch text.        */
 		cp2 = cp1 + chunk;
-		if (kflag != FALSE) {	/* Kill?                */
-			while (cp1 != cp2) {
-				if (kinsert(*cp1) == FALSE)
-					return FALSE;
-				++cp1;
-			}
-			cp1 = &dotp->l_text[doto];
-		}
-		while (cp2 != &dotp->l_text[dotp->l_used])
-			*cp1++ = *cp2++;
+		if (kflag != FALSE && kinsline(dotp, doto, chunk) == FALSE)
+			return FALSE;	/* Kill?                */
+		undo_record(dotp, doto, cp1, chunk, NULL, 0);
+		if (dotp->l_size != 0)
+			while (cp2 != &dotp->l_text[dotp->l_used])
+				*cp1++ = *cp2++;
+		else if (doto == 0)	/* Shared, skip the head */
+			dotp->l_text += chunk;
 		dotp->l_used -= chunk;
+		lindex_resize(curbp, dotp, -chunk);
 		wp = wheadp;	/* Fix windows          */
 		while (wp != NULL) {
 			if (wp->w_dotp == dotp && wp->w_doto >= doto) {
@@ -467,6 +703,82 @@ int ldelete(long n, int kflag)
 	return TRUE;
 }
 
+/*
+ * Where offset "o" of a line goes when the "nsp" pieces at "sp" get new
+ * text. An offset inside a piece goes to its start.
+ */
+static int lspmap(int o, struct lsplice *sp, int nsp)
+{
+	int delta;
+
+	delta = 0;
+	for (; nsp > 0 && sp->s_off < o; ++sp, --nsp) {
+		if (o < sp->s_off + sp->s_del)
+			return sp->s_off + delta;
+		delta += sp->s_ins - sp->s_del;
+	}
+	return o + delta;
+}
+
+/*
+ * Put the "used" bytes at "text" in place of the text of line "lp" of the
+ * current buffer, all at once. The new text is the old one with the "nsp"
+ * pieces at "sp", in order along the line, replaced; the dots and marks in
+ * the line move along with the text around them. The line is rebuilt only
+ * if the new text does not fit in it. Return TRUE if all is well, and
+ * FALSE on errors.
+ */
+int lreplace(struct line *lp, char *text, int used,
+	     struct lsplice *sp, int nsp)
+{
+	struct line *nlp;
+	struct window *wp;
+	int start;
+	int end;
+
+	if (curbp->b_mode & MDVIEW)	/* don't allow this command if      */
+		return rdonly();	/* we are in read only mode     */
+	lchange(WFEDIT);
+	if (used <= lp->l_size) {	/* Easy: in place       */
+		nlp = lp;
+		lforget(lp);
+		lindex_resize(curbp, lp, used - lp->l_used);
+	} else {		/* Hard: reallocate     */
+		if ((nlp = lalloc(curbp, used)) == NULL)
+			return FALSE;
+		lp->l_bp->l_fp = nlp;
+		nlp->l_fp = lp->l_fp;
+		lp->l_fp->l_bp = nlp;
+		nlp->l_bp = lp->l_bp;
+		lindex_replace(curbp, lp, nlp);
+	}
+	if (nsp > 0) {		/* From the first piece to the last */
+		start = sp[0].s_off;
+		end = sp[nsp - 1].s_off + sp[nsp - 1].s_del;
+		undo_record(nlp, start, &lp->l_text[start], end - start,
+			    &text[start], used - llength(lp) + end - start);
+	}
+	memcpy(nlp->l_text, text, used);
+	nlp->l_used = used;
+	wp = wheadp;		/* Update windows       */
+	while (wp != NULL) {
+		if (wp->w_linep == lp)
+			wp->w_linep = nlp;
+		if (wp->w_dotp == lp) {
+			wp->w_dotp = nlp;
+			wp->w_doto = lspmap(wp->w_doto, sp, nsp);
+		}
+		if (wp->w_markp == lp) {
+			wp->w_markp = nlp;
+			wp->w_marko = lspmap(wp->w_marko, sp, nsp);
+		}
+		wp = wp->w_wndp;
+	}
+	if (nlp != lp)
+		ldispose(lp);
+	return TRUE;
+}
+
 /*
  * getctext:	grab and return a string with the text of
  *		the current line
@@ -534,20 +846,21 @@ int ldelnewline(void)
 	struct line *lp2;
 	struct line *lp3;
 	struct window *wp;
-#if	COLOR
-	int nstate;
-#endif
 
 	if (curbp->b_mode & MDVIEW)	/* don't allow this command if      */
 		return rdonly();	/* we are in read only mode     */
 	lp1 = curwp->w_dotp;
 	lp2 = lp1->l_fp;
 	if (lp2 == curbp->b_linep) {	/* At the buffer end.   */
-		if (lp1->l_used == 0)	/* Blank line.              */
+		if (lp1->l_used == 0) {	/* Blank line.              */
+			undo_record(lp1, 0, "\n", 1, NULL, 0);
 			lfree(lp1);
+		}
 		return TRUE;
 	}
 	if (lp2->l_used <= lp1->l_size - lp1->l_used) {
+		undo_record(lp1, lp1->l_used, "\n", 1, NULL, 0);
+		lforget(lp1);
 		cp1 = &lp1->l_text[lp1->l_used];
 		cp2 = &lp2->l_text[0];
 		while (cp2 != &lp2->l_text[lp2->l_used])
@@ -567,26 +880,16 @@ int ldelnewline(void)
 			wp = wp->w_wndp;
 		}
 		lp1->l_used += lp2->l_used;
+		lindex_resize(curbp, lp1, lp2->l_used);
+		lindex_remove(curbp, lp2);
 		lp1->l_fp = lp2->l_fp;
 		lp2->l_fp->l_bp = lp1;
-#if	COLOR
-		if ((curbp->b_mode & MDCMOD) != 0) {
-			nstate = mcomment_line_state(lp1, lp1->l_mcomment);
-			lp1 = lforw(lp1);
-			while (lp1 != curwp->w_bufp->b_linep) {
-				if (lp1->l_mcomment == nstate)
-					break;
-				lp1->l_mcomment = nstate;
-				nstate = mcomment_line_state(lp1, nstate);
-				lp1 = lforw(lp1);
-			}
-		}
-#endif
-		free((char *) lp2);
+		ldispose(lp2);
 		return TRUE;
 	}
-	if ((lp3 = lalloc(lp1->l_used + lp2->l_used)) == NULL)
+	if ((lp3 = lalloc(curbp, lp1->l_used + lp2->l_used)) == NULL)
 		return FALSE;
+	undo_record(lp1, lp1->l_used, "\n", 1, NULL, 0);
 	cp1 = &lp1->l_text[0];
 	cp2 = &lp3->l_text[0];
 	while (cp1 != &lp1->l_text[lp1->l_used])
@@ -594,10 +897,12 @@ int ldelnewline(void)
 	cp1 = &lp2->l_text[0];
 	while (cp1 != &lp2->l_text[lp2->l_used])
 		*cp2++ = *cp1++;
+	lindex_remove(curbp, lp2);
 	lp1->l_bp->l_fp = lp3;
 	lp3->l_fp = lp2->l_fp;
 	lp2->l_fp->l_bp = lp3;
 	lp3->l_bp = lp1->l_bp;
+	lindex_replace(curbp, lp1, lp3);
 	wp = wheadp;
 	while (wp != NULL) {
 		if (wp->w_linep == lp1 || wp->w_linep == lp2)
@@ -616,118 +921,307 @@ int ldelnewline(void)
 		}
 		wp = wp->w_wndp;
 	}
-#if	COLOR
-	if ((curbp->b_mode & MDCMOD) != 0) {
-		lp3->l_mcomment = lp1->l_mcomment;
-		nstate = mcomment_line_state(lp3, lp3->l_mcomment);
-		lp3 = lforw(lp3);
-		while (lp3 != curwp->w_bufp->b_linep) {
-			if (lp3->l_mcomment == nstate)
-				break;
-			lp3->l_mcomment = nstate;
-			nstate = mcomment_line_state(lp3, nstate);
-			lp3 = lforw(lp3);
-		}
-	}
-#endif
-	free((char *) lp1);
-	free((char *) lp2);
+	ldispose(lp1);
+	ldispose(lp2);
 	return TRUE;
 }
 
 /*
- * Delete all of the text saved in the kill buffer. Called by commands when a
- * new kill context is being created. The kill buffer array is released, just
- * in case the buffer has grown to immense size. No errors.
+ * The kill ring: "kring[0]" is the newest kill, the one kill commands add
+ * to and yank puts back, and "kbufp" is its last chunk. A new kill pushes
+ * the others down the ring, which keeps "killring" of them. The last yank
+ * is remembered, for yank-pop to take out again.
+ */
+static int kyank;		/* Kill the last yank put in    */
+static long kyline;		/* Line it went in at           */
+static int kyoff;		/* and offset in that line      */
+static long kylen;		/* Bytes it put in              */
+
+/*
+ * Free the chunks of kill "kp".
+ */
+static void kfree(struct kill *kp)
+{
+	struct kill *np;
+
+	while (kp != NULL) {
+		np = kp->d_next;
+		if (kp->d_bufp != NULL)
+			--kp->d_bufp->b_krefs;
+		free(kp);
+		kp = np;
+	}
+}
+
+/*
+ * Delete all of the text saved in the kill ring. No errors.
  */
 void kdelete(void)
 {
-	struct kill *kp;		/* ptr to scan kill buffer chunk list */
+	int i;
+
+	for (i = 0; i < NKRING; ++i) {
+		kfree(kring[i]);
+		kring[i] = NULL;
+	}
+	kbufp = NULL;
+}
+
+/*
+ * Start a new kill. Called by commands when a new kill context is being
+ * created. The kills before it move down the ring, and the oldest drops
+ * off the end once there are "killring" of them. No errors.
+ */
+void kpush(void)
+{
+	int i;
+
+	if (kring[0] == NULL)	/* Last one is still empty */
+		return;
+	for (i = killring - 1; i < NKRING; ++i) {
+		kfree(kring[i]);
+		kring[i] = NULL;
+	}
+	for (i = killring - 1; i > 0; --i)
+		kring[i] = kring[i - 1];
+	kring[0] = NULL;
+	kbufp = NULL;
+}
+
+/*
+ * Link chunk "kp" in at the end of the newest kill.
+ */
+static void kappend(struct kill *kp)
+{
+	kp->d_next = NULL;
+	if (kbufp != NULL)
+		kbufp->d_next = kp;
+	else
+		kring[0] = kp;
+	kbufp = kp;
+}
 
-	if (kbufh != NULL) {
+/*
+ * Add a copy of the "n" bytes at "text" to the end of the kill buffer,
+ * allocating new chunks as needed; each is twice the size of the last, up
+ * to KMAXBLOCK. Return TRUE if all is well, and FALSE on errors.
+ */
+int kinstext(char *text, long n)
+{
+	struct kill *nchunk;		/* ptr to newly malloced chunk */
+	long size;
+	long chunk;
 
-		/* first, delete all the chunks */
-		kbufp = kbufh;
-		while (kbufp != NULL) {
-			kp = kbufp->d_next;
-			free(kbufp);
-			kbufp = kp;
+	while (n > 0) {
+		/* check to see if we need a new chunk */
+		if (kbufp == NULL || kbufp->d_used >= kbufp->d_size) {
+			size = KBLOCK;
+			if (kbufp != NULL && kbufp->d_size != 0)
+				size = kbufp->d_size < KMAXBLOCK / 2
+				    ? kbufp->d_size * 2 : KMAXBLOCK;
+			if ((nchunk = (struct kill *)malloc(sizeof(struct kill)
+							    + size)) == NULL)
+				return FALSE;
+			nchunk->d_bufp = NULL;
+			nchunk->d_chunk = (char *) (nchunk + 1);
+			nchunk->d_used = 0;
+			nchunk->d_size = size;
+			kappend(nchunk);
 		}
 
-		/* and reset all the kill buffer pointers */
-		kbufh = kbufp = NULL;
-		kused = KBLOCK;
+		/* and now copy in as much as fits */
+		chunk = kbufp->d_size - kbufp->d_used;
+		if (chunk > n)
+			chunk = n;
+		memcpy(&kbufp->d_chunk[kbufp->d_used], text, chunk);
+		kbufp->d_used += chunk;
+		text += chunk;
+		n -= chunk;
 	}
+	return TRUE;
 }
 
 /*
- * Insert a character to the kill buffer, allocating new chunks as needed.
- * Return TRUE if all is well, and FALSE on errors.
+ * Insert a character to the kill buffer. Return TRUE if all is well, and
+ * FALSE on errors.
  *
  * int c;			character to insert in the kill buffer
  */
 int kinsert(int c)
 {
-	struct kill *nchunk;		/* ptr to newly malloced chunk */
+	char ch;
+
+	if (kbufp != NULL && kbufp->d_used < kbufp->d_size) {
+		kbufp->d_chunk[kbufp->d_used++] = c;
+		return TRUE;
+	}
+	ch = c;
+	return kinstext(&ch, 1);
+}
 
-	/* check to see if we need a new chunk */
-	if (kused >= KBLOCK) {
-		if ((nchunk = (struct kill *)malloc(sizeof(struct kill))) == NULL)
+/*
+ * Add "n" bytes of line "lp" of the current buffer, from offset "off", to
+ * the kill buffer; the byte past the end of the line is its newline. What
+ * the line still shares of the original file text is not copied, the kill
+ * points at it; when lines follow each other in the file text, one chunk
+ * covers them all. Return TRUE if all is well, and FALSE on errors.
+ */
+int kinsline(struct line *lp, int off, long n)
+{
+	struct kill *nchunk;
+	char *text;
+	long len;
+
+	text = &lp->l_text[off];
+	len = llength(lp) - off;
+	if (len > n)
+		len = n;
+	if (lp->l_size != 0) {
+		if (kinstext(text, len) == FALSE)
 			return FALSE;
-		if (kbufh == NULL)	/* set head ptr if first time */
-			kbufh = nchunk;
-		if (kbufp != NULL)	/* point the current to this new one */
-			kbufp->d_next = nchunk;
-		kbufp = nchunk;
-		kbufp->d_next = NULL;
-		kused = 0;
+	} else {
+		if (len < n && text + len < curbp->b_text + curbp->b_tsize
+		    && text[len] == '\n')
+			++len;	/* Newline is in the file text too */
+		if (len > 0 && (kbufp == NULL || kbufp->d_bufp != curbp
+				|| kbufp->d_chunk + kbufp->d_used != text)) {
+			if ((nchunk = (struct kill *)malloc(sizeof(struct kill)))
+			    == NULL)
+				return FALSE;
+			nchunk->d_bufp = curbp;
+			nchunk->d_chunk = text;
+			nchunk->d_used = 0;
+			nchunk->d_size = 0;
+			++curbp->b_krefs;
+			kappend(nchunk);
+		}
+		kbufp->d_used += len;
 	}
+	if (len < n)
+		return kinsert('\n');
+	return TRUE;
+}
+
+/*
+ * Buffer "bp" is about to drop its original file text; give the kill
+ * chunks that point into it copies of their own. The text of a chunk
+ * there is no memory for is lost.
+ */
+void kcopy(struct buffer *bp)
+{
+	struct kill **kpp;
+	struct kill *kp;
+	struct kill *nkp;
+	int i;
+
+	for (i = 0; i < NKRING && bp->b_krefs > 0; ++i)
+		for (kpp = &kring[i]; (kp = *kpp) != NULL; kpp = &kp->d_next) {
+			if (kp->d_bufp != bp)
+				continue;
+			--bp->b_krefs;
+			kp->d_bufp = NULL;
+			if ((nkp = (struct kill *)malloc(sizeof(struct kill)
+							 + kp->d_used)) == NULL) {
+				mlwrite("(OUT OF MEMORY)");
+				kp->d_used = 0;
+				continue;
+			}
+			nkp->d_next = kp->d_next;
+			nkp->d_bufp = NULL;
+			nkp->d_chunk = (char *) (nkp + 1);
+			memcpy(nkp->d_chunk, kp->d_chunk, kp->d_used);
+			nkp->d_used = nkp->d_size = kp->d_used;
+			if (kbufp == kp)
+				kbufp = nkp;
+			*kpp = nkp;
+			free(kp);
+			kp = nkp;
+		}
+}
+
+/*
+ * The original file text of buffer "bp" moved here from "old"; move the
+ * kill chunks that point into it along.
+ */
+void kmove(struct buffer *bp, char *old)
+{
+	struct kill *kp;
+	int i;
+
+	for (i = 0; i < NKRING && bp->b_krefs > 0; ++i)
+		for (kp = kring[i]; kp != NULL; kp = kp->d_next)
+			if (kp->d_bufp == bp)
+				kp->d_chunk = bp->b_text + (kp->d_chunk - old);
+}
 
-	/* and now insert the character */
-	kbufp->d_chunk[kused++] = c;
+/*
+ * Put the text of kill "kp" in at dot, adding up its size in "kylen".
+ */
+static int kput(struct kill *kp)
+{
+	for (; kp != NULL; kp = kp->d_next) {
+		if (linstext(kp->d_chunk, kp->d_used) == FALSE)
+			return FALSE;
+		kylen += kp->d_used;
+	}
 	return TRUE;
 }
 
 /*
  * Yank text back from the kill buffer. This is really easy. All of the work
- * is done by the standard insert routines. All you do is run the loop, and
- * check for errors. Bound to "C-Y".
+ * is done by the standard insert routines, a chunk of the kill buffer at a
+ * time. All you do is run the loop, and check for errors. Bound to "C-Y".
  */
 int yank(int f, int n)
 {
-	int c;
-	int i;
-	char *sp;	/* pointer into string to insert */
-	struct kill *kp;		/* pointer into kill buffer */
+	long byte;
 
 	if (curbp->b_mode & MDVIEW)	/* don't allow this command if      */
 		return rdonly();	/* we are in read only mode     */
 	if (n < 0)
 		return FALSE;
 	/* make sure there is something to yank */
-	if (kbufh == NULL)
+	if (kring[0] == NULL)
 		return TRUE;	/* not an error, just nothing */
 
+	/* remember where it goes, for yank-pop */
+	lindex_where(curbp, curwp->w_dotp, &kyline, &byte);
+	kyoff = curwp->w_doto;
+	kylen = 0;
+	kyank = 0;
+	thisflag |= CFYANK;
+
 	/* for each time.... */
-	while (n--) {
-		kp = kbufh;
-		while (kp != NULL) {
-			if (kp->d_next == NULL)
-				i = kused;
-			else
-				i = KBLOCK;
-			sp = kp->d_chunk;
-			while (i--) {
-				if ((c = *sp++) == '\n') {
-					if (lnewline() == FALSE)
-						return FALSE;
-				} else {
-					if (linsert_byte(1, c) == FALSE)
-						return FALSE;
-				}
-			}
-			kp = kp->d_next;
-		}
-	}
+	while (n--)
+		if (kput(kring[0]) == FALSE)
+			return FALSE;
 	return TRUE;
 }
+
+/*
+ * Take out the text the last yank put in, and put in the kill before it
+ * in the kill ring instead. With an argument, go that many kills down the
+ * ring, or up it if it is negative; past the oldest comes the newest
+ * again. Only right after a yank or another yank-pop. Bound to "M-Y".
+ */
+int yankpop(int f, int n)
+{
+	int nkill;
+
+	if (curbp->b_mode & MDVIEW)	/* don't allow this command if      */
+		return rdonly();	/* we are in read only mode     */
+	if ((lastflag & CFYANK) == 0) {
+		mlwrite("(Last command was not a yank)");
+		return FALSE;
+	}
+	for (nkill = 0; nkill < NKRING && kring[nkill] != NULL; ++nkill)
+		;
+	kyank = ((kyank + n) % nkill + nkill) % nkill;
+	curwp->w_dotp = lindex_line(curbp, kyline);
+	curwp->w_doto = kyoff;
+	if (ldelete(kylen, FALSE) == FALSE)
+		return FALSE;
+	kylen = 0;
+	thisflag |= CFYANK;
+	return kput(kring[kyank]);
+}
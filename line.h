@@ -10,41 +10,76 @@
  * number of bytes in the line (the "used" size), the size of the text array,
  * and the text. The end of line is not stored as a byte; it's implied. Future
  * additions will include update hints, and a list of marks into the line.
+ *
+ * A line read from a big file does not own its text; it points into the
+ * original file text kept by the buffer ("b_text"), and "l_size" is zero.
+ * Such a line is only a piece of the original; it gets a private copy of
+ * its text the first time it is changed in place (see lowntext()).
  */
 struct line {
 	struct line *l_fp;	/* Link to the next line        */
 	struct line *l_bp;	/* Link to the previous line    */
-	int l_size;		/* Allocated size               */
+	char *l_text;		/* A bunch of characters.       */
+	int l_size;		/* Allocated size, 0 if shared  */
 	int l_used;		/* Used size                    */
+	int l_chunk;		/* Chunk of the line index      */
 #if COLOR
-	int l_mcomment;		/* Multi-line comment state     */
+	struct synline *l_syn;	/* Colours it was drawn in      */
 #endif
-	char l_text[1];		/* A bunch of characters.       */
+};
+
+/* A piece of a line that lreplace() put new text in place of */
+struct lsplice {
+	int s_off;		/* Where it was in the old text */
+	int s_del;		/* Bytes of old text            */
+	int s_ins;		/* Bytes of new text            */
 };
 
 #define lforw(lp)       ((lp)->l_fp)
 #define lback(lp)       ((lp)->l_bp)
 #define lgetc(lp, n)    ((lp)->l_text[(n)]&0xFF)
-#define lputc(lp, n, c) ((lp)->l_text[(n)]=(c))
+#define lputc(lp, n, c) ((void)(((lp)->l_size != 0 || lowntext(lp)) \
+				     && (lforget(lp), (lp)->l_text[(n)]=(c), TRUE)))
 #define llength(lp)     ((lp)->l_used)
 
+/* The text of line "lp" is about to change; its colours are no good */
+#if COLOR
+#define lforget(lp)	((lp)->l_syn != NULL ? syntax_forget(lp) : (void) 0)
+#else
+#define lforget(lp)	((void) 0)
+#endif
+
 extern void lfree(struct line *lp);
 extern void lchange(int flag);
 extern int insspace(int f, int n);
 extern int linstr(char *instr);
 extern int linsert(int n, int c);
+extern int linstext(char *text, long n);
 extern int lowrite(int c);
 extern int lover(char *ostr);
 extern int lnewline(void);
 extern int ldelete(long n, int kflag);
+extern int lreplace(struct line *lp, char *text, int used,
+		    struct lsplice *sp, int nsp);
 extern int ldelchar(long n, int kflag);
 extern int lgetchar(unicode_t *);
 extern char *getctext(void);
 extern int putctext(char *iline);
 extern int ldelnewline(void);
 extern void kdelete(void);
+extern void kpush(void);
 extern int kinsert(int c);
+extern int kinstext(char *text, long n);
+extern int kinsline(struct line *lp, int off, long n);
+extern void kcopy(struct buffer *bp);
+extern void kmove(struct buffer *bp, char *old);
 extern int yank(int f, int n);
-extern struct line *lalloc(int);  /* Allocate a line. */
+extern int yankpop(int f, int n);
+extern struct line *lalloc(struct buffer *bp, int used);  /* Allocate a line. */
+extern struct line *lshare(struct buffer *bp, char *text, int used);
+extern int lowntext(struct line *lp);
+#if COLOR
+extern void syntax_forget(struct line *lp);
+#endif
 
 #endif  /* LINE_H_ */
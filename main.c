@@ -61,6 +61,7 @@
 #include "efunc.h"   /* Function declarations and name table. */
 #include "ebind.h"   /* Default key bindings. */
 #include "version.h"
+#include "undo.h"
 
 /* For MSDOS, increase the default stack space. */
 #if MSDOS & TURBO
@@ -82,6 +83,7 @@ extern unsigned _stklen = 32766;
 
 #if UNIX
 #include <signal.h>
+#include <unistd.h>
 static void emergencyexit(int);
 #ifdef SIGWINCH
 extern void sizesignal(int);
@@ -313,6 +315,15 @@ int main(int argc, char **argv)
 	execute(META | SPEC | 'C', FALSE, 1);
 	lastflag = saveflag;
 
+#if	V7 | USG | BSD
+	/* until a key comes, look out for saves done in the background */
+	if (savepoll() != 0 && kbdmode != PLAY) {
+		update(FALSE);
+		while (savepoll() != 0 && !typahead())
+			usleep(20000L);
+	}
+#endif
+
 #if TYPEAH && PKCODE
 	if (typahead()) {
 		newc = getcmd();
@@ -427,7 +438,8 @@ int main(int argc, char **argv)
 		}
 	}
 
-	/* and execute the command */
+	/* and execute the command, as one change to undo */
+	undo_boundary(getbind(c) == NULL);
 	execute(c, f, n);
 	goto loop;
 }
@@ -604,6 +616,7 @@ int quit(int f, int n)
 {
 	int s;
 
+	savewait(NULL);		/* Let the saves finish first.  */
 	if (f != FALSE		/* Argument forces it.  */
 	    || anycb() == FALSE	/* All buffers clean.   */
 	    /* User says it's OK.   */
@@ -833,6 +846,9 @@ int cexit(int status)
 	}
 	wheadp = NULL;
 
+	/* then the kill buffer, before the file text it shares goes */
+	kdelete();
+
 	/* then the buffers */
 	bp = bheadp;
 	while (bp) {
@@ -842,9 +858,6 @@ int cexit(int status)
 		bp = bheadp;
 	}
 
-	/* and the kill buffer */
-	kdelete();
-
 	/* and the video buffers */
 	vtfree();
 
@@ -0,0 +1,559 @@
+/*	mcmatch.c
+ *
+ * The matcher behind MAGIC mode searches.
+ *
+ * The struct magic array that mcstr() makes of a pattern is compiled into
+ * a little program for a Thompson NFA: one instruction for each character,
+ * class, 'any', beginning or end of line, and a split and a jump around
+ * each closure. The program is run as a Pike VM, which steps all the ways
+ * the pattern could go through the text at once, in the order that the
+ * old backtracking matcher would have tried them. So it finds the same
+ * match, without ever going back over the text: the time it takes grows
+ * with the length of the text, whatever the pattern.
+ *
+ * A pattern that cannot match a newline cannot match across lines. Each
+ * line is then first run through a DFA, made lazily from the program one
+ * state at a time and kept for the next line; only a line the DFA says
+ * could hold a match is looked at by the VM. In a big buffer, the lines
+ * are shared out among several processes by psearch().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+#include "mcmatch.h"
+#include "psearch.h"
+
+#if	MAGIC
+
+#define	NINST	(3 * NPAT + 1)	/* Closures take three instructions   */
+#define	NDSTATE	128		/* DFA states kept at once            */
+
+/* Instructions. */
+#define	ISET	0		/* Take a byte from the set           */
+#define	ISPLIT	1		/* Go on both here and at i_next      */
+#define	IJMP	2		/* Go on at i_next                    */
+#define	IBOL	3		/* Only at the beginning of a line    */
+#define	IEOL	4		/* Only at the end of a line          */
+#define	IMATCH	5		/* Found it                           */
+
+struct inst {
+	short i_op;		/* One of the above                   */
+	short i_next;		/* Other instruction of ISPLIT, IJMP  */
+	unsigned char i_set[HIBYTE];	/* Bytes that ISET takes        */
+};
+
+/* A DFA state: the set of ISET and IMATCH instructions the NFA can be at. */
+struct dstate {
+	struct dstate *d_next[HICHAR];	/* On each byte, NULL if not known */
+	int d_match;		/* Does the set hold an IMATCH?       */
+	int d_npc;		/* Instructions in the set            */
+	short d_pc[1];		/* ... and the rest of them           */
+};
+
+struct prog {
+	struct magic *p_magic;	/* Made from this, or NULL            */
+	int p_exact;		/* ... in EXACT mode?                 */
+	int p_newline;		/* Can it match a newline?            */
+	int p_ninst;
+	struct inst p_inst[NINST];
+	struct dstate *p_dstate[NDSTATE];	/* The DFA so far     */
+	int p_ndstate;
+	struct dstate *p_dstart;	/* Its start state            */
+};
+
+/* A place in the buffer: a match can only end at such a place. */
+struct place {
+	struct line *lp;
+	int off;
+};
+
+/* A thread of the VM: where it is in the program, and where it started. */
+struct thread {
+	int t_pc;
+	struct place t_start;
+	long t_step;		/* Bytes read when it started         */
+};
+
+struct tlist {
+	int n;
+	struct thread t[NINST];
+};
+
+static struct prog fprog;	/* Forward, from mcpat[]              */
+static struct prog rprog;	/* Reverse, from tapcm[]              */
+static struct prog *lprog;	/* The one mcmline() runs             */
+static int ldirect;		/* ... and which way                  */
+static struct tlist tlist1;
+static struct tlist tlist2;
+static int mark[NINST];		/* Instruction is in the list of gen  */
+static int gen;
+static short pcs[NINST];	/* Set of a new DFA state             */
+
+/*
+ * Add the bytes that literal character "lc" matches to set "set".
+ */
+static void litset(unsigned char *set, int lc, int exact)
+{
+	int c;
+
+	lc &= 0xFF;
+	for (c = 0; c < HICHAR; ++c)
+		if (c == lc || (!exact && (islower(c) ? CHCASE(c) : c)
+				== (islower(lc) ? CHCASE(lc) : lc)))
+			set[c >> 3] |= BIT(c & 7);
+}
+
+/*
+ * Make the byte set of struct magic "mp" in "set".
+ */
+static void mkset(unsigned char *set, struct magic *mp, int exact)
+{
+	int c;
+	int in;
+
+	memset(set, 0, HIBYTE);
+	switch (mp->mc_type & MASKCL) {
+	case LITCHAR:
+		litset(set, mp->u.lchar, exact);
+		break;
+	case ANY:
+		memset(set, 0xFF, HIBYTE);
+		set['\n' >> 3] &= ~BIT('\n' & 7);
+		break;
+	case CCL:
+	case NCCL:
+		for (c = 0; c < HICHAR; ++c) {
+			in = (mp->u.cclmap[c >> 3] & BIT(c & 7)) != 0;
+			if (!in && !exact && isletter(c))
+				in = (mp->u.cclmap[CHCASE(c) >> 3]
+				      & BIT(CHCASE(c) & 7)) != 0;
+			if (in != ((mp->mc_type & MASKCL) == NCCL))
+				set[c >> 3] |= BIT(c & 7);
+		}
+		break;
+	}
+
+	/* a closure never takes a newline */
+	if (mp->mc_type & CLOSURE)
+		set['\n' >> 3] &= ~BIT('\n' & 7);
+}
+
+/*
+ * Throw away the DFA of program "pp".
+ */
+static void dfaflush(struct prog *pp)
+{
+	while (pp->p_ndstate > 0)
+		free((char *) pp->p_dstate[--pp->p_ndstate]);
+	pp->p_dstart = NULL;
+}
+
+/*
+ * Compile the struct magic array "mcp" into program "pp", unless that is
+ * what it holds already.
+ */
+static void compile(struct prog *pp, struct magic *mcp, int exact)
+{
+	struct inst *ip;
+	struct magic *mp;
+	int n;
+
+	if (pp->p_magic == mcp && pp->p_exact == exact)
+		return;
+	dfaflush(pp);
+	pp->p_magic = mcp;
+	pp->p_exact = exact;
+	pp->p_newline = FALSE;
+
+	n = 0;
+	for (mp = mcp; mp->mc_type != MCNIL; ++mp) {
+		ip = &pp->p_inst[n];
+		switch (mp->mc_type & MASKCL) {
+		case BOL:
+			ip->i_op = IBOL;
+			++n;
+			continue;
+		case EOL:
+			ip->i_op = IEOL;
+			++n;
+			continue;
+		}
+		if (mp->mc_type & CLOSURE) {	/* split, set, jump back */
+			ip->i_op = ISPLIT;
+			ip->i_next = n + 3;
+			++ip;
+			ip->i_op = ISET;
+			mkset(ip->i_set, mp, exact);
+			++ip;
+			ip->i_op = IJMP;
+			ip->i_next = n;
+			n += 3;
+		} else {
+			ip->i_op = ISET;
+			mkset(ip->i_set, mp, exact);
+			if (ip->i_set['\n' >> 3] & BIT('\n' & 7))
+				pp->p_newline = TRUE;
+			++n;
+		}
+	}
+	pp->p_inst[n++].i_op = IMATCH;
+	pp->p_ninst = n;
+}
+
+/*
+ * Forget the compiled programs; the pattern has changed.
+ */
+void mcmforget(void)
+{
+	fprog.p_magic = NULL;
+	rprog.p_magic = NULL;
+	dfaflush(&fprog);
+	dfaflush(&rprog);
+}
+
+/*
+ * Add instruction "pc" of "pp", and all that it leads to without taking a
+ * byte, to the pc set of a DFA state. Lines do not matter to the DFA, so
+ * it takes the beginning and end of line as always there.
+ */
+static void dfaadd(struct prog *pp, int pc)
+{
+	for (;;) {
+		if (mark[pc] == gen)
+			return;
+		mark[pc] = gen;
+		switch (pp->p_inst[pc].i_op) {
+		case ISPLIT:
+			dfaadd(pp, pc + 1);
+			pc = pp->p_inst[pc].i_next;
+			break;
+		case IJMP:
+			pc = pp->p_inst[pc].i_next;
+			break;
+		case IBOL:
+		case IEOL:
+			++pc;
+			break;
+		default:
+			return;
+		}
+	}
+}
+
+/*
+ * Find the DFA state for the instructions marked with "gen", making it if
+ * it is new.
+ */
+static struct dstate *dfastate(struct prog *pp)
+{
+	struct dstate *dp;
+	int npc;
+	int pc;
+	int i;
+
+	npc = 0;
+	for (pc = 0; pc < pp->p_ninst; ++pc)
+		if (mark[pc] == gen && (pp->p_inst[pc].i_op == ISET
+					|| pp->p_inst[pc].i_op == IMATCH))
+			pcs[npc++] = pc;
+
+	for (i = 0; i < pp->p_ndstate; ++i) {
+		dp = pp->p_dstate[i];
+		if (dp->d_npc == npc
+		    && memcmp(dp->d_pc, pcs, npc * sizeof(short)) == 0)
+			return dp;
+	}
+
+	if (pp->p_ndstate == NDSTATE)	/* Full: start over */
+		dfaflush(pp);
+	dp = (struct dstate *)malloc(sizeof(struct dstate)
+				     + npc * sizeof(short));
+	if (dp == NULL)
+		return NULL;
+	memset(dp->d_next, 0, sizeof(dp->d_next));
+	dp->d_match = FALSE;
+	dp->d_npc = npc;
+	for (i = 0; i < npc; ++i) {
+		dp->d_pc[i] = pcs[i];
+		if (pp->p_inst[pcs[i]].i_op == IMATCH)
+			dp->d_match = TRUE;
+	}
+	pp->p_dstate[pp->p_ndstate++] = dp;
+	return dp;
+}
+
+/*
+ * Could there be a match in the "n" bytes at "cp", read forward or in
+ * reverse from there? A match can start anywhere, so the start of the
+ * program is added in at every step. If we run out of memory, say yes and
+ * leave it to the VM.
+ */
+static int dfascan(struct prog *pp, char *cp, int n, int direct)
+{
+	struct dstate *dp;
+	struct dstate *ndp;
+	int step;
+	int c;
+	int i;
+
+	if ((dp = pp->p_dstart) == NULL) {
+		++gen;
+		dfaadd(pp, 0);
+		if ((dp = pp->p_dstart = dfastate(pp)) == NULL)
+			return TRUE;
+	}
+	step = 1;
+	if (direct == REVERSE) {
+		cp += n - 1;
+		step = -1;
+	}
+	for (; !dp->d_match; cp += step) {
+		if (n-- <= 0)
+			return FALSE;
+		c = *cp & 0xFF;
+		if ((ndp = dp->d_next[c]) == NULL) {
+			++gen;
+			for (i = 0; i < dp->d_npc; ++i)
+				if (pp->p_inst[dp->d_pc[i]].i_op == ISET
+				    && (pp->p_inst[dp->d_pc[i]].i_set[c >> 3]
+					& BIT(c & 7)))
+					dfaadd(pp, dp->d_pc[i] + 1);
+			dfaadd(pp, 0);
+			if ((ndp = dfastate(pp)) == NULL)
+				return TRUE;
+			if (pp->p_dstart != NULL)	/* "dp" is still there */
+				dp->d_next[c] = ndp;
+			else {	/* The DFA was thrown away to make room */
+				++gen;
+				dfaadd(pp, 0);
+				if ((pp->p_dstart = dfastate(pp)) == NULL)
+					return TRUE;
+			}
+		}
+		dp = ndp;
+	}
+	return TRUE;
+}
+
+/*
+ * Is place "pl" at the beginning or at the end of its line?
+ */
+#define	atbol(pl)	((pl).off == 0)
+#define	ateol(pl)	((pl).off == llength((pl).lp))
+
+/*
+ * Add a thread at instruction "pc", at place "pl", to list "lp", following
+ * the splits and jumps and checking the beginning and end of line, in the
+ * order the backtracking matcher would have tried them.
+ */
+static void addthread(struct prog *pp, struct tlist *tl, int pc,
+		      struct place pl, struct place start, long step)
+{
+	struct thread *tp;
+
+	for (;;) {
+		if (mark[pc] == gen)
+			return;
+		mark[pc] = gen;
+		switch (pp->p_inst[pc].i_op) {
+		case ISPLIT:
+			addthread(pp, tl, pc + 1, pl, start, step);
+			pc = pp->p_inst[pc].i_next;
+			break;
+		case IJMP:
+			pc = pp->p_inst[pc].i_next;
+			break;
+		case IBOL:
+			if (!atbol(pl))
+				return;
+			++pc;
+			break;
+		case IEOL:
+			if (!ateol(pl))
+				return;
+			++pc;
+			break;
+		default:
+			tp = &tl->t[tl->n++];
+			tp->t_pc = pc;
+			tp->t_start = start;
+			tp->t_step = step;
+			return;
+		}
+	}
+}
+
+/*
+ * Get the byte at place "pl" going in direction "direct", and the place
+ * after it in "np". Return -1 at the end of the buffer. The end of a line
+ * reads as a newline; the search does not wrap around the buffer.
+ */
+static int getbyte(struct place pl, struct place *np, int direct)
+{
+	struct line *hlp;
+
+	hlp = curbp->b_linep;
+	if (direct == FORWARD) {
+		if (pl.off < llength(pl.lp)) {
+			np->lp = pl.lp;
+			np->off = pl.off + 1;
+			return lgetc(pl.lp, pl.off);
+		}
+		if (pl.lp == hlp)
+			return -1;
+		np->lp = lforw(pl.lp);
+		np->off = 0;
+		return '\n';
+	}
+	if (pl.off > 0) {
+		np->lp = pl.lp;
+		np->off = pl.off - 1;
+		return lgetc(pl.lp, pl.off - 1);
+	}
+	if (lback(pl.lp) == hlp)
+		return -1;
+	np->lp = lback(pl.lp);
+	np->off = llength(np->lp);
+	return '\n';
+}
+
+/*
+ * Can a match start at place "pl"? Not past the end of the text in the
+ * direction we are going.
+ */
+static int canstart(struct place pl, int direct)
+{
+	struct line *hlp;
+
+	hlp = curbp->b_linep;
+	if (direct == FORWARD)
+		return pl.lp != hlp
+		    && (pl.off < llength(pl.lp) || lforw(pl.lp) != hlp);
+	return pl.off > 0 || lback(pl.lp) != hlp;
+}
+
+/*
+ * Run the VM of program "pp" from place "pl" in direction "direct", until
+ * the first match (in the order the places are tried) is found. If
+ * "oneline" is TRUE, only places in the line of "pl" are tried.
+ */
+static int vmrun(struct prog *pp, struct place pl, int direct, int oneline,
+		 struct mcmres *mrp)
+{
+	struct tlist *clist;
+	struct tlist *nlist;
+	struct tlist *tl;
+	struct thread *tp;
+	struct place np;
+	struct line *firstlp;
+	int matched;
+	long step;
+	int c;
+	int i;
+
+	clist = &tlist1;
+	nlist = &tlist2;
+	clist->n = 0;
+	++gen;
+	firstlp = pl.lp;
+	matched = FALSE;
+	for (step = 0;; ++step) {
+		/* the lowest priority of all: a new start here */
+		if (!matched && (!oneline || pl.lp == firstlp)
+		    && canstart(pl, direct))
+			addthread(pp, clist, 0, pl, pl, step);
+		if (clist->n == 0 && (matched || (oneline && pl.lp != firstlp)))
+			break;
+
+		c = getbyte(pl, &np, direct);
+		nlist->n = 0;
+		++gen;
+		for (i = 0; i < clist->n; ++i) {
+			tp = &clist->t[i];
+			if (pp->p_inst[tp->t_pc].i_op == IMATCH) {
+				/* cut off the threads after this one */
+				matched = TRUE;
+				mrp->m_slp = tp->t_start.lp;
+				mrp->m_soff = tp->t_start.off;
+				mrp->m_elp = pl.lp;
+				mrp->m_eoff = pl.off;
+				mrp->m_len = step - tp->t_step;
+				break;
+			}
+			if (c >= 0 && (pp->p_inst[tp->t_pc].i_set[c >> 3]
+				       & BIT(c & 7)))
+				addthread(pp, nlist, tp->t_pc + 1, np,
+					  tp->t_start, tp->t_step);
+		}
+		if (c < 0)
+			break;
+		tl = clist;
+		clist = nlist;
+		nlist = tl;
+		pl = np;
+	}
+	return matched;
+}
+
+/*
+ * Look for a match in the whole of line "lp", for psearch(), and put it
+ * in "mrp".
+ */
+static int mcmline(struct line *lp, void *mrp)
+{
+	struct place pl;
+
+	pl.lp = lp;
+	pl.off = ldirect == FORWARD ? 0 : llength(lp);
+	return dfascan(lprog, lp->l_text, llength(lp), ldirect)
+	    && vmrun(lprog, pl, ldirect, TRUE, mrp);
+}
+
+/*
+ * Search from "." in direction "direct" for struct magic array "mcp",
+ * which reads backward if we are going in reverse. Put where the match
+ * starts (in the direction of the search), where it ends, and its length
+ * in "mrp".
+ */
+int mcmatch(struct magic *mcp, int direct, struct mcmres *mrp)
+{
+	struct prog *pp;
+	struct line *hlp;
+	struct place pl;
+
+	pp = direct == FORWARD ? &fprog : &rprog;
+	compile(pp, mcp, (curwp->w_bufp->b_mode & MDEXACT) != 0);
+	hlp = curbp->b_linep;
+	pl.lp = curwp->w_dotp;
+	pl.off = curwp->w_doto;
+
+	if (pp->p_newline)
+		return vmrun(pp, pl, direct, FALSE, mrp);
+
+	/* one line at a time, if the DFA says it is worth it */
+	if (direct == FORWARD) {
+		if (pl.lp == hlp)
+			return FALSE;
+		if (dfascan(pp, pl.lp->l_text + pl.off,
+			    llength(pl.lp) - pl.off, FORWARD)
+		    && vmrun(pp, pl, FORWARD, TRUE, mrp))
+			return TRUE;
+		pl.lp = lforw(pl.lp);
+	} else {
+		if (dfascan(pp, pl.lp->l_text, pl.off, REVERSE)
+		    && vmrun(pp, pl, REVERSE, TRUE, mrp))
+			return TRUE;
+		if ((pl.lp = lback(pl.lp)) == hlp)
+			return FALSE;
+	}
+	lprog = pp;
+	ldirect = direct;
+	return psearch(&pl.lp, direct, mcmline, mrp, sizeof(*mrp));
+}
+#endif
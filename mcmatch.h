@@ -0,0 +1,23 @@
+#ifndef MCMATCH_H_
+#define MCMATCH_H_
+
+/*
+ * The matcher of MAGIC mode searches. "mcmatch" searches from "." for the
+ * struct magic array made by mcstr(), the reversed one if it is going in
+ * reverse, and tells where the match it found starts and ends, in the
+ * direction of the search, or returns ABORT if a key was typed while it
+ * searched a big buffer. "mcmforget" throws away what it has compiled
+ * when the arrays change.
+ */
+struct mcmres {
+	struct line *m_slp;	/* Start of the match                   */
+	int m_soff;
+	struct line *m_elp;	/* End of the match                     */
+	int m_eoff;
+	long m_len;		/* Bytes in it, newlines too            */
+};
+
+int mcmatch(struct magic *mcp, int direct, struct mcmres *mrp);
+void mcmforget(void);
+
+#endif  /* MCMATCH_H_ */
@@ -170,6 +170,7 @@ struct name_bind names[] = {
 	{"quick-exit", quickexit},
 	{"quote-character", quote},
 	{"read-file", fileread},
+	{"redo", redo},
 	{"redraw-display", reposition},
 	{"resize-window", resize},
 	{"restore-window", restwnd},
@@ -208,6 +209,7 @@ struct name_bind names[] = {
 	{"trim-line", trim},
 #endif
 	{"unbind-key", unbindkey},
+	{"undo", undo},
 	{"universal-argument", unarg},
 	{"unmark-buffer", unmark},
 	{"update-screen", upscreen},
@@ -216,6 +218,7 @@ struct name_bind names[] = {
 	{"write-file", filewrite},
 	{"write-message", writemsg},
 	{"yank", yank},
+	{"yank-pop", yankpop},
 
 	{"", NULL}
 };
@@ -1,8 +1,8 @@
 /*	posix.c
  *
  *      The functions in this file negotiate with the operating system for
- *      characters, and write characters in a barely buffered fashion on the
- *      display. All operating systems.
+ *      characters, and write characters on the display a whole screen update
+ *      at a time. All operating systems.
  *
  *	modified by Petri Kutvonen
  *
@@ -14,6 +14,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <termios.h>
@@ -37,8 +38,14 @@ static int kbdpoll;			/* in O_NDELAY mode             */
 static struct termios otermios;		/* original terminal characteristics */
 static struct termios ntermios;		/* charactoristics to use inside */
 
-#define TBUFSIZ 128
+/*
+ * Output to the terminal is collected here, and written out in one go
+ * when it is flushed at the end of a screen update; over a slow link, a
+ * redraw then goes out in as few packets as it fits in.
+ */
+#define TBUFSIZ 65536
 static char tobuf[TBUFSIZ];		/* terminal output buffer */
+static int tolen;			/* bytes in it */
 
 
 /*
@@ -74,12 +81,6 @@ void ttopen(void)
 	ntermios.c_cc[VTIME] = 0;
 	tcsetattr(0, TCSADRAIN, &ntermios);	/* and activate them */
 
-	/*
-	 * provide a smaller terminal output buffer so that
-	 * the type ahead detection works better (more often)
-	 */
-	setbuffer(stdout, &tobuf[0], TBUFSIZ);
-
 	kbdflgs = fcntl(0, F_GETFL, 0);
 	kbdpoll = FALSE;
 
@@ -100,18 +101,17 @@ void ttclose(void)
 }
 
 /*
- * Write a character to the display. On VMS, terminal output is buffered, and
- * we just put the characters in the big array, after checking for overflow.
- * On CPM terminal I/O unbuffered, so we just write the byte out. Ditto on
- * MS-DOS (use the very very raw console output routine).
+ * Write a character to the display. Terminal output is buffered, and we
+ * just put the characters in the big array, after checking for overflow.
  */
 int ttputc(int c)
 {
-	char utf8[6];
-	int bytes;
-
-	bytes = unicode_to_utf8(c, utf8);
-	fwrite(utf8, 1, bytes, stdout);
+	if (tolen > TBUFSIZ - 6)
+		ttflush();
+	if ((unsigned) c < 0x80)
+		tobuf[tolen++] = c;
+	else
+		tolen += unicode_to_utf8(c, &tobuf[tolen]);
 	return 0;
 }
 
@@ -132,17 +132,25 @@ void ttflush(void)
  * Jani Jaakkola suggested using select after EAGAIN but let's just wait a bit
  *
  */
-	int status;
-
-	status = fflush(stdout);
-	while (status < 0 && errno == EAGAIN) {
-		sleep(1);
-		status = fflush(stdout);
+	char *cp;
+	int n;
+
+	cp = tobuf;
+	while (tolen > 0) {
+		n = write(1, cp, tolen);
+		if (n > 0) {
+			cp += n;
+			tolen -= n;
+		} else if (n < 0 && errno == EAGAIN)
+			sleep(1);
+		else if (n >= 0 || errno != EINTR)
+			exit(15);
 	}
-	if (status < 0)
-		exit(15);
 }
 
+static char buffer[32];		/* Keys read but not yet taken */
+static int pending;			/* How many of them there are  */
+
 /*
  * Read a character from the terminal, performing no editing and doing no echo
  * at all. More complex in VMS that almost anyplace else, which figures. Very
@@ -150,8 +158,6 @@ void ttflush(void)
  */
 int ttgetc(void)
 {
-	static char buffer[32];
-	static int pending;
 	unicode_t c;
 	int count, bytes = 1, expected;
 
@@ -230,6 +236,8 @@ int typahead(void)
 {
 	int x;			/* holds # of pending chars */
 
+	if (pending > 0)
+		return pending;
 #ifdef FIONREAD
 	if (ioctl(0, FIONREAD, &x) < 0)
 		x = 0;
@@ -239,4 +247,19 @@ int typahead(void)
 	return x;
 }
 
+/*
+ * Wait up to "msec" milliseconds for a key to be typed. Return TRUE if one
+ * was.
+ */
+int ttwait(int msec)
+{
+	struct pollfd pfd;
+
+	if (pending > 0)
+		return TRUE;
+	pfd.fd = 0;
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, msec) > 0;
+}
+
 #endif				/* POSIX */
@@ -0,0 +1,258 @@
+/*	psearch.c
+ *
+ * Searching a big buffer in parallel.
+ *
+ * The lines still to be searched are split into as many runs as there are
+ * jobs, and each run is searched by a child process of its own. A child
+ * starts with a copy of the whole editor as it was when the search began,
+ * so the line pointers it finds are good in the parent too, and the
+ * compiled patterns and the DFA of the MAGIC matcher are its own to grow.
+ * It writes what it found down a pipe and goes away. The match in the run
+ * that comes first in the direction of the search wins, as soon as every
+ * run before it has come up empty; the others are killed. A key typed
+ * meanwhile stops the search.
+ *
+ * Buffers too small for this to pay, and systems without fork(), are
+ * searched a line at a time right here.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+#include "lindex.h"
+#include "psearch.h"
+
+#if	V7 | USG | BSD
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define	PSMIN	(16L * 1024 * 1024)	/* Bytes worth splitting up   */
+#define	NPJOB	64			/* Most jobs in one search    */
+#define	NPRES	256			/* Biggest result of lmatch   */
+
+/* A job: one run of lines, searched by a child */
+struct pjob {
+	int j_pid;		/* Process id, 0 when it is gone        */
+	int j_fd;		/* Read end of its pipe, -1 when done   */
+	int j_state;		/* PJRUN, PJFOUND or PJNONE             */
+	struct line *j_lp;	/* First line of the run, then match    */
+	long j_n;		/* Lines in the run                     */
+	char j_res[NPRES];	/* What lmatch found                    */
+};
+
+#define	PJRUN	0
+#define	PJFOUND	1
+#define	PJNONE	2
+
+static int pjobs(struct line **plp, long line, long count, int direct,
+		 int njobs, int (*lmatch)(struct line *, void *),
+		 void *res, int rsize);
+static void pkill(struct pjob *jp, int njobs);
+static int pdone(struct pjob *jp, int rsize);
+#endif
+
+/*
+ * Search the lines from "*plp" on; see psearch.h.
+ */
+int psearch(struct line **plp, int direct,
+	    int (*lmatch)(struct line *lp, void *res), void *res, int rsize)
+{
+	struct line *lp;
+#if	V7 | USG | BSD
+	long line, byte;
+	long lines, bytes;
+	long count;
+	int njobs;
+	int s;
+
+	njobs = srchjobs > 0 ? srchjobs
+	    : (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (njobs > NPJOB)
+		njobs = NPJOB;
+	if (njobs > 1 && rsize <= NPRES && *plp != curbp->b_linep) {
+		lindex_where(curbp, *plp, &line, &byte);
+		if (direct == FORWARD) {
+			lindex_total(curbp, &lines, &bytes);
+			count = lines - line;
+			bytes -= byte;
+		} else {
+			count = line + 1;
+			bytes = byte + llength(*plp) + 1;
+		}
+		if (njobs > count)
+			njobs = count;
+		if (bytes >= PSMIN && njobs > 1) {
+			s = pjobs(plp, line, count, direct, njobs,
+				  lmatch, res, rsize);
+			if (s != FIOERR)
+				return s;
+		}
+	}
+#endif
+
+	for (lp = *plp; lp != curbp->b_linep;
+	     lp = direct == FORWARD ? lforw(lp) : lback(lp))
+		if (lmatch(lp, res)) {
+			*plp = lp;
+			return TRUE;
+		}
+	return FALSE;
+}
+
+#if	V7 | USG | BSD
+/*
+ * Search the "count" lines from "*plp", which is line "line" of the
+ * buffer, with "njobs" children. Return FIOERR if they could not be set
+ * going, or one of them died without saying what it found.
+ */
+static int pjobs(struct line **plp, long line, long count, int direct,
+		 int njobs, int (*lmatch)(struct line *, void *),
+		 void *res, int rsize)
+{
+	struct pjob jobs[NPJOB];
+	struct pollfd fds[NPJOB];
+	struct pjob *jp;
+	struct line *lp;
+	long first, n;
+	int fd[2];
+	int nfds;
+	int i;
+	int s;
+
+	/* Split the lines up, in the order they are searched in */
+	first = 0;
+	for (i = 0; i < njobs; ++i) {
+		jp = &jobs[i];
+		jp->j_pid = 0;
+		jp->j_fd = -1;
+		jp->j_state = PJRUN;
+		jp->j_n = count * (i + 1) / njobs - first;
+		jp->j_lp = i == 0 ? *plp : lindex_line(curbp,
+		    direct == FORWARD ? line + first : line - first);
+		first += jp->j_n;
+	}
+
+	for (i = 0; i < njobs; ++i) {
+		jp = &jobs[i];
+		if (pipe(fd) < 0)
+			break;
+		if ((jp->j_pid = fork()) < 0) {
+			jp->j_pid = 0;
+			close(fd[0]);
+			close(fd[1]);
+			break;
+		}
+		if (jp->j_pid == 0) {	/* The child: search its run */
+			close(fd[0]);
+			lp = jp->j_lp;
+			for (n = jp->j_n; n > 0; --n) {
+				if (lmatch(lp, jp->j_res))
+					break;
+				lp = direct == FORWARD ? lforw(lp) : lback(lp);
+			}
+			jp->j_state = n > 0 ? PJFOUND : PJNONE;
+			jp->j_lp = lp;
+			s = write(fd[1], &jp->j_state, sizeof(jp->j_state))
+			    == sizeof(jp->j_state)
+			    && write(fd[1], &jp->j_lp, sizeof(jp->j_lp))
+			    == sizeof(jp->j_lp)
+			    && write(fd[1], jp->j_res, rsize) == rsize;
+			_exit(s ? 0 : 1);
+		}
+		close(fd[1]);
+		jp->j_fd = fd[0];
+	}
+	if (i < njobs) {
+		pkill(jobs, njobs);
+		return FIOERR;
+	}
+
+	for (;;) {
+		/* The first run with a match, or still going */
+		for (i = 0; i < njobs && jobs[i].j_state == PJNONE; ++i);
+		if (i == njobs) {
+			s = FALSE;
+			break;
+		}
+		if (jobs[i].j_state == PJFOUND) {
+			*plp = jobs[i].j_lp;
+			memcpy(res, jobs[i].j_res, rsize);
+			s = TRUE;
+			break;
+		}
+		if (clexec == FALSE && kbdmode != PLAY && typahead()) {
+			s = ABORT;
+			break;
+		}
+
+		nfds = 0;
+		for (i = 0; i < njobs; ++i)
+			if (jobs[i].j_fd >= 0) {
+				fds[nfds].fd = jobs[i].j_fd;
+				fds[nfds++].events = POLLIN;
+			}
+		if (poll(fds, nfds, 50) < 0 && errno != EINTR) {
+			s = FIOERR;
+			break;
+		}
+		for (i = 0; i < njobs; ++i)
+			if (jobs[i].j_fd >= 0 && pdone(&jobs[i], rsize) == FIOERR)
+				break;
+		if (i < njobs) {
+			s = FIOERR;
+			break;
+		}
+	}
+	pkill(jobs, njobs);
+	return s;
+}
+
+/*
+ * Read what job "jp" found, if it has said. Return FIOERR if it never
+ * will.
+ */
+static int pdone(struct pjob *jp, int rsize)
+{
+	struct pollfd pfd;
+	int s;
+
+	pfd.fd = jp->j_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) <= 0)
+		return FIOSUC;
+	s = read(jp->j_fd, &jp->j_state, sizeof(jp->j_state))
+	    == sizeof(jp->j_state)
+	    && read(jp->j_fd, &jp->j_lp, sizeof(jp->j_lp)) == sizeof(jp->j_lp)
+	    && read(jp->j_fd, jp->j_res, rsize) == rsize;
+	close(jp->j_fd);
+	jp->j_fd = -1;
+	if (!s || (jp->j_state != PJFOUND && jp->j_state != PJNONE))
+		return FIOERR;
+	return FIOSUC;
+}
+
+/*
+ * Stop the "njobs" jobs at "jp" that are still going, and clean up after
+ * all of them.
+ */
+static void pkill(struct pjob *jp, int njobs)
+{
+	int i;
+
+	for (i = 0; i < njobs; ++i, ++jp) {
+		if (jp->j_fd >= 0)
+			close(jp->j_fd);
+		if (jp->j_pid != 0) {
+			kill(jp->j_pid, SIGKILL);
+			while (waitpid(jp->j_pid, NULL, 0) < 0 && errno == EINTR);
+		}
+	}
+}
+#endif
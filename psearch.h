@@ -0,0 +1,15 @@
+#ifndef PSEARCH_H_
+#define PSEARCH_H_
+
+/*
+ * Searching the lines of a big buffer in parallel. "psearch" calls
+ * "lmatch" on each line from "*plp" on, in direction "direct", up to the
+ * end of the buffer, and stops at the first line it says has a match in
+ * it. It returns TRUE with that line in "*plp" and what "lmatch" put in
+ * the "rsize" bytes at "res", FALSE if no line matched, or ABORT if a key
+ * was typed before the search was over.
+ */
+int psearch(struct line **plp, int direct,
+	    int (*lmatch)(struct line *lp, void *res), void *res, int rsize);
+
+#endif  /* PSEARCH_H_ */
@@ -12,6 +12,8 @@
 #include "edef.h"
 #include "efunc.h"
 #include "line.h"
+#include "lindex.h"
+#include "undo.h"
 
 int tabsize; /* Tab size (0: use real tabs) */
 
@@ -34,49 +36,28 @@ int setfillcol(int f, int n)
  */
 int showcpos(int f, int n)
 {
-	struct line *lp;	/* current line */
 	long numchars;	/* # of chars in file */
-	int numlines;	/* # of lines in file */
+	long numlines;	/* # of lines in file */
 	long predchars;	/* # chars preceding point */
-	int predlines;	/* # lines preceding point */
+	long predlines;	/* # lines preceding point */
 	int curchar;	/* character under cursor */
 	int ratio;
 	int col;
 	int savepos;		/* temp save for current offset */
 	int ecol;		/* column pos/end of current line */
 
-	/* starting at the beginning of the buffer */
-	lp = lforw(curbp->b_linep);
+	/* count chars and lines, in total and in front of dot */
+	lindex_total(curbp, &numlines, &numchars);
+	lindex_where(curbp, curwp->w_dotp, &predlines, &predchars);
+	predchars += curwp->w_doto;
 
-	/* start counting chars and lines */
-	numchars = 0;
-	numlines = 0;
-	predchars = 0;
-	predlines = 0;
+	/* record the character under the cursor */
 	curchar = 0;
-	while (lp != curbp->b_linep) {
-		/* if we are on the current line, record it */
-		if (lp == curwp->w_dotp) {
-			predlines = numlines;
-			predchars = numchars + curwp->w_doto;
-			if ((curwp->w_doto) == llength(lp))
-				curchar = '\n';
-			else
-				curchar = lgetc(lp, curwp->w_doto);
-		}
-		/* on to the next line */
-		++numlines;
-		numchars += llength(lp) + 1;
-		lp = lforw(lp);
-	}
-
-	/* if at end of file, record it */
-	if (curwp->w_dotp == curbp->b_linep) {
-		predlines = numlines;
-		predchars = numchars;
-#if	PKCODE
-		curchar = 0;
-#endif
+	if (curwp->w_dotp != curbp->b_linep) {
+		if ((curwp->w_doto) == llength(curwp->w_dotp))
+			curchar = '\n';
+		else
+			curchar = lgetc(curwp->w_dotp, curwp->w_doto);
 	}
 
 	/* Get real column and end-of-line column. */
@@ -91,7 +72,7 @@ int showcpos(int f, int n)
 		ratio = (100L * predchars) / numchars;
 
 	/* summarize and report the info */
-	mlwrite("Line %d/%d Col %d/%d Char %D/%D (%d%%) char = 0x%x",
+	mlwrite("Line %D/%D Col %d/%d Char %D/%D (%d%%) char = 0x%x",
 		predlines + 1, numlines + 1, col, ecol,
 		predchars, numchars, ratio, curchar);
 	return TRUE;
@@ -99,23 +80,10 @@ int showcpos(int f, int n)
 
 int getcline(void)
 {				/* get the current line number */
-	struct line *lp;	/* current line */
-	int numlines;	/* # of lines before point */
-
-	/* starting at the beginning of the buffer */
-	lp = lforw(curbp->b_linep);
+	long numlines;	/* # of lines before point */
+	long numchars;	/* # of chars before point */
 
-	/* start counting lines */
-	numlines = 0;
-	while (lp != curbp->b_linep) {
-		/* if we are on the current line, record it */
-		if (lp == curwp->w_dotp)
-			break;
-		++numlines;
-		lp = lforw(lp);
-	}
-
-	/* and return the resulting count */
+	lindex_where(curbp, curwp->w_dotp, &numlines, &numchars);
 	return numlines + 1;
 }
 
@@ -202,8 +170,13 @@ int twiddle(int f, int n)
 	if (--doto < 0)
 		return FALSE;
 	cl = lgetc(dotp, doto);
+	undo_putc(dotp, doto + 0, cr);
 	lputc(dotp, doto + 0, cr);
+	undo_putc(dotp, doto + 1, cl);
 	lputc(dotp, doto + 1, cl);
+#if	COLOR
+	lindex_change(curbp, dotp);
+#endif
 	lchange(WFEDIT);
 	return TRUE;
 }
@@ -404,6 +377,10 @@ int trim(int f, int n)
 				break;
 			length--;
 		}
+		undo_record(lp, length, &lp->l_text[length],
+			    lp->l_used - length, NULL, 0);
+		lforget(lp);
+		lindex_resize(curbp, lp, length - lp->l_used);
 		lp->l_used = length;
 
 		/* advance/or back to the next line */
@@ -757,7 +734,7 @@ int forwdel(int f, int n)
 		return backdel(f, -n);
 	if (f != FALSE) {	/* Really a kill.       */
 		if ((lastflag & CFKILL) == 0)
-			kdelete();
+			kpush();
 		thisflag |= CFKILL;
 	}
 	return ldelchar((long) n, f);
@@ -779,7 +756,7 @@ int backdel(int f, int n)
 		return forwdel(f, -n);
 	if (f != FALSE) {	/* Really a kill.       */
 		if ((lastflag & CFKILL) == 0)
-			kdelete();
+			kpush();
 		thisflag |= CFKILL;
 	}
 	if ((s = backchar(f, n)) == TRUE)
@@ -802,8 +779,8 @@ int killtext(int f, int n)
 
 	if (curbp->b_mode & MDVIEW)	/* don't allow this command if      */
 		return rdonly();	/* we are in read only mode     */
-	if ((lastflag & CFKILL) == 0)	/* Clear kill buffer if */
-		kdelete();	/* last wasn't a kill.  */
+	if ((lastflag & CFKILL) == 0)	/* Start a new kill if  */
+		kpush();	/* last wasn't a kill.  */
 	thisflag |= CFKILL;
 	if (f == FALSE) {
 		chunk = llength(curwp->w_dotp) - curwp->w_doto;
@@ -1041,95 +1018,22 @@ int writemsg(int f, int n)
  */
 int getfence(int f, int n)
 {
-	struct line *oldlp;	/* original line pointer */
-	int oldoff;	/* and offset */
-	int sdir;	/* direction of search (1/-1) */
-	int count;	/* current fence level count */
-	char ch;	/* fence type to match against */
-	char ofence;	/* open fence */
-	char c;	/* current character in scan */
-
-	/* save the original cursor position */
-	oldlp = curwp->w_dotp;
-	oldoff = curwp->w_doto;
+	struct line *lp;	/* line of the match */
+	int off;	/* and offset */
 
-	/* get the current character */
-	if (oldoff == llength(oldlp))
-		ch = '\n';
-	else
-		ch = lgetc(oldlp, oldoff);
-
-	/* setup proper matching fence */
-	switch (ch) {
-	case '(':
-		ofence = ')';
-		sdir = FORWARD;
-		break;
-	case '{':
-		ofence = '}';
-		sdir = FORWARD;
-		break;
-	case '[':
-		ofence = ']';
-		sdir = FORWARD;
-		break;
-	case ')':
-		ofence = '(';
-		sdir = REVERSE;
-		break;
-	case '}':
-		ofence = '{';
-		sdir = REVERSE;
-		break;
-	case ']':
-		ofence = '[';
-		sdir = REVERSE;
-		break;
-	default:
+	/* find the match of the current character */
+	lp = curwp->w_dotp;
+	off = curwp->w_doto;
+	if (lindex_fence(curbp, &lp, &off) == FALSE || lp == NULL) {
 		TTbeep();
 		return FALSE;
 	}
 
-	/* set up for scan */
-	count = 1;
-	if (sdir == REVERSE)
-		backchar(FALSE, 1);
-	else
-		forwchar(FALSE, 1);
-
-	/* scan until we find it, or reach the end of file */
-	while (count > 0) {
-		if (curwp->w_doto == llength(curwp->w_dotp))
-			c = '\n';
-		else
-			c = lgetc(curwp->w_dotp, curwp->w_doto);
-		if (c == ch)
-			++count;
-		if (c == ofence)
-			--count;
-		if (sdir == FORWARD)
-			forwchar(FALSE, 1);
-		else
-			backchar(FALSE, 1);
-		if (boundry(curwp->w_dotp, curwp->w_doto, sdir))
-			break;
-	}
-
-	/* if count is zero, we have a match, move the sucker */
-	if (count == 0) {
-		if (sdir == FORWARD)
-			backchar(FALSE, 1);
-		else
-			forwchar(FALSE, 1);
-		curwp->w_flag |= WFMOVE;
-		return TRUE;
-	}
-
-	/* restore the current position */
-	curwp->w_dotp = oldlp;
-	curwp->w_doto = oldoff;
-	TTbeep();
-	return FALSE;
+	/* move the sucker */
+	curwp->w_dotp = lp;
+	curwp->w_doto = off;
+	curwp->w_flag |= WFMOVE;
+	return TRUE;
 }
 #endif
 
@@ -1143,56 +1047,37 @@ int fmatch(int ch)
 {
 	struct line *oldlp;	/* original line pointer */
 	int oldoff;	/* and offset */
-	struct line *toplp;	/* top line in current window */
-	int count;	/* current fence level count */
-	char opench;	/* open fence */
-	char c;	/* current character in scan */
+	struct line *lp;	/* line of the match */
+	int off;	/* and offset */
 	int i;
 
 	/* first get the display update out there */
 	update(FALSE);
 
+	/* find the match of the fence just typed */
+	lp = curwp->w_dotp;
+	off = curwp->w_doto - 1;
+	if (off < 0 || lgetc(lp, off) != ch ||
+	    lindex_fence(curbp, &lp, &off) == FALSE || lp == NULL)
+		return TRUE;
+
+	/* it is only shown if it is in the window */
+	oldlp = lp;
+	for (i = 0; oldlp != curwp->w_linep; oldlp = lback(oldlp))
+		if (oldlp == curbp->b_linep || ++i == curwp->w_ntrows)
+			return TRUE;
+
 	/* save the original cursor position */
 	oldlp = curwp->w_dotp;
 	oldoff = curwp->w_doto;
 
-	/* setup proper open fence for passed close fence */
-	if (ch == ')')
-		opench = '(';
-	else if (ch == '}')
-		opench = '{';
-	else
-		opench = '[';
-
-	/* find the top line and set up for scan */
-	toplp = curwp->w_linep->l_bp;
-	count = 1;
-	backchar(FALSE, 2);
-
-	/* scan back until we find it, or reach past the top of the window */
-	while (count > 0 && curwp->w_dotp != toplp) {
-		if (curwp->w_doto == llength(curwp->w_dotp))
-			c = '\n';
-		else
-			c = lgetc(curwp->w_dotp, curwp->w_doto);
-		if (c == ch)
-			++count;
-		if (c == opench)
-			--count;
-		backchar(FALSE, 1);
-		if (curwp->w_dotp == curwp->w_bufp->b_linep->l_fp &&
-		    curwp->w_doto == 0)
-			break;
-	}
-
-	/* if count is zero, we have a match, display the sucker */
+	/* display the sucker */
 	/* there is a real machine dependant timing problem here we have
 	   yet to solve......... */
-	if (count == 0) {
-		forwchar(FALSE, 1);
-		for (i = 0; i < term.t_pause; i++)
-			update(FALSE);
-	}
+	curwp->w_dotp = lp;
+	curwp->w_doto = off;
+	for (i = 0; i < term.t_pause; i++)
+		update(FALSE);
 
 	/* restore the current position */
 	curwp->w_dotp = oldlp;
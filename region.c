@@ -13,6 +13,7 @@
 #include "edef.h"
 #include "efunc.h"
 #include "line.h"
+#include "undo.h"
 
 /*
  * Kill the region. Ask "getregion"
@@ -30,7 +31,7 @@ int killregion(int f, int n)
 	if ((s = getregion(&region)) != TRUE)
 		return s;
 	if ((lastflag & CFKILL) == 0)	/* This is a kill type  */
-		kdelete();	/* command, so do magic */
+		kpush();	/* command, so do magic */
 	thisflag |= CFKILL;	/* kill buffer stuff.   */
 	curwp->w_dotp = region.r_linep;
 	curwp->w_doto = region.r_offset;
@@ -47,27 +48,26 @@ int copyregion(int f, int n)
 {
 	struct line *linep;
 	int loffs;
+	int chunk;
 	int s;
 	struct region region;
 
 	if ((s = getregion(&region)) != TRUE)
 		return s;
 	if ((lastflag & CFKILL) == 0)	/* Kill type command.   */
-		kdelete();
+		kpush();
 	thisflag |= CFKILL;
 	linep = region.r_linep;	/* Current line.        */
 	loffs = region.r_offset;	/* Current offset.      */
-	while (region.r_size--) {
-		if (loffs == llength(linep)) {	/* End of line.         */
-			if ((s = kinsert('\n')) != TRUE)
-				return s;
-			linep = lforw(linep);
-			loffs = 0;
-		} else {	/* Middle of line.      */
-			if ((s = kinsert(lgetc(linep, loffs))) != TRUE)
-				return s;
-			++loffs;
-		}
+	while (region.r_size > 0) {	/* Rest of the line,    */
+		chunk = llength(linep) - loffs + 1;	/* and newline */
+		if (chunk > region.r_size)
+			chunk = region.r_size;
+		if ((s = kinsline(linep, loffs, chunk)) != TRUE)
+			return s;
+		region.r_size -= chunk;
+		linep = lforw(linep);
+		loffs = 0;
 	}
 	mlwrite("(region copied)");
 	return TRUE;
@@ -102,8 +102,10 @@ int lowerregion(int f, int n)
 			loffs = 0;
 		} else {
 			c = lgetc(linep, loffs);
-			if (c >= 'A' && c <= 'Z')
+			if (c >= 'A' && c <= 'Z') {
+				undo_putc(linep, loffs, c + 'a' - 'A');
 				lputc(linep, loffs, c + 'a' - 'A');
+			}
 			++loffs;
 		}
 	}
@@ -139,8 +141,10 @@ int upperregion(int f, int n)
 			loffs = 0;
 		} else {
 			c = lgetc(linep, loffs);
-			if (c >= 'a' && c <= 'z')
+			if (c >= 'a' && c <= 'z') {
+				undo_putc(linep, loffs, c - 'a' + 'A');
 				lputc(linep, loffs, c - 'a' + 'A');
+			}
 			++loffs;
 		}
 	}
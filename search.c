@@ -58,11 +58,14 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "estruct.h"
 #include "edef.h"
 #include "efunc.h"
 #include "line.h"
+#include "mcmatch.h"
+#include "psearch.h"
 
 #if defined(MAGIC)
 /*
@@ -78,15 +81,21 @@ static struct magic tapcm[NPAT]; /* The reversed magic patterni. */
 static struct magic_replacement rmcpat[NPAT]; /* The replacement magic array. */
 #endif
 
-static int amatch(struct magic *mcptr, int direct, struct line **pcwline, int *pcwoff);
 static int readpattern(char *prompt, char *apat, int srch);
+static void litcompile(const char *patrn, int direct);
+static int litsame(const char *cp, const char *pp, int n);
+static int litfind(const char *cp, int from, int to);
+static int litrfind(const char *cp, int to);
+static int litlines(struct line *lp, struct line **plp, int *poff);
+static int litfwd(struct line *lp, void *poff);
+static int litrev(struct line *lp, void *poff);
 static int replaces(int kind, int f, int n);
+static int replaceline(int f, int n, int *pnummatch, int *pnumsub,
+		       int *pfound);
 static int nextch(struct line **pcurline, int *pcuroff, int dir);
 static int mcstr(void);
 static int rmcstr(void);
-static int mceq(int bc, struct magic *mt);
 static int cclmake(char **ppatptr, struct magic *mcptr);
-static int biteq(int bc, char *cclmap);
 static char *clearbits(void);
 static void setbit(int bc, char *cclmap);
 
@@ -123,14 +132,14 @@ int forwsearch(int f, int n)
 			else
 #endif
 				status = scanner(&pat[0], FORWARD, PTEND);
-		} while ((--n > 0) && status);
+		} while ((--n > 0) && status == TRUE);
 
 		/* Save away the match, or complain
 		 * if not there.
 		 */
 		if (status == TRUE)
 			savematch();
-		else
+		else if (status == FALSE)
 			mlwrite("Not found");
 	}
 	return status;
@@ -176,14 +185,14 @@ int forwhunt(int f, int n)
 		else
 #endif
 			status = scanner(&pat[0], FORWARD, PTEND);
-	} while ((--n > 0) && status);
+	} while ((--n > 0) && status == TRUE);
 
 	/* Save away the match, or complain
 	 * if not there.
 	 */
 	if (status == TRUE)
 		savematch();
-	else
+	else if (status == FALSE)
 		mlwrite("Not found");
 
 	return status;
@@ -224,14 +233,14 @@ int backsearch(int f, int n)
 			else
 #endif
 				status = scanner(&tap[0], REVERSE, PTBEG);
-		} while ((--n > 0) && status);
+		} while ((--n > 0) && status == TRUE);
 
 		/* Save away the match, or complain
 		 * if not there.
 		 */
 		if (status == TRUE)
 			savematch();
-		else
+		else if (status == FALSE)
 			mlwrite("Not found");
 	}
 	return status;
@@ -278,14 +287,14 @@ int backhunt(int f, int n)
 		else
 #endif
 			status = scanner(&tap[0], REVERSE, PTBEG);
-	} while ((--n > 0) && status);
+	} while ((--n > 0) && status == TRUE);
 
 	/* Save away the match, or complain
 	 * if not there.
 	 */
 	if (status == TRUE)
 		savematch();
-	else
+	else if (status == FALSE)
 		mlwrite("Not found");
 
 	return status;
@@ -303,8 +312,8 @@ int backhunt(int f, int n)
  */
 int mcscanner(struct magic *mcpatrn, int direct, int beg_or_end)
 {
-	struct line *curline;		/* current line during scan */
-	int curoff;		/* position within current line */
+	struct mcmres mr;
+	int s;
 
 	/* If we are going in reverse, then the 'end' is actually
 	 * the beginning of the pattern.  Toggle it.
@@ -319,190 +328,211 @@ int mcscanner(struct magic *mcpatrn, int direct, int beg_or_end)
 	 */
 	mlenold = matchlen;
 
-	/* Setup local scan pointers to global ".".
-	 */
-	curline = curwp->w_dotp;
-	curoff = curwp->w_doto;
+	if ((s = mcmatch(mcpatrn, direct, &mr)) != TRUE)
+		return s;	/* We could not find a match. */
 
-	/* Scan each character until we hit the head link record.
+	/* A SUCCESSFULL MATCH!!!
+	 * reset the global "." pointers.
 	 */
-	while (!boundry(curline, curoff, direct)) {
-		/* Save the current position in case we need to
-		 * restore it on a match, and initialize matchlen to
-		 * zero in case we are doing a search for replacement.
-		 */
-		matchline = curline;
-		matchoff = curoff;
-		matchlen = 0;
-
-		if (amatch(mcpatrn, direct, &curline, &curoff)) {
-			/* A SUCCESSFULL MATCH!!!
-			 * reset the global "." pointers.
-			 */
-			if (beg_or_end == PTEND) {	/* at end of string */
-				curwp->w_dotp = curline;
-				curwp->w_doto = curoff;
-			} else {	/* at beginning of string */
-
-				curwp->w_dotp = matchline;
-				curwp->w_doto = matchoff;
-			}
-
-			curwp->w_flag |= WFMOVE;	/* flag that we have moved */
-			return TRUE;
-		}
-
-		/* Advance the cursor.
-		 */
-		nextch(&curline, &curoff, direct);
+	matchline = mr.m_slp;
+	matchoff = mr.m_soff;
+	matchlen = mr.m_len;
+	if (beg_or_end == PTEND) {	/* at end of string */
+		curwp->w_dotp = mr.m_elp;
+		curwp->w_doto = mr.m_eoff;
+	} else {		/* at beginning of string */
+		curwp->w_dotp = mr.m_slp;
+		curwp->w_doto = mr.m_soff;
 	}
 
-	return FALSE;		/* We could not find a match. */
+	curwp->w_flag |= WFMOVE;	/* flag that we have moved */
+	return TRUE;
 }
+#endif
 
 /*
- * amatch -- Search for a meta-pattern in either direction.  Based on the
- *	recursive routine amatch() (for "anchored match") in
- *	Kernighan & Plauger's "Software Tools".
- *
- * struct magic *mcptr;		string to scan for
- * int direct;		which way to go.
- * struct line **pcwline;	current line during scan
- * int *pcwoff;		position within current line
+ * The literal search behind scanner(). The pattern is compiled once, into
+ * a copy that reads forward whichever way we go, with its case folded
+ * unless we are in EXACT mode, and into the shift tables of a
+ * Boyer-Moore-Horspool search each way. The text of each line is then
+ * searched in place; only a pattern with a newline in it is matched across
+ * lines, and then it can only start at one place in each line.
+ */
+static char lkey[NPAT];		/* the pattern, reading forward */
+static char lpat[NPAT];		/* ... with its case folded */
+static int llen;		/* its length */
+static int lnl;			/* does it have a newline in it? */
+static int lexact;		/* was it compiled in EXACT mode? */
+static unsigned char lfold[256];	/* case folding of a byte */
+static int lskip[256];		/* shift forward on the last byte */
+static int lrskip[256];		/* shift backward on the first byte */
+
+/*
+ * litcompile -- Make ready to search for "patrn", which is reversed if
+ *	we are going in reverse. Nothing to do if it is the last one.
  */
-static int amatch(struct magic *mcptr, int direct, struct line **pcwline, int *pcwoff)
+static void litcompile(const char *patrn, int direct)
 {
-	int c;		/* character at current position */
-	struct line *curline;		/* current line during scan */
-	int curoff;		/* position within current line */
-	int nchars;
+	char fpat[NPAT];
+	int exact;
+	int c;
+	int i;
 
-	/* Set up local scan pointers to ".", and get
-	 * the current character.  Then loop around
-	 * the pattern pointer until success or failure.
-	 */
-	curline = *pcwline;
-	curoff = *pcwoff;
-
-	/* The beginning-of-line and end-of-line metacharacters
-	 * do not compare against characters, they compare
-	 * against positions.
-	 * BOL is guaranteed to be at the start of the pattern
-	 * for forward searches, and at the end of the pattern
-	 * for reverse searches.  The reverse is true for EOL.
-	 * So, for a start, we check for them on entry.
-	 */
-	if (mcptr->mc_type == BOL) {
-		if (curoff != 0)
-			return FALSE;
-		mcptr++;
+	exact = (curwp->w_bufp->b_mode & MDEXACT) != 0;
+	if (direct == REVERSE)
+		rvstrcpy(fpat, (char *) patrn);
+	else
+		strcpy(fpat, patrn);
+	if (llen != 0 && exact == lexact && strcmp(fpat, lkey) == 0)
+		return;
+	strcpy(lkey, fpat);
+
+	for (c = 0; c < 256; ++c)
+		lfold[c] = (!exact && islower(c)) ? c ^ DIFCASE : c;
+	llen = strlen(fpat);
+	lnl = FALSE;
+	for (i = 0; i < llen; ++i) {
+		lpat[i] = lfold[fpat[i] & 0xFF];
+		if (lpat[i] == '\n')
+			lnl = TRUE;
 	}
+	lpat[llen] = '\0';
+	lexact = exact;
 
-	if (mcptr->mc_type == EOL) {
-		if (curoff != llength(curline))
-			return FALSE;
-		mcptr++;
+	for (c = 0; c < 256; ++c) {
+		lskip[c] = llen;
+		lrskip[c] = llen;
 	}
+	for (i = 0; i < llen - 1; ++i)
+		lskip[lpat[i] & 0xFF] = llen - 1 - i;
+	for (i = llen - 1; i > 0; --i)
+		lrskip[lpat[i] & 0xFF] = i;
+}
 
-	while (mcptr->mc_type != MCNIL) {
-		c = nextch(&curline, &curoff, direct);
+/*
+ * litsame -- Does the text at "cp" match the "n" bytes of the pattern
+ *	at "pp"?
+ */
+static int litsame(const char *cp, const char *pp, int n)
+{
+	if (lexact)
+		return memcmp(cp, pp, n) == 0;
+	while (n-- > 0)
+		if (lfold[*cp++ & 0xFF] != (*pp++ & 0xFF))
+			return FALSE;
+	return TRUE;
+}
 
-		if (mcptr->mc_type & CLOSURE) {
-			/* Try to match as many characters as possible
-			 * against the current meta-character.  A
-			 * newline never matches a closure.
-			 */
-			nchars = 0;
-			while (c != '\n' && mceq(c, mcptr)) {
-				c = nextch(&curline, &curoff, direct);
-				nchars++;
-			}
+/*
+ * litfind -- Find the first place from "from" on where the pattern is
+ *	in the "to" bytes of text "cp". Return -1 if it is not there.
+ */
+static int litfind(const char *cp, int from, int to)
+{
+	const char *p;
+	int last;
+	int c;
+	int i;
 
-			/* We are now at the character that made us
-			 * fail.  Try to match the rest of the pattern.
-			 * Shrink the closure by one for each failure.
-			 * Since closure matches *zero* or more occurences
-			 * of a pattern, a match may start even if the
-			 * previous loop matched no characters.
-			 */
-			mcptr++;
+	if (to - from < llen)
+		return -1;
+
+	/* short exact patterns: memchr() is quicker than any shift */
+	if (lexact && llen <= 2) {
+		while ((p = memchr(cp + from, lpat[0], to - llen + 1 - from))
+		       != NULL) {
+			from = p - cp;
+			if (llen == 1 || cp[from + 1] == lpat[1])
+				return from;
+			++from;
+		}
+		return -1;
+	}
 
-			for (;;) {
-				c = nextch(&curline, &curoff,
-					   direct ^ REVERSE);
+	last = lpat[llen - 1] & 0xFF;
+	for (i = from; i <= to - llen; i += lskip[c]) {
+		c = lfold[cp[i + llen - 1] & 0xFF];
+		if (c == last && litsame(cp + i, lpat, llen - 1))
+			return i;
+	}
+	return -1;
+}
 
-				if (amatch
-				    (mcptr, direct, &curline, &curoff)) {
-					matchlen += nchars;
-					goto success;
-				}
+/*
+ * litrfind -- Find the last place where the pattern is in the "to" bytes
+ *	of text "cp". Return -1 if it is not there.
+ */
+static int litrfind(const char *cp, int to)
+{
+	int first;
+	int c;
+	int i;
 
-				if (nchars-- == 0)
-					return FALSE;
-			}
-		} else {	/* Not closure. */
-
-			/* The only way we'd get a BOL metacharacter
-			 * at this point is at the end of the reversed pattern.
-			 * The only way we'd get an EOL metacharacter
-			 * here is at the end of a regular pattern.
-			 * So if we match one or the other, and are at
-			 * the appropriate position, we are guaranteed success
-			 * (since the next pattern character has to be MCNIL).
-			 * Before we report success, however, we back up by
-			 * one character, so as to leave the cursor in the
-			 * correct position.  For example, a search for ")$"
-			 * will leave the cursor at the end of the line, while
-			 * a search for ")<NL>" will leave the cursor at the
-			 * beginning of the next line.  This follows the
-			 * notion that the meta-character '$' (and likewise
-			 * '^') match positions, not characters.
-			 */
-			if (mcptr->mc_type == BOL) {
-				if (curoff == llength(curline)) {
-					c = nextch(&curline, &curoff,
-						   direct ^ REVERSE);
-					goto success;
-				} else
-					return FALSE;
-			}
+	first = lpat[0] & 0xFF;
+	for (i = to - llen; i >= 0; i -= lrskip[c]) {
+		c = lfold[cp[i] & 0xFF];
+		if (c == first && litsame(cp + i + 1, lpat + 1, llen - 1))
+			return i;
+	}
+	return -1;
+}
 
-			if (mcptr->mc_type == EOL) {
-				if (curoff == 0) {
-					c = nextch(&curline, &curoff,
-						   direct ^ REVERSE);
-					goto success;
-				} else
-					return FALSE;
-			}
+/*
+ * litlines -- Match a pattern with newlines in it, starting in line "lp"
+ *	with as much of the pattern as comes before the first newline, at
+ *	the end of the line. If it matches, set "*plp" and "*poff" to the
+ *	end of the match.
+ */
+static int litlines(struct line *lp, struct line **plp, int *poff)
+{
+	const char *pp;
+	const char *nl;
+	int n;
+
+	pp = lpat;
+	nl = strchr(pp, '\n');
+	n = nl - pp;
+	if (llength(lp) < n || !litsame(lp->l_text + llength(lp) - n, pp, n))
+		return FALSE;
 
-			/* Neither BOL nor EOL, so go through
-			 * the meta-character equal function.
-			 */
-			if (!mceq(c, mcptr))
+	while (nl != NULL) {
+		if (lp == curbp->b_linep)	/* no wrapping around */
+			return FALSE;
+		lp = lforw(lp);
+		pp = nl + 1;
+		if ((nl = strchr(pp, '\n')) != NULL) {	/* a whole line */
+			n = nl - pp;
+			if (llength(lp) != n)
+				return FALSE;
+		} else {	/* the start of a line */
+			n = strlen(pp);
+			if (llength(lp) < n)
 				return FALSE;
 		}
+		if (!litsame(lp->l_text, pp, n))
+			return FALSE;
+	}
+	*plp = lp;
+	*poff = n;
+	return TRUE;
+}
 
-		/* Increment the length counter and
-		 * advance the pattern pointer.
-		 */
-		matchlen++;
-		mcptr++;
-	}			/* End of mcptr loop. */
-
-	/* A SUCCESSFULL MATCH!!!
-	 * Reset the "." pointers.
-	 */
-      success:
-	*pcwline = curline;
-	*pcwoff = curoff;
+/*
+ * litfwd, litrev -- Find the first or the last place where the pattern
+ *	is in line "lp", for psearch(), and put it in "*poff".
+ */
+static int litfwd(struct line *lp, void *poff)
+{
+	return (*(int *) poff = litfind(lp->l_text, 0, llength(lp))) >= 0;
+}
 
-	return TRUE;
+static int litrev(struct line *lp, void *poff)
+{
+	return (*(int *) poff = litrfind(lp->l_text, llength(lp))) >= 0;
 }
-#endif
 
 /*
- * scanner -- Search for a pattern in either direction.  If found,
+ * scanner --Search for a pattern in either direction.  If found,
  *	reset the "." to be at the start or just after the match string,
  *	and (perhaps) repaint the display.
  *
@@ -512,73 +542,109 @@ static int amatch(struct magic *mcptr, int direct, struct line **pcwline, int *p
  */
 int scanner(const char *patrn, int direct, int beg_or_end)
 {
-	int c;		/* character at current position */
-	const char *patptr;	/* pointer into pattern */
 	struct line *curline;		/* current line during scan */
 	int curoff;		/* position within current line */
-	struct line *scanline;		/* current line during scanning */
-	int scanoff;		/* position in scanned line */
+	struct line *begline;		/* start of the match */
+	int begoff;
+	struct line *endline;		/* end of the match */
+	int endoff;
+	struct line *lp;
+	int n;
+	int s;
 
 	/* If we are going in reverse, then the 'end' is actually
 	 * the beginning of the pattern.  Toggle it.
 	 */
 	beg_or_end ^= direct;
 
+	litcompile(patrn, direct);
+	if (llen == 0)
+		return FALSE;
+
 	/* Set up local pointers to global ".".
 	 */
 	curline = curwp->w_dotp;
 	curoff = curwp->w_doto;
 
-	/* Scan each character until we hit the head link record.
-	 */
-	while (!boundry(curline, curoff, direct)) {
-		/* Save the current position in case we match
-		 * the search string at this point.
-		 */
-		matchline = curline;
-		matchoff = curoff;
-
-		/* Get the character resolving newlines, and
-		 * test it against first char in pattern.
-		 */
-		c = nextch(&curline, &curoff, direct);
-
-		if (eq(c, patrn[0])) {	/* if we find it.. */
-			/* Setup scanning pointers.
-			 */
-			scanline = curline;
-			scanoff = curoff;
-			patptr = &patrn[0];
-
-			/* Scan through the pattern for a match.
-			 */
-			while (*++patptr != '\0') {
-				c = nextch(&scanline, &scanoff, direct);
-
-				if (!eq(c, *patptr))
-					goto fail;
-			}
-
-			/* A SUCCESSFULL MATCH!!!
-			 * reset the global "." pointers
-			 */
-			if (beg_or_end == PTEND) {	/* at end of string */
-				curwp->w_dotp = scanline;
-				curwp->w_doto = scanoff;
-			} else {	/* at beginning of string */
-
-				curwp->w_dotp = matchline;
-				curwp->w_doto = matchoff;
+	if (direct == FORWARD && !lnl) {
+		if (curline == curbp->b_linep)
+			return FALSE;
+		n = litfind(curline->l_text, curoff, llength(curline));
+		if (n < 0) {
+			curline = lforw(curline);
+			if ((s = psearch(&curline, FORWARD, litfwd, &n,
+					 sizeof(n))) != TRUE)
+				return s;
+		}
+		begline = endline = curline;
+		begoff = n;
+		endoff = n + llen;
+		goto success;
+	} else if (direct == FORWARD) {
+		for (; curline != curbp->b_linep; curline = lforw(curline)) {
+			n = llength(curline) - (strchr(lpat, '\n') - lpat);
+			if (n >= curoff && litlines(curline, &endline, &endoff)
+			    && (n < llength(curline)
+				|| lforw(curline) != curbp->b_linep)) {
+				begline = curline;
+				begoff = n;
+				goto success;
 			}
-
-			curwp->w_flag |= WFMOVE;	/* Flag that we have moved. */
-			return TRUE;
-
+			curoff = 0;
+		}
+	} else if (!lnl) {
+		if (curline == curbp->b_linep
+		    || (n = litrfind(curline->l_text, curoff)) < 0) {
+			if ((curline = lback(curline)) == curbp->b_linep)
+				return FALSE;
+			if ((s = psearch(&curline, REVERSE, litrev, &n,
+					 sizeof(n))) != TRUE)
+				return s;
 		}
-	      fail:;		/* continue to search */
+		begline = endline = curline;
+		begoff = n;
+		endoff = n + llen;
+		goto success;
+	} else {
+		/* Go back to the first line that a match ending at "."
+		 * could start in, and on from there.
+		 */
+		lp = curline;
+		for (n = 0; lpat[n] != '\0'; ++n)
+			if (lpat[n] == '\n'
+			    && (lp = lback(lp)) == curbp->b_linep)
+				return FALSE;
+		for (; lp != curbp->b_linep; lp = lback(lp))
+			if (litlines(lp, &endline, &endoff)
+			    && (endline != curline || endoff <= curoff)) {
+				begline = lp;
+				begoff = llength(lp) - (strchr(lpat, '\n') - lpat);
+				goto success;
+			}
 	}
-
 	return FALSE;		/* We could not find a match */
+
+      success:
+	/* A SUCCESSFULL MATCH!!!
+	 * reset the global "." pointers
+	 */
+	if (direct == FORWARD) {
+		matchline = begline;
+		matchoff = begoff;
+	} else {
+		matchline = endline;
+		matchoff = endoff;
+		beg_or_end ^= 1;
+	}
+	if (beg_or_end == PTEND) {	/* at end of string */
+		curwp->w_dotp = endline;
+		curwp->w_doto = endoff;
+	} else {		/* at beginning of string */
+		curwp->w_dotp = begline;
+		curwp->w_doto = begoff;
+	}
+	curwp->w_flag |= WFMOVE;	/* Flag that we have moved. */
+	return TRUE;
 }
 
 /*
@@ -738,6 +804,7 @@ static int replaces(int kind, int f, int n)
 	int origoff;		/* and offset (for . query option) */
 	struct line *lastline;		/* position of last replace and */
 	int lastoff;		/* offset (for 'u' query option) */
+	int found;		/* already found the next match? */
 
 	if (curbp->b_mode & MDVIEW)	/* don't allow this command if      */
 		return rdonly();	/* we are in read only mode     */
@@ -792,6 +859,7 @@ static int replaces(int kind, int f, int n)
 	origoff = curwp->w_doto;
 	numsub = 0;
 	nummatch = 0;
+	found = FALSE;
 
 	while ((f == FALSE || n > nummatch) &&
 	       (nlflag == FALSE || nlrepl == FALSE)) {
@@ -800,13 +868,16 @@ static int replaces(int kind, int f, int n)
 		 * matchlen is reset to the true length of
 		 * the matched string.
 		 */
+		if (found)
+			found = FALSE;
+		else
 #if	MAGIC
 		if ((magical && curwp->w_bufp->b_mode & MDMAGIC) != 0) {
-			if (!mcscanner(&mcpat[0], FORWARD, PTBEG))
+			if (mcscanner(&mcpat[0], FORWARD, PTBEG) != TRUE)
 				break;
 		} else
 #endif
-		if (!scanner(&pat[0], FORWARD, PTBEG))
+		if (scanner(&pat[0], FORWARD, PTBEG) != TRUE)
 			break;	/* all done */
 
 		++nummatch;	/* Increment # of matches */
@@ -815,6 +886,20 @@ static int replaces(int kind, int f, int n)
 		 */
 		nlrepl = (lforw(curwp->w_dotp) == curwp->w_bufp->b_linep);
 
+		/* Without a query, a match within a line is replaced
+		 * together with the rest of the matches in the line.
+		 */
+		if (!kind && matchlen > 0 && strchr(rpat, '\n') == NULL
+		    && matchoff + matchlen <= llength(matchline)) {
+			status = replaceline(f, n, &nummatch, &numsub,
+					     &found);
+			if (status == ABORT)
+				break;
+			if (status != TRUE)
+				return status;
+			continue;
+		}
+
 		/* Check for query.
 		 */
 		if (kind) {
@@ -910,6 +995,9 @@ static int replaces(int kind, int f, int n)
 		}
 
 		/* end of "if kind" */
+		if (!kind)
+			savematch();	/* for any '&' in the replacement */
+
 		/*
 		 * Delete the sucker, and insert its
 		 * replacement.
@@ -935,6 +1023,143 @@ static int replaces(int kind, int f, int n)
 	return TRUE;
 }
 
+/*
+ * replaceline -- Replace the match at "." and the matches after it in the
+ *	same line, up to "n" matches in all if "f" is set, and put the new
+ *	text in the line at once. Count them in "*pnummatch" and
+ *	"*pnumsub". If the search for the next one found a match that is
+ *	not for here, leave "." at it and set "*pfound"; otherwise leave
+ *	"." just after the last replacement.
+ */
+static int replaceline(int f, int n, int *pnummatch, int *pnumsub,
+		       int *pfound)
+{
+	static char *rtext;		/* the new text */
+	static int rtextsize;
+	static struct lsplice *rsplice;	/* the pieces replaced */
+	static int rsplicesize;
+	struct line *lp;
+	char *cp;
+	int nsp;	/* number of pieces */
+	int used;	/* bytes of new text so far */
+	int off;	/* bytes of old text done with */
+	int len;	/* length of this replacement */
+	int status;
+#if	MAGIC
+	struct magic_replacement *rmcptr;
+	int rmeta;
+#endif
+
+#if	MAGIC
+	rmeta = rmagical && (curwp->w_bufp->b_mode & MDMAGIC) != 0;
+#endif
+	lp = matchline;
+	nsp = 0;
+	used = 0;
+	off = 0;
+	status = TRUE;
+	*pfound = FALSE;
+	for (;;) {
+		savematch();	/* for $match */
+		len = strlen(rpat);
+#if	MAGIC
+		if (rmeta)
+			for (len = 0, rmcptr = &rmcpat[0];
+			     rmcptr->mc_type != MCNIL; rmcptr++)
+				len += rmcptr->mc_type == LITCHAR
+				    ? (int) strlen(rmcptr->rstr) : matchlen;
+#endif
+		if (used + matchoff - off + len > rtextsize) {
+			rtextsize = 2 * (used + matchoff - off + len) + NPAT;
+			if ((cp = realloc(rtext, rtextsize)) == NULL) {
+				rtextsize = 0;
+				mlwrite("%%Out of memory while inserting");
+				return FALSE;
+			}
+			rtext = cp;
+		}
+		if (nsp == rsplicesize) {
+			rsplicesize = 2 * rsplicesize + 16;
+			rsplice = realloc(rsplice,
+					  rsplicesize * sizeof(*rsplice));
+			if (rsplice == NULL) {
+				rsplicesize = 0;
+				mlwrite("%%Out of memory while inserting");
+				return FALSE;
+			}
+		}
+
+		memcpy(&rtext[used], &lp->l_text[off], matchoff - off);
+		used += matchoff - off;
+#if	MAGIC
+		if (rmeta)
+			for (rmcptr = &rmcpat[0]; rmcptr->mc_type != MCNIL;
+			     rmcptr++)
+				if (rmcptr->mc_type == LITCHAR) {
+					strcpy(&rtext[used], rmcptr->rstr);
+					used += strlen(rmcptr->rstr);
+				} else {
+					memcpy(&rtext[used],
+					       &lp->l_text[matchoff], matchlen);
+					used += matchlen;
+				}
+		else
+#endif
+		{
+			memcpy(&rtext[used], rpat, len);
+			used += len;
+		}
+		rsplice[nsp].s_off = matchoff;
+		rsplice[nsp].s_del = matchlen;
+		rsplice[nsp].s_ins = len;
+		++nsp;
+		off = matchoff + matchlen;
+		++*pnumsub;
+
+		/* Look for the next one, from just after this one.
+		 */
+		curwp->w_dotp = lp;
+		curwp->w_doto = off;
+		if (f != FALSE && n <= *pnummatch)
+			break;
+		if (used == 0)	/* at the start of the line again */
+			break;
+#if	MAGIC
+		if ((magical && curwp->w_bufp->b_mode & MDMAGIC) != 0)
+			status = mcscanner(&mcpat[0], FORWARD, PTBEG);
+		else
+#endif
+			status = scanner(&pat[0], FORWARD, PTBEG);
+		if (status != TRUE)
+			break;
+		if (matchline != lp || matchlen == 0
+		    || matchoff + matchlen > llength(lp)) {
+			*pfound = TRUE;
+			break;
+		}
+		++*pnummatch;
+	}
+
+	if (used + llength(lp) - off > rtextsize) {
+		rtextsize = used + llength(lp) - off;
+		if ((cp = realloc(rtext, rtextsize)) == NULL) {
+			rtextsize = 0;
+			mlwrite("%%Out of memory while inserting");
+			return FALSE;
+		}
+		rtext = cp;
+	}
+	memcpy(&rtext[used], &lp->l_text[off], llength(lp) - off);
+	used += llength(lp) - off;
+	if (lreplace(lp, rtext, used, rsplice, nsp) != TRUE)
+		return FALSE;
+	if (*pfound) {
+		matchline = curwp->w_dotp;
+		matchoff = curwp->w_doto;
+	}
+	return status == ABORT ? ABORT : TRUE;
+}
+
 /*
  * delins -- Delete a specified length from the current point
  *	then either insert the string directly, or make use of
@@ -1111,6 +1336,7 @@ static int mcstr(void)
 	 */
 	if (magical)
 		mcclear();
+	mcmforget();
 
 	magical = FALSE;
 	mj = 0;
@@ -1243,6 +1469,7 @@ static int rmcstr(void)
 					break;
 				}
 				strncpy(rmcptr->rstr, patptr - mj, mj);
+				rmcptr->rstr[mj] = '\0';
 				rmcptr++;
 				mj = 0;
 			}
@@ -1265,6 +1492,7 @@ static int rmcstr(void)
 			}
 
 			strncpy(rmcptr->rstr, patptr - mj, mj + 1);
+			rmcptr->rstr[mj + 1] = '\0';
 
 			/* If MC_ESC is not the last character
 			 * in the string, find out what it is
@@ -1292,6 +1520,7 @@ static int rmcstr(void)
 			status = FALSE;
 		}
 		strncpy(rmcptr->rstr, patptr - mj, mj);
+		rmcptr->rstr[mj] = '\0';
 		rmcptr++;
 	}
 
@@ -1315,6 +1544,7 @@ void mcclear(void)
 		mcptr++;
 	}
 	mcpat[0].mc_type = tapcm[0].mc_type = MCNIL;
+	mcmforget();
 }
 
 /*
@@ -1335,55 +1565,6 @@ void rmcclear(void)
 	rmcpat[0].mc_type = MCNIL;
 }
 
-/*
- * mceq -- meta-character equality with a character.  In Kernighan & Plauger's
- *	Software Tools, this is the function omatch(), but i felt there
- *	were too many functions with the 'match' name already.
- */
-static int mceq(int bc, struct magic *mt)
-{
-	int result;
-
-#if	PKCODE
-	bc = bc & 0xFF;
-#endif
-	switch (mt->mc_type & MASKCL) {
-	case LITCHAR:
-		result = eq(bc, mt->u.lchar);
-		break;
-
-	case ANY:
-		result = (bc != '\n');
-		break;
-
-	case CCL:
-		if (!(result = biteq(bc, mt->u.cclmap))) {
-			if ((curwp->w_bufp->b_mode & MDEXACT) == 0 &&
-			    (isletter(bc))) {
-				result = biteq(CHCASE(bc), mt->u.cclmap);
-			}
-		}
-		break;
-
-	case NCCL:
-		result = !biteq(bc, mt->u.cclmap);
-
-		if ((curwp->w_bufp->b_mode & MDEXACT) == 0 &&
-		    (isletter(bc))) {
-			result &= !biteq(CHCASE(bc), mt->u.cclmap);
-		}
-		break;
-
-	default:
-		mlwrite("mceq: what is %d?", mt->mc_type);
-		result = FALSE;
-		break;
-
-	}			/* End of switch. */
-
-	return result;
-}
-
 extern char *clearbits(void);
 
 /*
@@ -1466,20 +1647,6 @@ static int cclmake(char **ppatptr, struct magic *mcptr)
 	return TRUE;
 }
 
-/*
- * biteq -- is the character in the bitmap?
- */
-static int biteq(int bc, char *cclmap)
-{
-#if	PKCODE
-	bc = bc & 0xFF;
-#endif
-	if (bc >= HICHAR)
-		return FALSE;
-
-	return (*(cclmap + (bc >> 3)) & BIT(bc & 7)) ? TRUE : FALSE;
-}
-
 /*
  * clearbits -- Allocate and zero out a CCL bitmap.
  */
@@ -11,6 +11,7 @@
 #include "estruct.h"
 #include "edef.h"
 #include "efunc.h"
+#include "undo.h"
 
 #if     VMS
 #define EFN     0		/* Event flag.          */
@@ -455,8 +456,15 @@ int filter_buffer(int f, int n)
 	s = TRUE;
 #endif
 
+	/* read the output in, keeping what it takes the place of to undo */
+	if (s == TRUE) {
+		undo_keep(bp, TRUE);
+		s = readin(filnam2, FALSE);
+		undo_keep(bp, FALSE);
+	}
+
 	/* on failure, escape gracefully */
-	if (s != TRUE || (readin(filnam2, FALSE) == FALSE)) {
+	if (s != TRUE) {
 		mlwrite("(Execution failed)");
 		strcpy(bp->b_fname, tmpnam);
 		unlink(filnam1);
@@ -1,6 +1,22 @@
 /*	syntax.c
  *
  *	The functions in this file handle syntax highlight.
+ *
+ * The languages are described in a syntax file (see "emacs.syn"), read at
+ * startup from wherever the startup file would be looked for; C is built
+ * in, for C mode, in case there is none. Each description is compiled into
+ * the table of a small state machine. The characters are sorted into
+ * classes that the description cannot tell apart, and for each state and
+ * class the table holds the next state and what is to be painted, so the
+ * work for a character on the screen is a lookup, whatever the language.
+ *
+ * The states are the plain text, a word, a number, a comment to the end of
+ * the line, each kind of comment that runs over lines, each kind of string
+ * and the character after its escape, and one for each part of a comment
+ * or string delimiter seen so far. A word is looked up in the keywords of
+ * the language once it is over. Only the comments that run over lines go
+ * on to the next line; the state a line starts in ("hi_mcomment") is 0, or
+ * the state of the comment it starts inside.
  */
 
 #include "estruct.h"
@@ -10,181 +26,287 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include "edef.h"
+#include "efunc.h"
+#include "epath.h"
 #include "util.h"
+#include "utf8.h"
 #include "hashtab.h"
+#include "line.h"
+#include "arena.h"
 #include "syntax.h"
 
-#define IDX_MACRO		0
-#define IDX_PREPROC_IF		1
-#define IDX_PREPROC_ELSE	2
-#define IDX_TYPE		3
-#define IDX_CONSTANT		4
-#define IDX_STRUCT		5
-#define IDX_STORAGE		6
-#define IDX_STATE		7
-#define IDX_LABEL		8
-#define IDX_COND		9
-#define IDX_REPEAT		10
-#define IDX_OPERATOR		11
-
-#define SYNLEN	20
+#define	NSYNNAME	16	/* Longest language or file name end */
+#define	NSYNDLEN	4	/* Longest delimiter, and its 0 */
+#define	NSYNDEL		8	/* Most delimiters of a kind */
+#define	NSYNFILE	8	/* Most file name ends of a language */
+#define	NSYNWORD	32	/* Most words on a line of the syntax file */
+#define	NSYNSTATE	255	/* Most states of a table */
+#define	NSYNCHAR	129	/* Characters with a class, all from 128 as one */
+
+#define SYNLEN	31
 static char synbuf[SYNLEN + 1];
 
-typedef struct color_S
-{
-	int fcolor;
-	int bcolor;
-} color_T;
+/* The fixed states; the comments, strings and delimiters come after */
+#define	S_NORMAL	0	/* plain text */
+#define	S_WORD		1	/* a word */
+#define	S_NUMBER	2	/* a number */
+#define	S_LINE		3	/* a comment to the end of the line */
+#define	S_BLOCK		4	/* the first comment that runs over lines */
+
+/*
+ * What a table entry does, besides moving to its state; from A_RETRY on,
+ * the character is then looked up again in the new state.
+ */
+#define	A_SET		0	/* nothing */
+#define	A_MOVE		1	/* paint the character in the new state */
+#define	A_START		2	/* the same, and a word or delimiter starts */
+#define	A_OPEN		3	/* paint the delimiter in the new state */
+#define	A_CLOSE		4	/* paint the character in the old state */
+#define	A_ERR1		5	/* paint the character as an error */
+#define	A_ERROR		6	/* paint the delimiter as an error */
+#define	A_PRE		7	/* may start a preprocessor line */
+#define	A_RETRY		8
+#define	A_WORD		8	/* a word is over */
+#define	A_NUMBER	9	/* a number is over */
+#define	A_FAIL		10	/* not a delimiter after all */
+#define	A_AOPEN		11	/* A_OPEN, of a delimiter already over */
+#define	A_AERROR	12	/* A_ERROR, the same */
+
+#define	SYNENT(state, act)	((unsigned short) ((state) | (act) << 8))
+
+/* Kinds of delimiters */
+#define	TK_OPEN		0	/* opens a comment or string */
+#define	TK_CLOSE	1	/* closes a comment */
+#define	TK_ERROR	2	/* is out of place */
+
+/*
+ * A language. The first part is what the syntax file says, the rest is
+ * the table made from it.
+ */
+struct synlang {
+	struct synlang *l_next;	/* next language               */
+	char l_name[NSYNNAME];	/* its name                    */
+	char l_files[NSYNFILE][NSYNNAME];	/* files it is for     */
+	int l_nfiles;
+	int l_id;		/* number, for saved colours   */
+	char l_line[NSYNDEL][NSYNDLEN];	/* comments to end of line */
+	int l_nline;
+	char l_open[NSYNDEL][NSYNDLEN];	/* comments over lines     */
+	char l_close[NSYNDEL][NSYNDLEN];
+	int l_nblock;
+	char l_quote[NSYNDEL];	/* strings                     */
+	char l_escape[NSYNDEL];	/* and their escapes, or 0     */
+	int l_nstring;
+	int l_pre;		/* starts a preprocessor line  */
+	char l_word[NSYNNAME];	/* word characters, besides    */
+				/* letters, digits and "_"     */
+	char l_number[NSTRING];	/* characters of numbers       */
+	hashtab_T l_keyw;	/* keywords                    */
+	int l_maxkw;		/* longest keyword             */
+
+	unsigned char l_class[NSYNCHAR];	/* class of characters */
+	int l_ncls;		/* classes, end of line last   */
+	int l_nstate;		/* states                      */
+	int l_node;		/* the first for part of a     */
+				/* delimiter                   */
+	unsigned short *l_table;	/* by state and class  */
+	unsigned int *l_attr;	/* colours of each state       */
+	unsigned int *l_pattr;	/* in a preprocessor line      */
+};
 
 typedef struct colorindex_S
 {
-	short_u	ci_index;	/* index of color_T */
+	short_u	ci_index;	/* index in "syncolor" */
 	char_u	ci_keyw[1];	/* keyword */
 } colorindex_T;
 
 #define CI_KEY_OFF	offsetof(colorindex_T, ci_keyw)
 #define HI2CI(hi)	((colorindex_T *)((hi)->hi_key - CI_KEY_OFF))
 
-/* syntax highlight color */
-static int speckeyfg = 0x5FD7FF;	/* special key forgrnd color */
-static int speccharfg = 0xFFD7D7;	/* special char forgrnd color */
-static int commentfg = 0x34E2E2;	/* comment forgrnd color */
-static int stringfg = 0xAD7FA8;		/* string forgrnd color */
-static int preprocfg = 0x5FD7FF;	/* preprocess forgrnd color */
-static int macrofg = 0x5FD7FF;		/* macro forgrnd color */
-//static int typefg = 0x87FFAF;		/* type forgrnd color */
-//static int constantfg = 0xAD7FA8;	/* constant forgrnd color */
-//static int structfg = 0x87FFAF;	/* structure forgrnd color */
-//static int storagefg = 0x87FFAF;	/* storage class forgrnd color */
-//static int statefg = 0xFCE94F;	/* statement forgrnd color */
-//static int labelfg = 0xFCE94F;	/* label forgrnd color */
-//static int condfg = 0xFCE94F;		/* conditional forgrnd color */
-//static int repeatfg = 0xFCE94F;	/* repeat forgrnd color */
-static int numberfg = 0xAD7FA8;		/* number forgrnd color */
-static int oct1stfg = 0x5FD7FF;		/* octal first forgrnd color */
-static int errorfg = 0xEEEEEC;		/* error forgrnd color */
-static int errorbg = 0xEF2929;		/* error bacgrnd color */
-
-static color_T arr_color[] = {
-	{0x5FD7FF, CLR_NONE},	/* macro fg and bg color */
-	{0x5FD7FF, CLR_NONE},	/* preproc_if fg and bg color */
-	{0x5FD7FF, CLR_NONE},	/* preproc_else fg and bg color */
-	{0x87FFAF, CLR_NONE},	/* type fg and bg color */
-	{0xAD7FA8, CLR_NONE},	/* constant fg and bg color */
-	{0x87FFAF, CLR_NONE},	/* struct fg and bg color */
-	{0x87FFAF, CLR_NONE},	/* storage fg and bg color */
-	{0xFCE94F, CLR_NONE},	/* state fg and bg color */
-	{0xFCE94F, CLR_NONE},	/* label fg and bg color */
-	{0xFCE94F, CLR_NONE},	/* cond fg and bg color */
-	{0xFCE94F, CLR_NONE},	/* repeat fg and bg color */
-	{0xFCE94F, CLR_NONE}	/* operator fg and bg color */
+/*
+ * The colours a line was last drawn in, kept with the line ("l_syn") so
+ * that redrawing it does not have to go through the highlighter again.
+ * They are good for as long as the text of the line, its language, the
+ * multi line comment state it starts in, the width of the screen and the
+ * tab stops are what they were; the line forgets them when its text
+ * changes (see lforget()). The block comes from the arena of the buffer of
+ * the line.
+ */
+struct synspan {
+	unsigned short sp_col;	/* first column of the run */
+	unsigned short sp_len;	/* columns in the run */
+	unsigned short sp_attr;	/* colour pair, see attr_find() */
 };
 
-static char *arr_macro[] = {"define", "undef", NULL};
-static char *arr_preproc_if[] = {"if", "ifdef" , "ifndef", NULL};
-static char *arr_preproc_else[] = {"else", "endif", NULL};
-static char *arr_type[] = {
-	"int", "long", "short", "char", "void",
-	"signed", "unsigned", "float", "double",
-	/* gnu */
-	"__label__", "__complex__", "__volatile__",
-	NULL
-};
-static char *arr_constant[] = {
-	"NULL", "EOF", "SEEK_CUR", "SEEK_END", "SEEK_SET",
-	"stderr", "stdin", "stdout",
-	"__LINE__", "__FILE__", "__DATE__", "__TIME__",
-	"__STDC__", "__STDC_VERSION__",
-	/* gnu */
-	"__GNUC__", "__FUNCTION__", "__PRETTY_FUNCTION__", "__func__",
-	NULL
+struct synline {
+	int s_size;		/* bytes in the block */
+	short s_ncol;		/* screen width, 0 when forgotten */
+	short s_tabs;		/* tab mask */
+	short s_lang;		/* language */
+	unsigned char s_in;	/* comment state at the start */
+	unsigned char s_out;	/* and at the end */
+	short s_n;		/* runs in s_span */
+	struct synspan s_span[1];
 };
-static char *arr_struct[] = {"struct", "union" , "enum", "typedef", NULL};
-static char *arr_storage[] = {
-	"static", "register", "auto", "volatile", "extern", "const",
-	/* gnu */
-	"inline", "__attribute__",
-	NULL
-};
-static char *arr_state[] = {
-	"goto", "break", "return", "continue", "asm",
-	/* gnu */
-	"__asm__",
-	NULL
+
+#define SYNSIZE(n)	((int) offsetof(struct synline, s_span) \
+			 + (n) * (int) sizeof(struct synspan))
+
+/*
+ * syntax highlight colours, by the names the syntax file knows them by;
+ * those from "type" on are for keywords
+ */
+static struct syncolor {
+	char *c_name;
+	int c_fcolor;
+	int c_bcolor;
+	unsigned int c_attr;	/* the pair, once the file is read */
+} syncolor[] = {
+	{"key", 0x5FD7FF, CLR_NONE},		/* special keys */
+	{"special", 0xFFD7D7, CLR_NONE},	/* escapes in strings */
+	{"comment", 0x34E2E2, CLR_NONE},
+	{"string", 0xAD7FA8, CLR_NONE},
+	{"preproc", 0x5FD7FF, CLR_NONE},
+	{"number", 0xAD7FA8, CLR_NONE},
+	{"error", 0xEEEEEC, 0xEF2929},
+	{"type", 0x87FFAF, CLR_NONE},
+	{"constant", 0xAD7FA8, CLR_NONE},
+	{"struct", 0x87FFAF, CLR_NONE},
+	{"storage", 0x87FFAF, CLR_NONE},
+	{"statement", 0xFCE94F, CLR_NONE},
+	{"label", 0xFCE94F, CLR_NONE},
+	{"conditional", 0xFCE94F, CLR_NONE},
+	{"repeat", 0xFCE94F, CLR_NONE},
+	{"operator", 0xFCE94F, CLR_NONE}
 };
-static char *arr_label[] = {"case", "default", NULL};
-static char *arr_cond[] = {"if", "else", "switch", NULL};
-static char *arr_repeat[] = {"while", "for", "do", NULL};
-static char *arr_operator[] = {
-	"sizeof",
-	/* gnu */
-	"typeof", "__real__", "__imag__",
+
+#define	SC_KEY		0
+#define	SC_SPECIAL	1
+#define	SC_COMMENT	2
+#define	SC_STRING	3
+#define	SC_PREPROC	4
+#define	SC_NUMBER	5
+#define	SC_ERROR	6
+#define	SC_KEYWORD	7	/* the first for keywords */
+
+/* C, for C mode when the syntax file does not describe it */
+static char *cdefault[] = {
+	"syntax c",
+	"comment //",
+	"comment /* */",
+	"string \" \\",
+	"string ' \\",
+	"preproc #",
+	"number 0123456789abcdefABCDEFxXlLuU.",
+	"keyword type int long short char void signed unsigned float double",
+	"keyword type __label__ __complex__ __volatile__",
+	"keyword constant NULL EOF SEEK_CUR SEEK_END SEEK_SET",
+	"keyword constant stderr stdin stdout",
+	"keyword constant __LINE__ __FILE__ __DATE__ __TIME__",
+	"keyword constant __STDC__ __STDC_VERSION__",
+	"keyword constant __GNUC__ __FUNCTION__ __PRETTY_FUNCTION__ __func__",
+	"keyword struct struct union enum typedef",
+	"keyword storage static register auto volatile extern const",
+	"keyword storage inline __attribute__",
+	"keyword statement goto break return continue asm __asm__",
+	"keyword label case default",
+	"keyword conditional if else switch",
+	"keyword repeat while for do",
+	"keyword operator sizeof typeof __real__ __imag__",
 	NULL
 };
 
-/* syntax keyword hashtable */
-static hashtab_T poundtab;
-static hashtab_T keywtab;
-
-/* syntax highlight flag */
-int hi_mcomment;		/* multi line comment */
-static int hi_char;		/* char */
-static int hi_sstring;		/* single line string */
-static int hi_scomment;		/* single line comment */
-static int hi_include;		/* #include */
-static int hi_macro;		/* macro */
-static int hi_preproc_if;	/* #if */
-static int hi_preproc_else;	/* #else */
-static int hi_preproc;		/* preproc */
-
-static int hi_char_idx;		/* char index */
-static int hi_mcomment_idx;	/* multi line comment index */
-static int hi_pound_idx;	/* # index */
-static int hi_less_idx;		/* #include < index */
-static int hi_nonempty_idx;	/* nonempty char index */
-static int hi_bslash_idx;	/* backslash index */
-static int hi_percent_idx;	/* percent index */
-
-static void syn_include(struct text *v_text, int vtcol);
-static void syn_preproc(struct text *v_text, int vtcol);
-static int syn_other(struct text *v_text, int vtcol);
-
-static void syn_find(struct text *v_text, int begin, int end,
-	int *pbegin, int *pend);
-static void syn_trim(struct text *v_text, int begin, int end,
-	int *pbegin, int *pend);
-static void syn_fcolor(struct text *v_text, int begin, int end,
-	int fcolor);
-static void syn_color(struct text *v_text, int begin, int end,
-	int fcolor, int bcolor);
-
-static void hash_addarr(hashtab_T *ht, char **arr, short_u idx);
+static struct synlang *synlangs;	/* the languages */
+static struct synlang *syncmode;	/* the one for C mode */
+static int synnlang;			/* languages ever made */
+
+/* syntax highlight state */
+int hi_mcomment;		/* comment state at the start of a line */
+static int hi_start;		/* the same, of the line being drawn */
+static struct synlang *hi_lang;	/* its language */
+static unsigned int *hi_attr;	/* and colours, l_attr or l_pattr */
+static int hi_state;		/* state after the last character */
+static int hi_tok;		/* column the word or delimiter began in */
+static int hi_lead;		/* only blanks on the line so far */
+static int hi_direct;		/* the next word is a preprocessor one */
+static int hi_ncol;		/* columns on the screen */
+
+/* while a table is made: the delimiters, and what each state is */
+static struct syntok {
+	char t_text[NSYNDLEN];	/* the delimiter */
+	int t_ctx;		/* state it is looked for in */
+	int t_next;		/* state it leads to */
+	int t_kind;		/* TK_... */
+} syntok[NSYNDEL * 6];
+static int nsyntok;
+
+static struct synnode {
+	char n_text[NSYNDLEN];	/* delimiter so far, "" if not in one */
+	int n_ctx;		/* state it was started in */
+} synnode[NSYNSTATE];
+
+static int synfile(char *fname);
+static char *synparse(struct synlang **spp, char *text);
+static int syncompile(struct synlang *sp);
+static void synaddtok(char *text, int ctx, int next, int kind);
+static int synfindtok(int ctx, char *text);
+static int synfindnode(int ctx, char *text);
+static unsigned short synrule(struct synlang *sp, int s, int c);
+static int synword(struct synlang *sp, int c);
+static int synnum(struct synlang *sp, int c);
+static int synspecial(struct synlang *sp, int c);
+static void synlfree(struct synlang *sp);
+static void synstep(struct text *v_text, int col, int cl);
+static void synpaint(struct text *v_text, int begin, int end,
+	unsigned int attr);
+static void synkeyword(struct text *v_text, int end);
+static int synexpand(int c, int *buf);
+
+static int hash_addkey(hashtab_T *ht, char *key, short_u idx);
 static int hash_findkey(hashtab_T *ht, char *key);
-static int is_separator(int c);
-static int is_escape(int c);
-static int is_format_tail(int c);
-static int is_format_middle(struct text *v_text, int begin, int end);
 
 /*
- * Initialize the data structures used by the syntax code
+ * Initialize the data structures used by the syntax code: read the
+ * syntax file, if there is one, add C if it did not describe it, and make
+ * the tables. A language that does not fit in a table is dropped.
  */
 void syninit(void)
 {
-	hash_init(&poundtab);
-	hash_addarr(&poundtab, arr_macro, IDX_MACRO);
-	hash_addarr(&poundtab, arr_preproc_if, IDX_PREPROC_IF);
-	hash_addarr(&poundtab, arr_preproc_else, IDX_PREPROC_ELSE);
+	struct synlang **spp;
+	struct synlang *sp;
+	char line[NSTRING];
+	char *fname;
+	char *msg;
+	int i;
+
+	if ((fname = flook(pathname[2], TRUE)) != NULL)
+		synfile(fname);
+
+	for (sp = synlangs; sp != NULL; sp = sp->l_next)
+		if (strcmp(sp->l_name, "c") == 0)
+			break;
+	if (sp == NULL)
+		for (i = 0; cdefault[i] != NULL; i++) {
+			mystrscpy(line, cdefault[i], NSTRING);
+			if ((msg = synparse(&sp, line)) != NULL)
+				mlwrite("Built in syntax: %s", msg);
+		}
 
-	hash_init(&keywtab);
-	hash_addarr(&keywtab, arr_type, IDX_TYPE);
-	hash_addarr(&keywtab, arr_constant, IDX_CONSTANT);
-	hash_addarr(&keywtab, arr_struct, IDX_STRUCT);
-	hash_addarr(&keywtab, arr_storage, IDX_STORAGE);
-	hash_addarr(&keywtab, arr_state, IDX_STATE);
-	hash_addarr(&keywtab, arr_label, IDX_LABEL);
-	hash_addarr(&keywtab, arr_cond, IDX_COND);
-	hash_addarr(&keywtab, arr_repeat, IDX_REPEAT);
-	hash_addarr(&keywtab, arr_operator, IDX_OPERATOR);
+	for (i = 0; i < ARRAY_SIZE(syncolor); i++)
+		syncolor[i].c_attr = attr_find(syncolor[i].c_fcolor,
+					       syncolor[i].c_bcolor);
+	for (spp = &synlangs; (sp = *spp) != NULL;) {
+		if (syncompile(sp) == FALSE) {
+			mlwrite("Syntax %s is too big", sp->l_name);
+			*spp = sp->l_next;
+			synlfree(sp);
+			continue;
+		}
+		if (syncmode == NULL && strcmp(sp->l_name, "c") == 0)
+			syncmode = sp;
+		spp = &sp->l_next;
+	}
 }
 
 /*
@@ -192,478 +314,869 @@ void syninit(void)
  */
 void synfree(void)
 {
-	hash_clear_all(&poundtab, CI_KEY_OFF);
-	hash_clear_all(&keywtab, CI_KEY_OFF);
+	struct synlang *sp;
+
+	while ((sp = synlangs) != NULL) {
+		synlangs = sp->l_next;
+		synlfree(sp);
+	}
+	syncmode = NULL;
+}
+
+/*
+ * Read the syntax file "fname". A line that makes no sense is complained
+ * about and skipped.
+ */
+static int synfile(char *fname)
+{
+	struct synlang *sp = NULL;
+	char *msg;
+	int nbytes;
+	int lineno = 0;
+	int s;
+
+	if (ffropen(fname) != FIOSUC)
+		return FALSE;
+	while ((s = ffgetline(&nbytes)) == FIOSUC)
+		if ((msg = synparse(&sp, fline)) != NULL)
+			mlwrite("%s line %d: %s", fname, ++lineno, msg);
+		else
+			++lineno;
+	ffclose();
+	return s == FIOEOF;
 }
 
-/* syntax highlight for special key */
-void syntax_specialkey(struct text *v_text, int start, int len)
+/*
+ * Take in line "text" of a syntax file, for language "*spp"; a "syntax"
+ * line starts a new one there. Return NULL, or what is wrong with it.
+ */
+static char *synparse(struct synlang **spp, char *text)
 {
-	int i;
-	for (i = 0; i < len; i++)
-		v_text[start + i].t_fcolor = speckeyfg;
-}
-
-/* syntax highlight line init for c */
-void syntax_c_line_init()
-{
-	hi_char = FALSE;
-	hi_sstring = FALSE;
-	hi_scomment = FALSE;
-	hi_include = FALSE;
-	hi_macro = FALSE;
-	hi_preproc_if = FALSE;
-	hi_preproc_else = FALSE;
-	hi_preproc = FALSE;
-
-	hi_char_idx = -1;
-	hi_mcomment_idx = -1;
-	hi_pound_idx = -1;
-	hi_less_idx = -1;
-	hi_nonempty_idx = -1;
-	hi_bslash_idx = -1;
-	hi_percent_idx = -1;
-}
-
-static int syntax_c_common(struct text *v_text, int vtcol)
-{
-	int ret = FALSE;
-	int c = v_text[vtcol].t_char;
-
-	if (c == '/' && vtcol > 0 && v_text[vtcol - 1].t_char == '/') {
-		v_text[vtcol].t_fcolor = commentfg;
-		v_text[vtcol - 1].t_fcolor = commentfg;
-		hi_scomment = TRUE;
-		ret = TRUE;
-	} else if (c == '*' && vtcol > 0 && v_text[vtcol - 1].t_char == '/') {
-		v_text[vtcol].t_fcolor = commentfg;
-		v_text[vtcol - 1].t_fcolor = commentfg;
-		hi_mcomment_idx = vtcol;
-		hi_mcomment = TRUE;
-		ret = TRUE;
-	} else if (is_separator(c)) {
-		if (hi_nonempty_idx >= 0)
-			syn_other(v_text, vtcol);
-		hi_nonempty_idx = -1;
+	struct synlang *sp = *spp;
+	struct synlang **spp2;
+	char *word[NSYNWORD];
+	char *cp;
+	int nword = 0;
+	int i, j;
+
+	/* cut the line up into words */
+	for (cp = text; nword < NSYNWORD;) {
+		while (*cp == ' ' || *cp == '\t')
+			*cp++ = 0;
+		if (*cp == 0)
+			break;
+		word[nword++] = cp;
+		while (*cp != 0 && *cp != ' ' && *cp != '\t')
+			++cp;
+	}
+	while (*cp == ' ' || *cp == '\t')
+		*cp++ = 0;
+
+	if (nword == 0 || word[0][0] == ';')
+		return NULL;
+
+	if (strcmp(word[0], "color") == 0) {
+		if (nword < 3 || nword > 4)
+			return "color needs a name and one or two colours";
+		for (i = 0; i < ARRAY_SIZE(syncolor); i++)
+			if (strcmp(word[1], syncolor[i].c_name) == 0)
+				break;
+		if (i == ARRAY_SIZE(syncolor))
+			return "no such color";
+		syncolor[i].c_fcolor = (int) strtol(word[2], NULL, 16);
+		if (nword == 4)
+			syncolor[i].c_bcolor = (int) strtol(word[3], NULL, 16);
+		return NULL;
+	}
+
+	if (strcmp(word[0], "syntax") == 0) {
+		if (nword != 2 || strlen(word[1]) >= NSYNNAME)
+			return "syntax needs a short name";
+		if ((sp = calloc(1, sizeof(struct synlang))) == NULL)
+			return "out of memory";
+		strcpy(sp->l_name, word[1]);
+		strcpy(sp->l_number, "0123456789.");
+		hash_init(&sp->l_keyw);
+		for (spp2 = &synlangs; *spp2 != NULL; spp2 = &(*spp2)->l_next)
+			;
+		*spp2 = sp;
+		*spp = sp;
+		return NULL;
 	}
-	return ret;
-}
-
-/* syntax highlight handle for c */
-void syntax_c_handle(struct text *v_text, int vtcol)
-{
-	int i, ret;
-	int c = v_text[vtcol].t_char;
-
-	if (c != ' ' && hi_nonempty_idx < 0)
-		hi_nonempty_idx = vtcol;
-
-	if (hi_scomment == TRUE)
-		v_text[vtcol].t_fcolor = commentfg;
-	else if (hi_mcomment == TRUE) {
-		v_text[vtcol].t_fcolor = commentfg;
-		if (c == '/' && vtcol > 0 && v_text[vtcol - 1].t_char == '*') {
-			if (hi_mcomment_idx > 0) {
-				if (vtcol - hi_mcomment_idx >= 2)
-					hi_mcomment = FALSE;
-			} else
-				hi_mcomment = FALSE;
-		} else if (c == '*' && vtcol > 0 && v_text[vtcol - 1].t_char == '/') {
-			syn_color(v_text, vtcol - 1, vtcol - 1, errorfg, errorbg);
+
+	if (sp == NULL)
+		return "not in a syntax";
+	if (*cp != 0)
+		return "too many words";
+
+	if (strcmp(word[0], "files") == 0) {
+		for (i = 1; i < nword; i++) {
+			if (sp->l_nfiles == NSYNFILE ||
+			    strlen(word[i]) >= NSYNNAME)
+				return "too many files";
+			strcpy(sp->l_files[sp->l_nfiles++], word[i]);
 		}
-	} else if (hi_macro == TRUE) {
-		ret = syntax_c_common(v_text, vtcol);
-		if (ret == FALSE)
-			v_text[vtcol].t_fcolor = macrofg;
-	} else if (hi_preproc_if == TRUE) {
-		ret = syntax_c_common(v_text, vtcol);
-		if (ret == FALSE)
-			v_text[vtcol].t_fcolor = preprocfg;
-	} else if (hi_preproc_else == TRUE) {
-		ret = syntax_c_common(v_text, vtcol);
-		if (ret == FALSE)
-			v_text[vtcol].t_fcolor = preprocfg;
-	} else if (c == '\'') {
-		if (hi_char == FALSE) {
-			if (hi_sstring == FALSE) {
-				hi_char = TRUE;
-				hi_char_idx = vtcol;
-			} else {
-				if (v_text[vtcol - 1].t_char == '\\') {
-					v_text[vtcol - 1].t_fcolor = speccharfg;
-					v_text[vtcol].t_fcolor = speccharfg;
-				}
-				else
-					v_text[vtcol].t_fcolor = stringfg;
-			}
-		} else {
-			if (v_text[vtcol - 1].t_char != '\\') {
-				int delta = vtcol - hi_char_idx;
-				if (delta == 2) {
-					hi_char = FALSE;
-					syn_fcolor(v_text, hi_char_idx, vtcol, stringfg);
-				} else if (delta == 3 &&
-					v_text[vtcol - 2].t_char == '\\') {
-					hi_char = FALSE;
-					syn_fcolor(v_text, hi_char_idx, vtcol, speccharfg);
-				} else
-					hi_char_idx = vtcol;
-			}
+	} else if (strcmp(word[0], "comment") == 0) {
+		if (nword < 2 || nword > 3)
+			return "comment needs one or two delimiters";
+		for (i = 1; i < nword; i++) {
+			if (strlen(word[i]) >= NSYNDLEN)
+				return "delimiter is too long";
+			for (cp = word[i]; *cp != 0; cp++)
+				if (synword(sp, *cp) || (*cp & 0x80))
+					return "delimiter is not punctuation";
 		}
-	} else if (c == '"') {
-		if (hi_sstring == FALSE) {
-			if (hi_char == FALSE) {
-				if (hi_pound_idx >= 0)
-					syn_include(v_text, vtcol);
-				hi_sstring = TRUE;
-				v_text[vtcol].t_fcolor = stringfg;
-			}
+		if (nword == 2) {
+			if (sp->l_nline == NSYNDEL)
+				return "too many comments";
+			strcpy(sp->l_line[sp->l_nline++], word[1]);
 		} else {
-			if (v_text[vtcol - 1].t_char != '\\' ||
-				hi_include == TRUE) {
-				hi_sstring = FALSE;
-				v_text[vtcol].t_fcolor = stringfg;
-			} else {
-				v_text[vtcol].t_fcolor = speccharfg;
-				v_text[vtcol - 1].t_fcolor = speccharfg;
-			}
+			if (sp->l_nblock == NSYNDEL)
+				return "too many comments";
+			strcpy(sp->l_open[sp->l_nblock], word[1]);
+			strcpy(sp->l_close[sp->l_nblock++], word[2]);
 		}
-	} else if (hi_sstring == TRUE) {
-		if (hi_include == FALSE) {
-			if (v_text[vtcol - 1].t_char == '\\' &&
-				(is_escape(c) || is_digit(c))) {
-				v_text[vtcol].t_fcolor = speccharfg;
-				v_text[vtcol - 1].t_fcolor = speccharfg;
-				if (is_digit(c))
-					hi_bslash_idx = vtcol - 1;
-			} else if (hi_bslash_idx > 0 && is_digit(c)) {
-				v_text[vtcol].t_fcolor = speccharfg;
-			} else if (hi_percent_idx >= 0 && is_format_tail(c)) {
-				if (is_format_middle(v_text, hi_percent_idx + 1, vtcol - 1)) {
-					syn_fcolor(v_text, hi_percent_idx, vtcol, speccharfg);
-					hi_percent_idx = -1;
-				} else {
-					v_text[vtcol].t_fcolor = stringfg;
-					hi_bslash_idx = -1;
-				}
-			} else {
-				v_text[vtcol].t_fcolor = stringfg;
-				hi_bslash_idx = -1;
-				if (c == '%')
-					hi_percent_idx = vtcol;
-			}
-		} else
-			v_text[vtcol].t_fcolor = stringfg;
-	} else if (c == '#' && hi_pound_idx < 0) {
-		for (i = 0; i < vtcol; i++) {
-			if (v_text[i].t_char != ' ')
+	} else if (strcmp(word[0], "string") == 0) {
+		if (nword < 2 || nword > 3 || word[1][1] != 0 ||
+		    (nword == 3 && word[2][1] != 0))
+			return "string needs a quote and maybe an escape";
+		if (synword(sp, word[1][0]) || (word[1][0] & 0x80))
+			return "quote is not punctuation";
+		if (sp->l_nstring == NSYNDEL)
+			return "too many strings";
+		sp->l_quote[sp->l_nstring] = word[1][0];
+		sp->l_escape[sp->l_nstring++] = nword == 3 ? word[2][0] : 0;
+	} else if (strcmp(word[0], "preproc") == 0) {
+		if (nword != 2 || word[1][1] != 0)
+			return "preproc needs a character";
+		sp->l_pre = word[1][0];
+	} else if (strcmp(word[0], "word") == 0) {
+		if (nword != 2 || strlen(word[1]) >= NSYNNAME)
+			return "word needs a few characters";
+		strcpy(sp->l_word, word[1]);
+	} else if (strcmp(word[0], "number") == 0) {
+		if (nword != 2 || strlen(word[1]) >= NSTRING)
+			return "number needs some characters";
+		strcpy(sp->l_number, word[1]);
+	} else if (strcmp(word[0], "keyword") == 0) {
+		if (nword < 2)
+			return "keyword needs a group";
+		for (i = SC_KEYWORD; i < ARRAY_SIZE(syncolor); i++)
+			if (strcmp(word[1], syncolor[i].c_name) == 0)
 				break;
+		if (i == ARRAY_SIZE(syncolor))
+			return "no such keyword group";
+		for (j = 2; j < nword; j++) {
+			if (strlen(word[j]) > SYNLEN)
+				return "keyword is too long";
+			if (hash_addkey(&sp->l_keyw, word[j], i) == FALSE)
+				return "out of memory";
+			if (strlen(word[j]) > sp->l_maxkw)
+				sp->l_maxkw = strlen(word[j]);
+		}
+	} else
+		return "unknown line";
+	return NULL;
+}
+
+/*
+ * Make the table of language "sp". Return TRUE, or FALSE if it does not
+ * fit or there is no memory for it.
+ */
+static int syncompile(struct synlang *sp)
+{
+	int rep[NSYNCHAR];	/* a character of each class */
+	char text[NSYNDLEN];
+	int nstring;		/* first string state */
+	int nstate;
+	int c, i, k, s;
+	struct syntok *tp;
+
+	/* the delimiters */
+	nsyntok = 0;
+	for (i = 0; i < sp->l_nline; i++)
+		synaddtok(sp->l_line[i], S_NORMAL, S_LINE, TK_OPEN);
+	for (i = 0; i < sp->l_nblock; i++) {
+		s = S_BLOCK + i;
+		synaddtok(sp->l_open[i], S_NORMAL, s, TK_OPEN);
+		synaddtok(sp->l_close[i], s, S_NORMAL, TK_CLOSE);
+		synaddtok(sp->l_close[i], S_NORMAL, S_NORMAL, TK_ERROR);
+		synaddtok(sp->l_open[i], s, s, TK_ERROR);
+	}
+	nstring = S_BLOCK + sp->l_nblock;
+	for (i = 0; i < sp->l_nstring; i++) {
+		text[0] = sp->l_quote[i];
+		text[1] = 0;
+		synaddtok(text, S_NORMAL, nstring + 2 * i, TK_OPEN);
+	}
+
+	/* the states, then one for each start of a longer delimiter */
+	nstate = nstring + 2 * sp->l_nstring;
+	if (nstate > NSYNSTATE)
+		return FALSE;
+	for (s = 0; s < nstate; s++) {
+		synnode[s].n_text[0] = 0;
+		synnode[s].n_ctx = s;
+	}
+	for (tp = syntok; tp < &syntok[nsyntok]; tp++) {
+		for (k = 1; tp->t_text[k] != 0; k++) {
+			memcpy(text, tp->t_text, k);
+			text[k] = 0;
+			if (synfindnode(tp->t_ctx, text) >= 0)
+				continue;
+			if (nstate == NSYNSTATE)
+				return FALSE;
+			strcpy(synnode[nstate].n_text, text);
+			synnode[nstate++].n_ctx = tp->t_ctx;
 		}
-		if (i == vtcol)
-			hi_pound_idx = vtcol;
-	} else if (c == '<' && hi_pound_idx >= 0 && hi_less_idx < 0) {
-		syn_include(v_text, vtcol);
-		if (hi_include == TRUE) {
-			v_text[vtcol].t_fcolor = preprocfg;
-			hi_less_idx = vtcol;
+	}
+
+	/* the classes */
+	sp->l_ncls = 0;
+	for (c = 0; c < NSYNCHAR; c++) {
+		for (k = 0; k < sp->l_ncls; k++) {
+			if (synspecial(sp, c) || synspecial(sp, rep[k])) {
+				if (c == rep[k])
+					break;
+			} else if (synword(sp, c) == synword(sp, rep[k]) &&
+				   is_digit(c) == is_digit(rep[k]) &&
+				   synnum(sp, c) == synnum(sp, rep[k]))
+				break;
 		}
-	} else if (c == '>' && hi_include == TRUE) {
-		for (i = hi_less_idx; i <= vtcol; i++)
-			v_text[i].t_fcolor = stringfg;
-	} else if (c == '/' && vtcol > 0 && v_text[vtcol - 1].t_char == '/') {
-		v_text[vtcol].t_fcolor = commentfg;
-		v_text[vtcol - 1].t_fcolor = commentfg;
-		hi_scomment = TRUE;
-	} else if (c == '*' && vtcol > 0 && v_text[vtcol - 1].t_char == '/') {
-		v_text[vtcol].t_fcolor = commentfg;
-		v_text[vtcol - 1].t_fcolor = commentfg;
-		hi_mcomment_idx = vtcol;
-		hi_mcomment = TRUE;
-	} else if (c == '/' && vtcol > 0 && v_text[vtcol - 1].t_char == '*' &&
-		hi_mcomment == FALSE) {
-		syn_color(v_text, vtcol - 1, vtcol, errorfg, errorbg);
-	} else if (c == ' ' && hi_pound_idx >= 0 && hi_preproc == FALSE)
-		syn_preproc(v_text, vtcol);
-	else if (is_separator(c)) {
-		if (hi_nonempty_idx >= 0)
-			syn_other(v_text, vtcol);
-		hi_nonempty_idx = -1;
+		if (k == sp->l_ncls)
+			rep[sp->l_ncls++] = c;
+		sp->l_class[c] = k;
+	}
+	rep[sp->l_ncls++] = -1;		/* the end of the line */
+
+	sp->l_nstate = nstate;
+	sp->l_node = nstring + 2 * sp->l_nstring;
+	sp->l_table = malloc(nstate * sp->l_ncls * sizeof(unsigned short));
+	sp->l_attr = malloc(nstate * sizeof(unsigned int));
+	sp->l_pattr = malloc(nstate * sizeof(unsigned int));
+	if (sp->l_table == NULL || sp->l_attr == NULL || sp->l_pattr == NULL)
+		return FALSE;
+	for (s = 0; s < nstate; s++)
+		for (k = 0; k < sp->l_ncls; k++)
+			sp->l_table[s * sp->l_ncls + k] = synrule(sp, s, rep[k]);
+
+	/* and their colours */
+	for (s = 0; s < nstate; s++) {
+		k = synnode[s].n_ctx;
+		if (k == S_NORMAL || k == S_WORD || k == S_NUMBER)
+			sp->l_attr[s] = ATTR_NONE;
+		else if (k == S_LINE || k < nstring)
+			sp->l_attr[s] = syncolor[SC_COMMENT].c_attr;
+		else if ((k - nstring) % 2 == 0)
+			sp->l_attr[s] = syncolor[SC_STRING].c_attr;
+		else
+			sp->l_attr[s] = syncolor[SC_SPECIAL].c_attr;
+		if (sp->l_attr[s] == ATTR_NONE)
+			sp->l_pattr[s] = syncolor[SC_PREPROC].c_attr;
+		else
+			sp->l_pattr[s] = sp->l_attr[s];
 	}
+	sp->l_id = ++synnlang;
+	return TRUE;
 }
 
-/* syntax highlight line end for c */
-void syntax_c_line_end(struct text *v_text, int vtcol)
+/*
+ * Add delimiter "text" for the table being made, to be looked for in
+ * state "ctx", leading to state "next". The first one wins.
+ */
+static void synaddtok(char *text, int ctx, int next, int kind)
 {
-	if (hi_mcomment == TRUE)
+	struct syntok *tp;
+
+	if (synfindtok(ctx, text) >= 0)
 		return;
-	if (hi_pound_idx >= 0 && hi_preproc == FALSE)
-		syn_preproc(v_text, vtcol);
-	else if (hi_nonempty_idx >= 0)
-		syn_other(v_text, vtcol);
+	tp = &syntok[nsyntok++];
+	strcpy(tp->t_text, text);
+	tp->t_ctx = ctx;
+	tp->t_next = next;
+	tp->t_kind = kind;
 }
 
-/* syntax highlight for #include */
-static void syn_include(struct text *v_text, int vtcol)
+/* Find delimiter "text" of state "ctx", -1 if there is none */
+static int synfindtok(int ctx, char *text)
 {
-	int begin, end;
-
-	syn_find(v_text, hi_pound_idx + 1, vtcol - 1, &begin, &end);
+	int i;
 
-	if (strcmp("include", synbuf) == 0) {
-		v_text[hi_pound_idx].t_fcolor = preprocfg;
-		syn_fcolor(v_text, begin, vtcol - 1, preprocfg);
-		hi_include = TRUE;
-		hi_preproc = TRUE;
-	}
+	for (i = 0; i < nsyntok; i++)
+		if (syntok[i].t_ctx == ctx && strcmp(syntok[i].t_text, text) == 0)
+			return i;
+	return -1;
 }
 
-/* syntax highlight for preproc */
-static void syn_preproc(struct text *v_text, int vtcol)
+/* Find the state for the start "text" of a delimiter of "ctx", or -1 */
+static int synfindnode(int ctx, char *text)
 {
-	int begin, end;
-	int fcolor = CLR_NONE;
-	int idx;
+	int s;
 
-	syn_find(v_text, hi_pound_idx + 1, vtcol - 1, &begin, &end);
+	for (s = 0; s < NSYNSTATE; s++)
+		if (synnode[s].n_text[0] != 0 && synnode[s].n_ctx == ctx &&
+		    strcmp(synnode[s].n_text, text) == 0)
+			return s;
+	return -1;
+}
 
-	/* hash table search */
-	idx = hash_findkey(&poundtab, synbuf);
+/*
+ * The table entry of language "sp" for character "c" in state "s", where
+ * "c" is -1 at the end of the line.
+ */
+static unsigned short synrule(struct synlang *sp, int s, int c)
+{
+	static const char act[] = {A_OPEN, A_CLOSE, A_ERROR};
+	static const char act1[] = {A_MOVE, A_CLOSE, A_ERR1};
+	static const char aact[] = {A_AOPEN, A_FAIL, A_AERROR};
+	struct synnode *np = &synnode[s];
+	char text[NSYNDLEN];
+	int nstring = S_BLOCK + sp->l_nblock;
+	int k, t;
+
+	if (np->n_text[0] != 0) {	/* part of a delimiter */
+		k = strlen(np->n_text);
+		if (c > 0 && k + 1 < NSYNDLEN) {
+			memcpy(text, np->n_text, k);
+			text[k] = c;
+			text[k + 1] = 0;
+			if ((t = synfindnode(np->n_ctx, text)) >= 0)
+				return SYNENT(t, A_MOVE);
+			if ((t = synfindtok(np->n_ctx, text)) >= 0)
+				return SYNENT(syntok[t].t_next,
+					      act[syntok[t].t_kind]);
+		}
+		if ((t = synfindtok(np->n_ctx, np->n_text)) >= 0)
+			return SYNENT(syntok[t].t_next, aact[syntok[t].t_kind]);
+		return SYNENT(np->n_ctx, A_FAIL);
+	}
 
-	if (idx < 0)
-		return;
+	if (c < 0) {			/* the end of the line */
+		if (s == S_WORD)
+			return SYNENT(S_NORMAL, A_WORD);
+		if (s == S_NUMBER)
+			return SYNENT(S_NORMAL, A_NUMBER);
+		return SYNENT(s >= S_BLOCK && s < nstring ? s : S_NORMAL,
+			      A_SET);
+	}
 
-	if (idx == IDX_MACRO) {
-		fcolor = arr_color[idx].fcolor;
-		hi_macro = TRUE;
-		hi_nonempty_idx = -1;
-	} else if (idx == IDX_PREPROC_IF) {
-		fcolor = arr_color[idx].fcolor;
-		hi_preproc_if = TRUE;
-	} else if (idx == IDX_PREPROC_ELSE) {
-		fcolor = arr_color[idx].fcolor;
-		hi_preproc_else = TRUE;
-		hi_nonempty_idx = -1;
+	if (s == S_NORMAL || (s >= S_BLOCK && s < nstring)) {
+		text[0] = c;
+		text[1] = 0;
+		if (c > 0 && (t = synfindnode(s, text)) >= 0)
+			return SYNENT(t, A_START);
+		if (c > 0 && (t = synfindtok(s, text)) >= 0)
+			return SYNENT(syntok[t].t_next, act1[syntok[t].t_kind]);
+		if (s != S_NORMAL)
+			return SYNENT(s, A_MOVE);
+		if (c == sp->l_pre)
+			return SYNENT(S_NORMAL, A_PRE);
+		if (is_digit(c))
+			return SYNENT(S_NUMBER, A_START);
+		if (synword(sp, c))
+			return SYNENT(S_WORD, A_START);
+		return SYNENT(S_NORMAL, A_MOVE);
 	}
 
-	if (fcolor != CLR_NONE) {
-		v_text[hi_pound_idx].t_fcolor = fcolor;
-		syn_fcolor(v_text, begin, end, fcolor);
-		hi_preproc = TRUE;
-		end = vtcol;
+	switch (s) {
+	case S_WORD:
+		return synword(sp, c) ? SYNENT(S_WORD, A_MOVE)
+				      : SYNENT(S_NORMAL, A_WORD);
+	case S_NUMBER:
+		if (synnum(sp, c))
+			return SYNENT(S_NUMBER, A_MOVE);
+		return synword(sp, c) ? SYNENT(S_WORD, A_MOVE)
+				      : SYNENT(S_NORMAL, A_NUMBER);
+	case S_LINE:
+		return SYNENT(S_LINE, A_MOVE);
 	}
+
+	/* in a string, or after its escape */
+	k = (s - nstring) / 2;
+	if ((s - nstring) % 2 != 0)
+		return SYNENT(s - 1, A_CLOSE);
+	if (c == sp->l_quote[k])
+		return SYNENT(S_NORMAL, A_CLOSE);
+	if (c == sp->l_escape[k] && c != 0)
+		return SYNENT(s + 1, A_MOVE);
+	return SYNENT(s, A_MOVE);
+}
+
+/* is "c" (128 for all from there) part of a word of language "sp"? */
+static int synword(struct synlang *sp, int c)
+{
+	return c >= 0x80 || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+	    || is_digit(c) || c == '_' || (c != 0 && strchr(sp->l_word, c));
 }
 
-/* syntax highlight for other */
-static int syn_other(struct text *v_text, int vtcol)
+/* can "c" be in a number of language "sp", after the first digit? */
+static int synnum(struct synlang *sp, int c)
 {
-	int begin, end;
-	int len;
-	int idx;
+	return is_digit(c) || (c > 0 && c < 0x80 && strchr(sp->l_number, c));
+}
 
-	syn_find(v_text, hi_nonempty_idx, vtcol - 1, &begin, &end);
+/* is "c" in any delimiter, or otherwise special to language "sp"? */
+static int synspecial(struct synlang *sp, int c)
+{
+	int i;
 
-	/* it is number */
-	if (synbuf[0] == '.' || is_digit(synbuf[0])) {
-		len = strlen(synbuf);
-		if (is_hex_str(synbuf)) {
-			syn_fcolor(v_text, begin, end, numberfg);
+	if (c <= 0 || c >= 0x80)
+		return FALSE;
+	if (c == sp->l_pre)
+		return TRUE;
+	for (i = 0; i < sp->l_nstring; i++)
+		if (c == sp->l_quote[i] || c == sp->l_escape[i])
 			return TRUE;
-		}
-		if (synbuf[len - 1] == 'f' || synbuf[len - 1] == 'F') {
-			synbuf[len - 1] = '\0';
-			if (is_octal_str(synbuf) || is_int_str(synbuf) ||
-				is_float_str(synbuf)) {
-				syn_fcolor(v_text, begin, end, numberfg);
-				return TRUE;
-			}
-		}
-		if (is_octal_str(synbuf)) {
-			syn_fcolor(v_text, begin, begin, oct1stfg);
-			syn_fcolor(v_text, begin + 1, end, numberfg);
+	for (i = 0; i < sp->l_nline; i++)
+		if (strchr(sp->l_line[i], c))
 			return TRUE;
-		} else if (is_int_str(synbuf) || is_float_str(synbuf)) {
-			syn_fcolor(v_text, begin, end, numberfg);
+	for (i = 0; i < sp->l_nblock; i++)
+		if (strchr(sp->l_open[i], c) || strchr(sp->l_close[i], c))
 			return TRUE;
-		}
-		return FALSE;
-	}
+	return FALSE;
+}
 
-	/* hash table search */
-	idx = hash_findkey(&keywtab, synbuf);
+/* free language "sp" */
+static void synlfree(struct synlang *sp)
+{
+	hash_clear_all(&sp->l_keyw, CI_KEY_OFF);
+	free(sp->l_table);
+	free(sp->l_attr);
+	free(sp->l_pattr);
+	free(sp);
+}
 
-	if (idx >= 0) {
-		if (arr_color[idx].bcolor == CLR_NONE)
-			syn_fcolor(v_text, begin, end, arr_color[idx].fcolor);
-		else
-			syn_color(v_text, begin, end, arr_color[idx].fcolor,
-				arr_color[idx].bcolor);
-		return TRUE;
-	}
-	return FALSE;
+/*
+ * The language of buffer "bp": the first one with a file name end that
+ * its file name has, or C in C mode. NULL if it has none.
+ */
+struct synlang *syntax_find(struct buffer *bp)
+{
+	struct synlang *sp;
+	int len, n, i;
+
+	len = strlen(bp->b_fname);
+	for (sp = synlangs; sp != NULL; sp = sp->l_next)
+		for (i = 0; i < sp->l_nfiles; i++) {
+			n = strlen(sp->l_files[i]);
+			if (n <= len &&
+			    strcmp(&bp->b_fname[len - n], sp->l_files[i]) == 0 &&
+			    (sp->l_files[i][0] == '.' || n == len ||
+			     bp->b_fname[len - n - 1] == '/'))
+				return sp;
+		}
+	return (bp->b_mode & MDCMOD) != 0 ? syncmode : NULL;
 }
 
-static void syn_find(struct text *v_text, int begin, int end, int *pbegin, int *pend)
+/* syntax highlight for special key */
+void syntax_specialkey(struct text *v_text, int start, int len)
 {
-	int i, len;
+	int i;
+	for (i = 0; i < len; i++)
+		if (start + i >= 0)
+			v_text[start + i].t_attr = syncolor[SC_KEY].c_attr;
+}
 
-	syn_trim(v_text, begin, end, pbegin, pend);
-	len = *pend - *pbegin + 1;
+/*
+ * Start highlighting a line of language "sp", on a screen "ncol" wide, in
+ * comment state "hi_mcomment".
+ */
+void syntax_line_init(struct synlang *sp, int ncol)
+{
+	hi_lang = sp;
+	hi_attr = sp->l_attr;
+	hi_start = hi_state = hi_mcomment;
+	hi_tok = 0;
+	hi_lead = TRUE;
+	hi_direct = FALSE;
+	hi_ncol = ncol;
+}
 
-	if (len <= 0 || len > SYNLEN) {
-		synbuf[0] = '\0';
-		return;
-	}
+/*
+ * Character "c" was put in column "vtcol" of "v_text"; the column may be
+ * off the screen on either side.
+ */
+void syntax_handle(struct text *v_text, int vtcol, int c)
+{
+	synstep(v_text, vtcol, hi_lang->l_class[c < 0x80 ? c : 0x80]);
+	if (c != ' ')
+		hi_lead = FALSE;
+}
 
-	for (i = 0; i < len; i++)
-		synbuf[i] = v_text[*pbegin + i].t_char;
+/*
+ * Character "c" would have gone in column "vtcol" of "v_text", but is off
+ * the right edge; it still counts for what comes after it.
+ */
+void syntax_feed(struct text *v_text, int vtcol, int c)
+{
+	int buf[3];
+	int i, n;
 
-	synbuf[len] = '\0';
+	n = synexpand(c, buf);
+	for (i = 0; i < n; i++)
+		syntax_handle(v_text, vtcol + i, buf[i]);
 }
 
-static void syn_trim(struct text *v_text, int begin, int end, int *pbegin, int *pend)
+/* the line ends in column "vtcol" of "v_text" */
+void syntax_line_end(struct text *v_text, int vtcol)
 {
-	int i, j;
+	synstep(v_text, vtcol, hi_lang->l_ncls - 1);
+	hi_mcomment = hi_state;
+}
 
-	for (i = begin; i<= end;) {
-		if (v_text[i].t_char != ' ')
+/* Go through the table for a character of class "cl" in column "col" */
+static void synstep(struct text *v_text, int col, int cl)
+{
+	struct synlang *sp = hi_lang;
+	unsigned short t;
+	int next;
+
+	for (;;) {
+		t = sp->l_table[hi_state * sp->l_ncls + cl];
+		next = t & 0xff;
+		switch (t >> 8) {
+		case A_SET:
 			break;
-		i++;
-	}
-
-	for (j = end; j > i;) {
-		if (v_text[j].t_char != ' ')
+		case A_MOVE:
+			synpaint(v_text, col, col, hi_attr[next]);
+			break;
+		case A_START:
+			hi_tok = col;
+			synpaint(v_text, col, col, hi_attr[next]);
+			break;
+		case A_OPEN:
+			synpaint(v_text, hi_tok, col, hi_attr[next]);
+			break;
+		case A_CLOSE:
+			synpaint(v_text, col, col, hi_attr[hi_state]);
+			break;
+		case A_ERR1:
+			hi_tok = col;
+			/* fall through */
+		case A_ERROR:
+			synpaint(v_text, hi_tok, col, syncolor[SC_ERROR].c_attr);
+			break;
+		case A_PRE:
+			if (hi_lead) {
+				hi_attr = sp->l_pattr;
+				hi_direct = TRUE;
+			}
+			synpaint(v_text, col, col, hi_attr[next]);
 			break;
-		j--;
+		case A_WORD:
+			synkeyword(v_text, col);
+			break;
+		case A_NUMBER:
+			synpaint(v_text, hi_tok, col - 1,
+				 syncolor[SC_NUMBER].c_attr);
+			break;
+		case A_AOPEN:
+			synpaint(v_text, hi_tok, col - 1, hi_attr[next]);
+			break;
+		case A_AERROR:
+			synpaint(v_text, hi_tok, col - 1,
+				 syncolor[SC_ERROR].c_attr);
+			break;
+		}
+		hi_state = next;
+		if ((t >> 8) < A_RETRY)
+			return;
 	}
+}
 
-	*pbegin = i;
-	*pend = j;
+/* paint the columns from "begin" to "end" of "v_text" that are on screen */
+static void synpaint(struct text *v_text, int begin, int end,
+	unsigned int attr)
+{
+	if (begin < 0)
+		begin = 0;
+	if (end >= hi_ncol)
+		end = hi_ncol - 1;
+	while (begin <= end)
+		v_text[begin++].t_attr = attr;
 }
 
-static void syn_fcolor(struct text *v_text, int begin, int end,
-	int fcolor)
+/*
+ * A word ends before column "end" of "v_text"; colour it if it is a
+ * keyword, and not what a preprocessor line starts with.
+ */
+static void synkeyword(struct text *v_text, int end)
 {
-	int i;
-	for (i = begin; i <= end; i++)
-		v_text[i].t_fcolor = fcolor;
+	int i, len, idx;
+
+	len = end - hi_tok;
+	if (hi_direct) {
+		hi_direct = FALSE;
+		return;
+	}
+	if (len > hi_lang->l_maxkw || hi_tok < 0 || end > hi_ncol)
+		return;
+	for (i = 0; i < len; i++) {
+		if (v_text[hi_tok + i].t_char >= 0x80)
+			return;
+		synbuf[i] = v_text[hi_tok + i].t_char;
+	}
+	synbuf[len] = '\0';
+
+	/* hash table search */
+	if ((idx = hash_findkey(&hi_lang->l_keyw, synbuf)) >= 0)
+		synpaint(v_text, hi_tok, end - 1, syncolor[idx].c_attr);
 }
 
-static void syn_color(struct text *v_text, int begin, int end,
-	int fcolor, int bcolor)
+/*
+ * Put in "buf" the characters "c" is shown as, as far as the highlighter
+ * goes, and return how many there are (see vtputc()).
+ */
+static int synexpand(int c, int *buf)
 {
-	int i;
-	for (i = begin; i <= end; i++) {
-		v_text[i].t_fcolor = fcolor;
-		v_text[i].t_bcolor = bcolor;
+	static const char hex[] = "0123456789abcdef";
+
+	if (c == '\t') {
+		buf[0] = ' ';
+		return 1;
+	}
+	if (c < 0x20 || c == 0x7f) {
+		buf[0] = '^';
+		buf[1] = c == 0x7f ? '?' : c ^ 0x40;
+		return 2;
+	}
+	if (c >= 0x80 && c <= 0x9f) {
+		buf[0] = '\\';
+		buf[1] = hex[c >> 4];
+		buf[2] = hex[c & 15];
+		return 3;
 	}
+	buf[0] = c;
+	return 1;
 }
 
-static void hash_addarr(hashtab_T *ht, char **arr, short_u idx)
+/*
+ * Return the comment state of language "sp" after line "lp", when it
+ * starts in state "state". This goes through the same table as the
+ * display, without painting anything.
+ */
+int syntax_line_state(struct synlang *sp, struct line *lp, int state)
 {
-	int i;
-	hash_T hash;
-	hashitem_T *hi;
-	colorindex_T *ci;
-	char_u *p;
-
-	for (i = 0; arr[i] != NULL; i++) {
-		p = (char_u *)arr[i];
-		hash = hash_hash(p);
-		hi = hash_lookup(ht, p, hash);
-		if (HASHITEM_EMPTY(hi)) {
-			ci = (colorindex_T *)malloc((unsigned)(sizeof(colorindex_T) + STRLEN(p)));
-			if (ci == NULL)
-				return;
-			STRCPY(ci->ci_keyw, p);
-			ci->ci_index = idx;
-			hash_add_item(ht, hi, ci->ci_keyw, hash);
+	unsigned short t;
+	int buf[3];
+	int i, j, n, cl;
+	unicode_t c;
+
+	for (i = 0; i <= lp->l_used; ) {
+		if (i == lp->l_used) {		/* the end */
+			n = 1;
+			buf[0] = -1;
+			++i;
+		} else if ((unsigned char) lp->l_text[i] < 0x80) {
+			n = synexpand((unsigned char) lp->l_text[i++], buf);
+		} else {
+			i += utf8_to_unicode(lp->l_text, i, lp->l_used, &c);
+			n = synexpand(c, buf);
+		}
+		for (j = 0; j < n; j++) {
+			if (buf[j] < 0)
+				cl = sp->l_ncls - 1;
+			else
+				cl = sp->l_class[buf[j] < 0x80 ? buf[j] : 0x80];
+			do {
+				t = sp->l_table[state * sp->l_ncls + cl];
+				state = t & 0xff;
+			} while ((t >> 8) >= A_RETRY);
 		}
 	}
+	return state;
 }
 
-static int hash_findkey(hashtab_T *ht, char *key)
+/*
+ * Go through line "lp" of language "sp" from comment state "state" as
+ * syntax_line_state() does, and add the offsets of the fences in it, ()[]
+ * and {}, that are in plain text to "off", from "*n" on. A fence that may
+ * start a delimiter is only counted once it turns out not to. Return the
+ * state after the line.
+ */
+int syntax_line_fences(struct synlang *sp, struct line *lp, int state,
+	int *off, int *n)
 {
-	hashitem_T *hi;
-	colorindex_T *ci;
-
-	hi = hash_find(ht, (char_u *)key);
-	if (!HASHITEM_EMPTY(hi)) {
-		ci = HI2CI(hi);
-		return ci->ci_index;
+	unsigned short t;
+	int buf[3];
+	int i, j, k, m, cl, from, pend;
+	unicode_t c;
+
+	pend = from = -1;
+	t = 0;
+	for (i = 0; i <= lp->l_used; ) {
+		k = i;
+		if (i == lp->l_used) {		/* the end */
+			m = 1;
+			buf[0] = -1;
+			++i;
+		} else if ((unsigned char) lp->l_text[i] < 0x80) {
+			m = synexpand((unsigned char) lp->l_text[i++], buf);
+		} else {
+			i += utf8_to_unicode(lp->l_text, i, lp->l_used, &c);
+			m = synexpand(c, buf);
+		}
+		for (j = 0; j < m; j++) {
+			if (buf[j] < 0)
+				cl = sp->l_ncls - 1;
+			else
+				cl = sp->l_class[buf[j] < 0x80 ? buf[j] : 0x80];
+			do {
+				from = state;
+				t = sp->l_table[state * sp->l_ncls + cl];
+				state = t & 0xff;
+				if ((t >> 8) >= A_RETRY) {
+					if ((t >> 8) == A_FAIL &&
+					    state == S_NORMAL && pend >= 0)
+						off[(*n)++] = pend;
+					pend = -1;
+				}
+			} while ((t >> 8) >= A_RETRY);
+		}
+		if (m == 1 && buf[0] > 0 && from == S_NORMAL &&
+		    strchr("()[]{}", buf[0]) != NULL) {
+			if ((t >> 8) == A_MOVE && state == S_NORMAL)
+				off[(*n)++] = k;
+			else if ((t >> 8) == A_START && state >= sp->l_node)
+				pend = k;
+		} else if (state < sp->l_node)
+			pend = -1;
 	}
-	return -1;
+	return state;
 }
 
-static int is_char_in(int c, char *str)
+/*
+ * Whether line "lp" has colours saved for language "sp" on a screen "ncol"
+ * wide with tab mask "tabs", starting in the current comment state.
+ */
+int syntax_line_cached(struct synlang *sp, struct line *lp, int ncol,
+	int tabs)
 {
-	int i;
+	struct synline *lsp = lp->l_syn;
 
-	if (c > 0x7f)
-		return FALSE;
-	for (i = 0; str[i] != '\0'; i++) {
-		if (c == str[i])
-			return TRUE;
-	}
-	return FALSE;
+	return lsp != NULL && lsp->s_ncol == ncol && lsp->s_tabs == tabs
+	    && lsp->s_lang == sp->l_id && lsp->s_in == hi_mcomment;
 }
 
-static int is_separator(int c)
+/*
+ * Colour the first "n" cells at "v_text", where line "lp" has just been
+ * put, with the colours saved for it, and go on in the comment state it
+ * ended in.
+ */
+void syntax_line_paint(struct line *lp, struct text *v_text, int n)
 {
-	static char *str = " (){}[];,>=<+-*/%&|~";
-	return is_char_in(c, str);
+	struct synline *sp = lp->l_syn;
+	struct synspan *rp;
+	int i, j;
+
+	for (i = 0; i < n; i++)
+		v_text[i].t_attr = ATTR_NONE;
+	for (rp = sp->s_span; rp < &sp->s_span[sp->s_n]; rp++)
+		for (i = rp->sp_col, j = i + rp->sp_len; i < j; i++)
+			v_text[i].t_attr = rp->sp_attr;
+	hi_mcomment = sp->s_out;
 }
 
-static int is_escape(int c)
+/*
+ * Save the colours of the first "n" cells at "v_text", where line "lp"
+ * has just been put and highlighted, for a screen "ncol" wide with tab mask
+ * "tabs". The memory comes from arena "ap"; if there is none to be had the
+ * line is just drawn the long way next time.
+ */
+void syntax_line_save(struct arena *ap, struct line *lp,
+	struct text *v_text, int n, int ncol, int tabs)
 {
-	static char *str = "\\abefnrtv";
-	return is_char_in(c, str);
+	struct synline *sp = lp->l_syn;
+	struct synspan *rp;
+	int i, runs, size;
+
+	runs = 0;
+	for (i = 0; i < n; i++)
+		if (v_text[i].t_attr != ATTR_NONE &&
+		    (i == 0 || v_text[i].t_attr != v_text[i - 1].t_attr))
+			runs++;
+
+	if (sp == NULL || sp->s_size < SYNSIZE(runs)) {
+		if (sp != NULL)
+			arena_release(ap, sp, sp->s_size);
+		size = SYNSIZE(runs);
+		lp->l_syn = sp = arena_alloc(ap, &size);
+		if (sp == NULL)
+			return;
+		sp->s_size = size;
+	}
+	sp->s_ncol = ncol;
+	sp->s_tabs = tabs;
+	sp->s_lang = hi_lang->l_id;
+	sp->s_in = hi_start;
+	sp->s_out = hi_mcomment;
+	sp->s_n = runs;
+
+	rp = sp->s_span - 1;
+	for (i = 0; i < n; i++) {
+		if (v_text[i].t_attr == ATTR_NONE)
+			continue;
+		if (i == 0 || v_text[i].t_attr != v_text[i - 1].t_attr) {
+			rp++;
+			rp->sp_col = i;
+			rp->sp_len = 0;
+			rp->sp_attr = v_text[i].t_attr;
+		}
+		rp->sp_len++;
+	}
 }
 
-static int is_format_tail(int c)
+/*
+ * The text of line "lp" is changing. Its colours are no good any more, but
+ * the block is kept for the next time they are saved, as this may be
+ * called for lines of buffers other than the current one.
+ */
+void syntax_forget(struct line *lp)
 {
-	static char *str = "bdiuoxXDOUfeEgGcCsSpn";
-	return is_char_in(c, str);
+	lp->l_syn->s_ncol = 0;
 }
 
-static int is_format_head(int c)
+/*
+ * Line "lp" is being freed; give its colours back to arena "ap".
+ */
+void syntax_free(struct arena *ap, struct line *lp)
 {
-	static char *str = "-+' #0*";
-	return is_char_in(c, str);
+	arena_release(ap, lp->l_syn, lp->l_syn->s_size);
+	lp->l_syn = NULL;
 }
 
-static int is_format_middle(struct text *v_text, int begin, int end)
+static int hash_addkey(hashtab_T *ht, char *key, short_u idx)
 {
-	int i, j, k;
-	int c;
-
-	if (begin > end)
-		return TRUE;
-
-	syn_trim(v_text, begin, end, &j, &k);
-
-	for (i = j; i <= k; i++) {
-		c = v_text[i].t_char;
-		if (!is_format_head(c))
-			break;
-	}
-
-	for (; i <= k; i++) {
-		c = v_text[i].t_char;
-		if (!is_digit(c) && c != '.')
-			break;
+	hash_T hash;
+	hashitem_T *hi;
+	colorindex_T *ci;
+	char_u *p = (char_u *)key;
+
+	hash = hash_hash(p);
+	hi = hash_lookup(ht, p, hash);
+	if (HASHITEM_EMPTY(hi)) {
+		ci = (colorindex_T *)malloc((unsigned)(sizeof(colorindex_T) + STRLEN(p)));
+		if (ci == NULL)
+			return FALSE;
+		STRCPY(ci->ci_keyw, p);
+		ci->ci_index = idx;
+		return hash_add_item(ht, hi, ci->ci_keyw, hash);
 	}
+	HI2CI(hi)->ci_index = idx;
+	return TRUE;
+}
 
-	if (i > k)
-		return TRUE;
-
-	c = v_text[i].t_char;
+static int hash_findkey(hashtab_T *ht, char *key)
+{
+	hashitem_T *hi;
+	colorindex_T *ci;
 
-	if (i == k && (c == 'h' || c == 'l' || c == 'L'))
-		return TRUE;
-	else if (i + 1 == k && c == 'l' &&
-		v_text[i + 1].t_char == 'l')
-		return TRUE;
-	return FALSE;
+	hi = hash_find(ht, (char_u *)key);
+	if (!HASHITEM_EMPTY(hi)) {
+		ci = HI2CI(hi);
+		return ci->ci_index;
+	}
+	return -1;
 }
 
 #endif /* COLOR */
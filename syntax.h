@@ -3,11 +3,31 @@
 
 #include "display.h"
 
+struct line;
+struct arena;
+struct buffer;
+struct synlang;
+
 void syntax_specialkey(struct text *v_text, int start, int len);
 
-/* syntax for c language */
-void syntax_c_line_init(void);
-void syntax_c_handle(struct text *v_text, int vtcol);
-void syntax_c_line_end(struct text *v_text, int vtcol);
+/* the language of a buffer, NULL if none */
+struct synlang *syntax_find(struct buffer *bp);
+
+/* syntax highlight of a line */
+void syntax_line_init(struct synlang *sp, int ncol);
+void syntax_handle(struct text *v_text, int vtcol, int c);
+void syntax_feed(struct text *v_text, int vtcol, int c);
+void syntax_line_end(struct text *v_text, int vtcol);
+int syntax_line_state(struct synlang *sp, struct line *lp, int state);
+int syntax_line_fences(struct synlang *sp, struct line *lp, int state,
+	int *off, int *n);
+
+/* colours saved with the lines */
+int syntax_line_cached(struct synlang *sp, struct line *lp, int ncol,
+	int tabs);
+void syntax_line_paint(struct line *lp, struct text *v_text, int n);
+void syntax_line_save(struct arena *ap, struct line *lp,
+	struct text *v_text, int n, int ncol, int tabs);
+void syntax_free(struct arena *ap, struct line *lp);
 
 #endif /* SYNTAX_H_ */
@@ -15,11 +15,13 @@
 
 #include <curses.h>
 #include <stdio.h>
+#include <string.h>
 #include <term.h>
 
 #include "estruct.h"
 #include "edef.h"
 #include "efunc.h"
+#include "utf8.h"
 
 #if TERMCAP
 
@@ -32,10 +34,17 @@
 #define	NPAUSE	10    /* # times thru update to pause. */
 #define BEL     0x07
 #define ESC     0x1B
+#define	NCMC	256   /* # cursor addresses remembered. */
+#define	NSGR	64    /* # colors remembered, each way. */
+#define	NMOVE	64    /* Longest relative move.        */
 
 static void tcapkopen(void);
 static void tcapkclose(void);
+static int tcapputc(int c);
 static void tcapmove(int, int);
+static char *tcapcm(int row, int col);
+static int tcaprlen(int n);
+static char *tcapright(char *s, int n);
 static void tcapeeol(void);
 static void tcapeeop(void);
 static void tcapbeep(void);
@@ -43,6 +52,10 @@ static void tcaprev(int);
 static int tcapcres(char *);
 static void tcapscrollregion(int top, int bot);
 static void putpad(char *str);
+static void putseq(char *str);
+#if COLOR
+static int sgronly(char *str);
+#endif
 
 static void tcapopen(void);
 #if PKCODE
@@ -63,10 +76,43 @@ static void tcapscroll_delins(int from, int to, int linestoscroll);
 #define TCAPSLEN 315
 static char tcapbuf[TCAPSLEN];
 static char *UP, PC, *CM, *CE, *CL, *SO, *SE;
+static char *CR, *LE, *ND, *RI, *DO;
+
+/*
+ * Where the cursor is, as far as the characters and moves sent through
+ * here go, or -1 when that is not known. A write into the last column
+ * leaves it unknown, since terminals differ on where that puts it.
+ */
+static int tcrow = -1;
+static int tccol = -1;
+
+/* Cursor addresses already worked out, by "tcapcm". */
+static struct cmcache {
+	int c_row, c_col;	/* Where it goes, -1 when unused */
+	char c_seq[16];		/* "tgoto(CM, c_col, c_row)"     */
+} cmcache[NCMC];
+
+static int rimin;		/* Fewest columns RI beats ND at */
+static int tcrev = -1;		/* Reverse video, -1 if not known */
 
 #if COLOR
 static char *T_8F = "\033[38;2;%lu;%lu;%lum";
 static char *T_8B = "\033[48;2;%lu;%lu;%lum";
+
+/*
+ * The colors set now, CLR_NONE for the defaults or TCUNSET when that is
+ * not known, and the sequences for the colors used lately.
+ */
+#define	TCUNSET	(-2)
+
+static int tcfcol = TCUNSET;
+static int tcbcol = TCUNSET;
+static int revkeep;		/* SO and SE leave the colors be */
+
+static struct sgrcache {
+	int s_rgb;		/* The color, TCUNSET when unused */
+	char s_seq[24];		/* Sequence that sets it          */
+} fgcache[NSGR], bgcache[NSGR];
 #endif
 
 #if PKCODE
@@ -97,7 +143,7 @@ struct terminal term = {
 	tcapkopen,
 	tcapkclose,
 	ttgetc,
-	ttputc,
+	tcapputc,
 	ttflush,
 	tcapmove,
 	tcapeeol,
@@ -123,6 +169,7 @@ static void tcapopen(void)
 	char *tv_stype;
 	char err_str[72];
 	int int_col, int_row;
+	int i;
 
 #if PKCODE && USE_BROKEN_OPTIMIZATION
 	if (!term_init_ok) {
@@ -173,6 +220,15 @@ static void tcapopen(void)
 		CM = tgetstr("cm", &p);
 		CE = tgetstr("ce", &p);
 		UP = tgetstr("up", &p);
+		if ((CR = tgetstr("cr", &p)) == NULL)
+			CR = "\r";
+		if ((LE = tgetstr("le", &p)) == NULL
+		    && (LE = tgetstr("bc", &p)) == NULL)
+			LE = "\b";
+		ND = tgetstr("nd", &p);
+		RI = tgetstr("RI", &p);
+		if ((DO = tgetstr("do", &p)) == NULL)
+			DO = "\n";
 		SE = tgetstr("se", &p);
 		SO = tgetstr("so", &p);
 		if (SO != NULL)
@@ -216,17 +272,37 @@ static void tcapopen(void)
 			puts("Terminal description too big!\n");
 			exit(1);
 		}
+
+		/* Past this many columns, RI is shorter than that many NDs */
+		rimin = HUGE;
+		if (RI != NULL)
+			for (i = 1; i < HUGE; ++i)
+				if (ND == NULL || strlen(tgoto(RI, 0, i))
+				    < i * strlen(ND)) {
+					rimin = i;
+					break;
+				}
 #if PKCODE && USE_BROKEN_OPTIMIZATION
 		term_init_ok = 1;
 	}
 #endif
+	for (i = 0; i < NCMC; ++i)
+		cmcache[i].c_row = -1;
+#if	COLOR
+	for (i = 0; i < NSGR; ++i)
+		fgcache[i].s_rgb = bgcache[i].s_rgb = TCUNSET;
+	tcfcol = tcbcol = TCUNSET;
+	revkeep = sgronly(SO) && sgronly(SE);
+#endif
+	tcrow = tccol = -1;
+	tcrev = -1;
 	ttopen();
 }
 
 #if	PKCODE
 static void tcapclose(void)
 {
-	putpad(tgoto(CM, 0, term.t_nrow));
+	tcapmove(term.t_nrow, 0);
 	putpad(TE);
 	ttflush();
 	ttclose();
@@ -241,6 +317,11 @@ static void tcapkopen(void)
 	ttrow = 999;
 	ttcol = 999;
 	sgarbf = TRUE;
+#endif
+	tcrow = tccol = -1;
+	tcrev = -1;
+#if	COLOR
+	tcfcol = tcbcol = TCUNSET;
 #endif
 	strcpy(sres, "NORMAL");
 }
@@ -251,11 +332,134 @@ static void tcapkclose(void)
 	putpad(TE);
 	ttflush();
 #endif
+	tcrow = tccol = -1;
+	tcrev = -1;
+#if	COLOR
+	tcfcol = tcbcol = TCUNSET;
+#endif
+}
+
+/*
+ * Put a character on the screen, and keep track of where that leaves the
+ * cursor.
+ */
+static int tcapputc(int c)
+{
+	if (c >= 0x20 && c != 0x7f && (c < 0x80 || c > 0x9f)) {
+		if (tccol >= 0 && (tccol += char_width(c)) >= term.t_ncol)
+			tccol = -1;
+	} else if (c == '\r') {
+		if (tcrow >= 0)
+			tccol = 0;
+	} else if (c == '\b') {
+		if (tccol > 0)
+			--tccol;
+	} else if (c == '\n' && tcrow >= 0 && tcrow < term.t_nrow) {
+		++tcrow;
+	} else if (c != BEL) {
+		tcrow = tccol = -1;
+	}
+	return ttputc(c);
 }
 
+/*
+ * Move the cursor the cheapest way there is: with the cursor address, or,
+ * when it is known where the cursor is now, with up and down, carriage
+ * return, backspaces and cursor right, whichever takes fewer bytes.
+ */
 static void tcapmove(int row, int col)
 {
-	putpad(tgoto(CM, col, row));
+	char rel[NMOVE + 1];
+	char *s;
+	int len, back, n;
+
+	s = NULL;
+	if (tcrow >= 0 && tccol >= 0 && row <= term.t_nrow
+	    && col < term.t_ncol) {
+		if (row >= tcrow)
+			len = (row - tcrow) * strlen(DO);
+		else
+			len = (tcrow - row) * strlen(UP);
+		back = FALSE;
+		if (col > tccol)
+			len += tcaprlen(col - tccol);
+		else if (col < tccol) {
+			n = strlen(CR) + tcaprlen(col);
+			back = (tccol - col) * strlen(LE) <= n;
+			len += back ? (tccol - col) * strlen(LE) : n;
+		}
+		if (len <= NMOVE && len < strlen(tcapcm(row, col))) {
+			s = rel;
+			for (n = row - tcrow; n > 0; --n)
+				s += strlen(strcpy(s, DO));
+			for (; n < 0; ++n)
+				s += strlen(strcpy(s, UP));
+			if (back)
+				for (n = tccol - col; n > 0; --n)
+					s += strlen(strcpy(s, LE));
+			else if (col < tccol) {
+				s += strlen(strcpy(s, CR));
+				s = tcapright(s, col);
+			} else
+				s = tcapright(s, col - tccol);
+			*s = 0;
+		}
+	}
+	putpad(s != NULL ? rel : tcapcm(row, col));
+	tcrow = row;
+	tccol = col;
+	if (row > term.t_nrow || col >= term.t_ncol)	/* Off the edge */
+		tcrow = tccol = -1;
+}
+
+/*
+ * The cursor address of "row", "col". The last few used are kept, as the
+ * same few moves keep coming up. Like what "tgoto" returns, it does not
+ * last past the next call.
+ */
+static char *tcapcm(int row, int col)
+{
+	struct cmcache *cp;
+	char *seq;
+
+	cp = &cmcache[(row * 31 + col) % NCMC];
+	if (cp->c_row == row && cp->c_col == col)
+		return cp->c_seq;
+	seq = tgoto(CM, col, row);
+	if (strlen(seq) >= sizeof(cp->c_seq))
+		return seq;
+	strcpy(cp->c_seq, seq);
+	cp->c_row = row;
+	cp->c_col = col;
+	return cp->c_seq;
+}
+
+/*
+ * The bytes it takes to move the cursor "n" columns to the right, or HUGE
+ * if it can not be done.
+ */
+static int tcaprlen(int n)
+{
+	if (n == 0)
+		return 0;
+	if (n >= rimin)
+		return strlen(tgoto(RI, 0, n));
+	if (ND != NULL)
+		return n * strlen(ND);
+	return HUGE;
+}
+
+/*
+ * Put the cheapest way to move "n" columns to the right at "s", and
+ * return the end of it.
+ */
+static char *tcapright(char *s, int n)
+{
+	if (n >= rimin)
+		return s + strlen(strcpy(s, tgoto(RI, 0, n)));
+	for (; n > 0; --n)
+		s += strlen(strcpy(s, ND));
+	return s;
 }
 
 static void tcapeeol(void)
@@ -266,6 +470,7 @@ static void tcapeeol(void)
 static void tcapeeop(void)
 {
 	putpad(CL);
+	tcrow = tccol = 0;
 }
 
 /*
@@ -275,11 +480,18 @@ static void tcapeeop(void)
  */
 static void tcaprev(int state)
 {
+	if (state == tcrev)
+		return;
 	if (state) {
 		if (SO != NULL)
 			putpad(SO);
 	} else if (SE != NULL)
 		putpad(SE);
+	tcrev = state;
+#if	COLOR
+	if (!revkeep)
+		tcfcol = tcbcol = TCUNSET;
+#endif
 }
 
 /* Change screen resolution. */
@@ -331,6 +543,7 @@ static void tcapscroll_delins(int from, int to, int howmanylines)
 		for (i = to - from; i > 0; i--)
 			putpad(AL);
 	}
+	tcrow = tccol = -1;
 }
 
 /* cs is set up just like cm, so we use tgoto... */
@@ -338,6 +551,7 @@ static void tcapscrollregion(int top, int bot)
 {
 	ttputc(PC);
 	putpad(tgoto(CS, bot, top));
+	tcrow = tccol = -1;	/* Most terminals home the cursor */
 }
 
 #endif
@@ -347,32 +561,51 @@ static void tcapscrollregion(int top, int bot)
 #define GREEN(rgb)	(((rgb) >>  8) & 0xFF)
 #define BLUE(rgb)	(((rgb)      ) & 0xFF)
 
-static void term_rgb_color(char *s, int rgb)
+/*
+ * Set a color with format "s", unless it is set already. "cache" keeps
+ * the sequences for the colors used lately, so each is only made once.
+ */
+static void term_rgb_color(char *s, int rgb, int *now,
+			   struct sgrcache *cache)
 {
-#define MAX_COLOR_STR_LEN 100
-	char buf[MAX_COLOR_STR_LEN];
-	snprintf(buf, MAX_COLOR_STR_LEN, s, RED(rgb), GREEN(rgb), BLUE(rgb));
-	putpad(buf);
+	struct sgrcache *cp;
+
+	if (rgb == *now)
+		return;
+	cp = &cache[(RED(rgb) * 7 + GREEN(rgb) * 3 + BLUE(rgb)) % NSGR];
+	if (cp->s_rgb != rgb) {
+		snprintf(cp->s_seq, sizeof(cp->s_seq), s,
+			 RED(rgb), GREEN(rgb), BLUE(rgb));
+		cp->s_rgb = rgb;
+	}
+	putseq(cp->s_seq);
+	*now = rgb;
 }
 
 static void tcapfcol(int rgb)
 {
-	term_rgb_color(T_8F, rgb);
+	term_rgb_color(T_8F, rgb, &tcfcol, fgcache);
 }
 
 static void tcapbcol(int rgb)
 {
-	term_rgb_color(T_8B, rgb);
+	term_rgb_color(T_8B, rgb, &tcbcol, bgcache);
 }
 
 static void tcap_reset_fcol(void)
 {
-	putpad("\033[39m");
+	if (tcfcol != CLR_NONE) {
+		putseq("\033[39m");
+		tcfcol = CLR_NONE;
+	}
 }
 
 static void tcap_reset_bcol(void)
 {
-	putpad("\033[49m");
+	if (tcbcol != CLR_NONE) {
+		putseq("\033[49m");
+		tcbcol = CLR_NONE;
+	}
 }
 #endif
 
@@ -385,4 +618,28 @@ static void putpad(char *str)
 {
 	tputs(str, 1, ttputc);
 }
+
+#if COLOR
+/*
+ * Is "str" a single SGR that changes nothing but what it says, that is,
+ * not a reset to normal?
+ */
+static int sgronly(char *str)
+{
+	int n;
+
+	if (str == NULL || str[0] != ESC || str[1] != '[')
+		return FALSE;
+	for (n = 0, str += 2; *str >= '0' && *str <= '9'; ++str)
+		n = n * 10 + *str - '0';
+	return n != 0 && str[0] == 'm' && str[1] == 0;
+}
+#endif
+
+/* Send a sequence that has no padding in it, as it is. */
+static void putseq(char *str)
+{
+	while (*str)
+		ttputc(*str++);
+}
 #endif /* TERMCAP */
@@ -0,0 +1,598 @@
+/*	undo.c
+ *
+ * Undoing and redoing changes.
+ *
+ * Each buffer keeps a journal of the changes made to it, oldest first. A
+ * change is a place in the buffer (a line number and an offset in that
+ * line), the bytes that were there and the bytes that took their place; an
+ * insert has no old bytes and a delete no new ones. The bytes of all of the
+ * changes are kept one after the other in one block, the old bytes of a
+ * change in front of its new ones. A change also knows the command that
+ * made it. Undoing takes back all of the changes of the last command,
+ * newest first, and redoing makes them again; the changes that were undone
+ * stay at the end of the journal until something else is changed.
+ *
+ * A change that starts where the last one of the same command left off is
+ * added on to that one instead, so typing a word, deleting a run of
+ * characters or changing the case of a region makes one change, not one
+ * for each character. A run of self inserts is undone as one command. A
+ * global replace puts a line in at once (see lreplace()), which makes one
+ * change per line, from its first match to the end of its last, and
+ * undoing it puts each line back in one go.
+ *
+ * The journal of a buffer is held to "$undosize" bytes, counting both the
+ * changes and their bytes; when it grows past that, the oldest commands
+ * are dropped. A command that is too big on its own drops the journal
+ * and is not recorded either.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+#include "lindex.h"
+#include "undo.h"
+
+#define	NJOIN		20	/* Self inserts undone as one, at most  */
+#define	ADDMAX		1024	/* New bytes moved to add on, at most   */
+
+struct uchange {
+	long h_line;		/* Line of the change, from 0   */
+	int h_off;		/* and offset in that line      */
+	unsigned h_cmd;		/* Command that made it         */
+	long h_del;		/* Bytes taken out              */
+	long h_ins;		/* Bytes put in their place     */
+	long h_text;		/* Where they are in u_text     */
+};
+
+struct undo {
+	struct uchange *u_change;	/* The changes, oldest first    */
+	int u_nchange;		/* Changes in the journal       */
+	int u_done;		/* ... that are not undone      */
+	int u_max;		/* Room in u_change             */
+	char *u_text;		/* Their bytes, old then new    */
+	long u_used;		/* Bytes of u_text in use       */
+	long u_size;		/* Room in u_text               */
+	long u_eline;		/* Where the new bytes of the   */
+	int u_eoff;		/* last change end              */
+	unsigned u_lost;	/* Command too big to record    */
+	int u_cut;		/* Older commands were dropped  */
+	int u_keep;		/* Kept through bclear()        */
+	int u_cleared;		/* ... which has been done      */
+};
+
+static unsigned curcmd = 1;	/* Number of the command running */
+static int lastins;		/* The last one was a self insert */
+static int njoined;		/* Self inserts in this command  */
+static int undoing;		/* Changes are not to be recorded */
+static char *utext;		/* New text of a line being put  */
+static long utextsize;		/* back, and room in it          */
+
+/*
+ * Start a new command. A self insert ("insert" is TRUE) after another one
+ * goes with it, up to NJOIN of them.
+ */
+void undo_boundary(int insert)
+{
+	if (insert && lastins && njoined < NJOIN) {
+		++njoined;
+		return;
+	}
+	++curcmd;
+	lastins = insert;
+	njoined = 1;
+}
+
+/*
+ * Bytes taken by the changes of journal "up" from the "i"th on.
+ */
+static long usince(struct undo *up, int i)
+{
+	if (i == up->u_nchange)
+		return 0;
+	return (up->u_nchange - i) * (long) sizeof(struct uchange)
+	    + up->u_used - up->u_change[i].h_text;
+}
+
+/*
+ * Empty journal "up", giving back its memory.
+ */
+static void uempty(struct undo *up)
+{
+	free(up->u_change);
+	free(up->u_text);
+	up->u_change = NULL;
+	up->u_text = NULL;
+	up->u_nchange = up->u_done = up->u_max = 0;
+	up->u_used = up->u_size = 0;
+}
+
+/*
+ * Throw the journal of buffer "bp" away.
+ */
+static void ufree(struct buffer *bp)
+{
+	if (bp->b_undo != NULL) {
+		uempty(bp->b_undo);
+		free(bp->b_undo);
+		bp->b_undo = NULL;
+	}
+}
+
+/*
+ * Return the journal of buffer "bp" to record a change of the running
+ * command in, making it if need be, or NULL if that change is not to be
+ * recorded.
+ */
+static struct undo *journal(struct buffer *bp)
+{
+	struct undo *up;
+	struct uchange *hp;
+
+	if (undoing)
+		return NULL;
+	if (undosize <= 0) {	/* Undo turned off      */
+		ufree(bp);
+		return NULL;
+	}
+	if ((up = bp->b_undo) == NULL) {
+		if ((up = calloc(1, sizeof(struct undo))) == NULL)
+			return NULL;
+		bp->b_undo = up;
+	}
+	if (up->u_lost == curcmd)
+		return NULL;
+	if (up->u_done < up->u_nchange) {	/* Nothing to redo now  */
+		up->u_nchange = up->u_done;
+		up->u_used = 0;
+		if (up->u_done > 0) {
+			hp = &up->u_change[up->u_done - 1];
+			up->u_used = hp->h_text + hp->h_del + hp->h_ins;
+		}
+	}
+	return up;
+}
+
+/*
+ * The running command is too big to record in journal "up": drop all of it.
+ */
+static void lost(struct undo *up)
+{
+	uempty(up);
+	up->u_lost = curcmd;
+	up->u_cut = TRUE;
+}
+
+/*
+ * Make room in journal "up" for "n" more bytes and one more change. Return
+ * FALSE if there is no memory for them, after dropping the journal.
+ */
+static int room(struct undo *up, long n)
+{
+	struct uchange *hp;
+	char *cp;
+	long size;
+	int max;
+
+	if (n > undosize || up->u_used + n < up->u_used) {
+		lost(up);
+		return FALSE;
+	}
+	if (up->u_nchange == up->u_max) {
+		max = 2 * up->u_max + 16;
+		hp = realloc(up->u_change, max * sizeof(struct uchange));
+		if (hp == NULL) {
+			lost(up);
+			return FALSE;
+		}
+		up->u_change = hp;
+		up->u_max = max;
+	}
+	if (up->u_used + n > up->u_size) {
+		size = 2 * (up->u_used + n) + 256;
+		if ((cp = realloc(up->u_text, size)) == NULL) {
+			lost(up);
+			return FALSE;
+		}
+		up->u_text = cp;
+		up->u_size = size;
+	}
+	return TRUE;
+}
+
+/*
+ * Add a change at line "line", offset "off" to journal "up", with "ndel"
+ * old and "nins" new bytes. Return where its bytes go, or NULL if there is
+ * no room for them.
+ */
+static char *newchange(struct undo *up, long line, int off, long ndel,
+		       long nins)
+{
+	struct uchange *hp;
+
+	if (!room(up, ndel + nins))
+		return NULL;
+	hp = &up->u_change[up->u_nchange++];
+	hp->h_line = line;
+	hp->h_off = off;
+	hp->h_cmd = curcmd;
+	hp->h_del = ndel;
+	hp->h_ins = nins;
+	hp->h_text = up->u_used;
+	up->u_used += ndel + nins;
+	up->u_done = up->u_nchange;
+	up->u_eline = line;
+	up->u_eoff = off;
+	return &up->u_text[hp->h_text];
+}
+
+/*
+ * The "n" bytes at "cp" were put in where the last change of journal "up"
+ * ended; move its end past them.
+ */
+static void advance(struct undo *up, char *cp, long n)
+{
+	while (n-- > 0)
+		if (*cp++ == '\n') {
+			++up->u_eline;
+			up->u_eoff = 0;
+		} else
+			++up->u_eoff;
+}
+
+/*
+ * Hold journal "up" to "$undosize" bytes, dropping the oldest commands
+ * until it is a quarter below that, so that it does not happen again on
+ * the next change. If the running command is too big on its own, drop it
+ * too.
+ */
+static void cutback(struct undo *up)
+{
+	struct uchange *hp;
+	long keep;
+	int i;
+	int j;
+
+	if (usince(up, 0) <= undosize)
+		return;
+	hp = up->u_change;
+	for (i = 0; i < up->u_nchange && hp[i].h_cmd != curcmd; i = j) {
+		if (usince(up, i) <= undosize - undosize / 4)
+			break;
+		for (j = i; j < up->u_nchange && hp[j].h_cmd == hp[i].h_cmd;
+		     ++j)
+			;
+	}
+	if (usince(up, i) > undosize) {	/* Too big on its own   */
+		lost(up);
+		return;
+	}
+	keep = hp[i].h_text;
+	memmove(up->u_text, up->u_text + keep, up->u_used - keep);
+	up->u_used -= keep;
+	memmove(hp, hp + i, (up->u_nchange - i) * sizeof(struct uchange));
+	up->u_nchange -= i;
+	up->u_done = up->u_nchange;
+	for (i = 0; i < up->u_nchange; ++i)
+		hp[i].h_text -= keep;
+	up->u_cut = TRUE;
+}
+
+/*
+ * Record a change to the current buffer at offset "off" of line "lp": the
+ * "ndel" bytes at "del" taken out and the "nins" bytes at "ins" put in.
+ * Call it while the line is still in the buffer; that is, before the line
+ * goes for a delete and after it is there for an insert.
+ */
+void undo_record(struct line *lp, int off, char *del, long ndel,
+		 char *ins, long nins)
+{
+	struct undo *up;
+	struct uchange *hp;
+	char *cp;
+	long line;
+	long byte;
+
+	if ((ndel == 0 && nins == 0) || (up = journal(curbp)) == NULL)
+		return;
+	lindex_where(curbp, lp, &line, &byte);
+	hp = up->u_nchange > 0 ? &up->u_change[up->u_nchange - 1] : NULL;
+	if (hp != NULL && hp->h_cmd == curcmd && line == up->u_eline
+	    && off == up->u_eoff && (ndel == 0 || hp->h_ins <= ADDMAX)) {
+		if (!room(up, ndel + nins))	/* Add on to the last one */
+			return;
+		hp = &up->u_change[up->u_nchange - 1];
+		cp = &up->u_text[hp->h_text + hp->h_del];
+		if (ndel > 0) {
+			memmove(cp + ndel, cp, hp->h_ins);
+			memcpy(cp, del, ndel);
+		}
+		if (nins > 0)
+			memcpy(cp + ndel + hp->h_ins, ins, nins);
+		hp->h_del += ndel;
+		hp->h_ins += nins;
+		up->u_used += ndel + nins;
+	} else {
+		if ((cp = newchange(up, line, off, ndel, nins)) == NULL)
+			return;
+		if (ndel > 0)
+			memcpy(cp, del, ndel);
+		if (nins > 0)
+			memcpy(cp + ndel, ins, nins);
+	}
+	advance(up, ins, nins);
+	cutback(up);
+}
+
+/*
+ * Record that the byte at offset "off" of line "lp" of the current buffer
+ * is about to be changed to "c".
+ */
+void undo_putc(struct line *lp, int off, int c)
+{
+	char old;
+	char new;
+
+	old = lp->l_text[off];
+	new = c;
+	if (new != old)
+		undo_record(lp, off, &old, 1, &new, 1);
+}
+
+/*
+ * Copy the text of the lines from "lp" up to "end" to "cp", with a newline
+ * after each.
+ */
+static void gather(struct line *lp, struct line *end, char *cp)
+{
+	for (; lp != end; lp = lforw(lp)) {
+		memcpy(cp, lp->l_text, llength(lp));
+		cp += llength(lp);
+		*cp++ = '\n';
+	}
+}
+
+/*
+ * Record the whole lines of buffer "bp" from "lp" up to "end" as put in
+ * ("ins" is TRUE) or as about to be taken out.
+ */
+static void wholelines(struct buffer *bp, struct line *lp, struct line *end,
+		       int ins)
+{
+	struct undo *up;
+	struct line *clp;
+	char *cp;
+	long line;
+	long byte;
+	long n;
+	long nl;
+
+	if (lp == end || (up = journal(bp)) == NULL)
+		return;
+	n = nl = 0;
+	for (clp = lp; clp != end; clp = lforw(clp)) {
+		n += llength(clp) + 1;
+		++nl;
+	}
+	lindex_where(bp, lp, &line, &byte);
+	if ((cp = newchange(up, line, 0, ins ? 0 : n, ins ? n : 0)) == NULL)
+		return;
+	gather(lp, end, cp);
+	if (ins) {
+		up->u_eline += nl;
+		up->u_eoff = 0;
+	}
+	cutback(up);
+}
+
+/*
+ * All of the text of buffer "bp" is about to go (see bclear()). Forget its
+ * journal, unless it is to be kept; then record the text as taken out.
+ */
+void undo_clear(struct buffer *bp)
+{
+	struct undo *up;
+
+	if ((up = bp->b_undo) == NULL)
+		return;
+	if (!up->u_keep) {
+		ufree(bp);
+		return;
+	}
+	wholelines(bp, lforw(bp->b_linep), bp->b_linep, FALSE);
+	up->u_cleared = TRUE;
+}
+
+/*
+ * Keep the journal of buffer "bp" through bclear() ("keep" is TRUE), so
+ * that text read in to take the place of the old can be undone. When
+ * that is done ("keep" is FALSE) record the new text, if it came in.
+ */
+void undo_keep(struct buffer *bp, int keep)
+{
+	struct undo *up;
+
+	if (keep)
+		up = journal(bp);
+	else
+		up = bp->b_undo;
+	if (up == NULL)
+		return;
+	up->u_keep = keep;
+	if (!keep && up->u_cleared) {
+		up->u_cleared = FALSE;
+		wholelines(bp, lforw(bp->b_linep), bp->b_linep, TRUE);
+	}
+}
+
+/*
+ * Put the "nto" bytes at "to" in place of the "nfrom" bytes at line
+ * "line", offset "off" of the current buffer, the way they went in or out
+ * when they were recorded. A change that stays within a line puts the line
+ * in at once. Return TRUE if all is well.
+ */
+static int apply(long line, int off, long nfrom, char *from, long nto,
+		 char *to)
+{
+	struct lsplice sp;
+	struct line *lp;
+	char *cp;
+	long used;
+
+	lp = lindex_line(curbp, line);
+	if (lp != curbp->b_linep && off + nfrom <= llength(lp)
+	    && memchr(from, '\n', nfrom) == NULL
+	    && memchr(to, '\n', nto) == NULL) {
+		used = llength(lp) - nfrom + nto;
+		if (used > utextsize) {
+			if ((cp = realloc(utext, used)) == NULL) {
+				mlwrite("(OUT OF MEMORY)");
+				return FALSE;
+			}
+			utext = cp;
+			utextsize = used;
+		}
+		memcpy(utext, lp->l_text, off);
+		memcpy(&utext[off], to, nto);
+		memcpy(&utext[off + nto], &lp->l_text[off + nfrom],
+		       llength(lp) - off - nfrom);
+		sp.s_off = off;
+		sp.s_del = nfrom;
+		sp.s_ins = nto;
+		return lreplace(lp, utext, used, &sp, 1);
+	}
+	curwp->w_dotp = lp;
+	curwp->w_doto = off;
+	if (nfrom > 0 && ldelete(nfrom, FALSE) != TRUE)
+		return FALSE;
+	if (nto == 0)
+		return TRUE;
+	if (curwp->w_dotp == curbp->b_linep) {	/* At the end: the last */
+		if (lnewline() != TRUE)	/* newline makes a line */
+			return FALSE;
+		curwp->w_dotp = lback(curbp->b_linep);
+		curwp->w_doto = 0;
+		--nto;
+	}
+	return linstext(to, nto);
+}
+
+/*
+ * Put dot at offset "off" of line "line" of the current buffer.
+ */
+static void setdot(long line, int off)
+{
+	struct line *lp;
+
+	lp = lindex_line(curbp, line);
+	curwp->w_dotp = lp;
+	curwp->w_doto = off < llength(lp) ? off : llength(lp);
+	curwp->w_flag |= WFMOVE;
+}
+
+/*
+ * Something went wrong halfway through a command: the journal no longer
+ * matches the buffer.
+ */
+static int ufail(void)
+{
+	ufree(curbp);
+	mlwrite("(Undo failed, undo information dropped)");
+	return FALSE;
+}
+
+/*
+ * Undo the changes of the last "n" commands in the current buffer, newest
+ * first. Bound to "C-_" and "C-X U".
+ */
+int undo(int f, int n)
+{
+	struct undo *up;
+	struct uchange *hp;
+	char *cp;
+	unsigned cmd;
+	int s;
+
+	if (curbp->b_mode & MDVIEW)	/* don't allow this command if      */
+		return rdonly();	/* we are in read only mode     */
+	if (n < 0)
+		return redo(f, -n);
+	while (n-- > 0) {
+		up = curbp->b_undo;
+		if (up == NULL || up->u_done == 0) {
+			if (up != NULL && up->u_cut)
+				mlwrite("(No more undo information kept)");
+			else
+				mlwrite("(Nothing to undo)");
+			return FALSE;
+		}
+		cmd = up->u_change[up->u_done - 1].h_cmd;
+		undoing = TRUE;
+		do {
+			hp = &up->u_change[--up->u_done];
+			cp = &up->u_text[hp->h_text];
+			s = apply(hp->h_line, hp->h_off, hp->h_ins,
+				  cp + hp->h_del, hp->h_del, cp);
+		} while (s == TRUE && up->u_done > 0
+			 && up->u_change[up->u_done - 1].h_cmd == cmd);
+		undoing = FALSE;
+		if (s != TRUE)
+			return ufail();
+		setdot(hp->h_line, hp->h_off);
+	}
+	return TRUE;
+}
+
+/*
+ * Make the changes of the next "n" commands that were undone in the
+ * current buffer again. Bound to "M-_".
+ */
+int redo(int f, int n)
+{
+	struct undo *up;
+	struct uchange *hp;
+	char *cp;
+	char *end;
+	unsigned cmd;
+	long line;
+	int off;
+	int s;
+
+	if (curbp->b_mode & MDVIEW)	/* don't allow this command if      */
+		return rdonly();	/* we are in read only mode     */
+	if (n < 0)
+		return undo(f, -n);
+	while (n-- > 0) {
+		up = curbp->b_undo;
+		if (up == NULL || up->u_done == up->u_nchange) {
+			mlwrite("(Nothing to redo)");
+			return FALSE;
+		}
+		cmd = up->u_change[up->u_done].h_cmd;
+		undoing = TRUE;
+		do {
+			hp = &up->u_change[up->u_done++];
+			cp = &up->u_text[hp->h_text];
+			s = apply(hp->h_line, hp->h_off, hp->h_del, cp,
+				  hp->h_ins, cp + hp->h_del);
+		} while (s == TRUE && up->u_done < up->u_nchange
+			 && up->u_change[up->u_done].h_cmd == cmd);
+		undoing = FALSE;
+		if (s != TRUE)
+			return ufail();
+		line = hp->h_line;	/* Dot after the new text */
+		off = hp->h_off;
+		for (cp += hp->h_del, end = cp + hp->h_ins; cp < end; ++cp)
+			if (*cp == '\n') {
+				++line;
+				off = 0;
+			} else
+				++off;
+		setdot(line, off);
+	}
+	return TRUE;
+}
@@ -0,0 +1,22 @@
+#ifndef UNDO_H_
+#define UNDO_H_
+
+/*
+ * The undo journal of a buffer. The line functions tell it about every
+ * change they make to the current buffer, as the bytes taken out and the
+ * bytes put in at a place in it: "undo_record" before the old bytes go
+ * away or after the new ones are in, whichever is handy, as long as the
+ * line and offset are where the change starts. "undo_boundary" starts a
+ * new command; the changes a command made are undone and redone as one.
+ */
+struct line;
+struct buffer;
+
+void undo_boundary(int insert);
+void undo_record(struct line *lp, int off, char *del, long ndel,
+	char *ins, long nins);
+void undo_putc(struct line *lp, int off, int c);
+void undo_clear(struct buffer *bp);
+void undo_keep(struct buffer *bp, int keep);
+
+#endif  /* UNDO_H_ */
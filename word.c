@@ -13,6 +13,7 @@
 #include "edef.h"
 #include "efunc.h"
 #include "line.h"
+#include "undo.h"
 
 /* Word wrap on n-spaces. Back-over whatever precedes the point on the current
  * line and stop on the first word-break or the beginning of the line. If we
@@ -136,6 +137,7 @@ int upperword(int f, int n)
 			if (c >= 'a' && c <= 'z') {
 #endif
 				c -= 'a' - 'A';
+				undo_putc(curwp->w_dotp, curwp->w_doto, c);
 				lputc(curwp->w_dotp, curwp->w_doto, c);
 				lchange(WFHARD);
 			}
@@ -172,6 +174,7 @@ int lowerword(int f, int n)
 			if (c >= 'A' && c <= 'Z') {
 #endif
 				c += 'a' - 'A';
+				undo_putc(curwp->w_dotp, curwp->w_doto, c);
 				lputc(curwp->w_dotp, curwp->w_doto, c);
 				lchange(WFHARD);
 			}
@@ -209,6 +212,7 @@ int capword(int f, int n)
 			if (c >= 'a' && c <= 'z') {
 #endif
 				c -= 'a' - 'A';
+				undo_putc(curwp->w_dotp, curwp->w_doto, c);
 				lputc(curwp->w_dotp, curwp->w_doto, c);
 				lchange(WFHARD);
 			}
@@ -222,6 +226,8 @@ int capword(int f, int n)
 				if (c >= 'A' && c <= 'Z') {
 #endif
 					c += 'a' - 'A';
+					undo_putc(curwp->w_dotp,
+						  curwp->w_doto, c);
 					lputc(curwp->w_dotp, curwp->w_doto,
 					      c);
 					lchange(WFHARD);
@@ -255,9 +261,9 @@ int delfword(int f, int n)
 	if (n < 0)
 		return FALSE;
 
-	/* Clear the kill buffer if last command wasn't a kill */
+	/* Start a new kill if last command wasn't a kill */
 	if ((lastflag & CFKILL) == 0)
-		kdelete();
+		kpush();
 	thisflag |= CFKILL;	/* this command is a kill */
 
 	/* save the current cursor position */
@@ -341,9 +347,9 @@ int delbword(int f, int n)
 	if (n <= 0)
 		return FALSE;
 
-	/* Clear the kill buffer if last command wasn't a kill */
+	/* Start a new kill if last command wasn't a kill */
 	if ((lastflag & CFKILL) == 0)
-		kdelete();
+		kpush();
 	thisflag |= CFKILL;	/* this command is a kill */
 
 	if (backchar(FALSE, 1) == FALSE)